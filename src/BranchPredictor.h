@@ -0,0 +1,291 @@
+#ifndef BRANCH_PREDICTOR_H
+#define BRANCH_PREDICTOR_H
+
+#include <vector>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+//Branch prediction for the cycle simulator. Branches resolve in ID there and have a
+//delay slot, so a branch only costs anything when it has to wait in ID for its
+//operands. With a predictor it doesn't wait: fetching goes on down the predicted
+//path and the branch resolves in EX, where a wrong prediction drops the one
+//instruction fetched since (see CycleSim::speculate). j and jal never wait, their
+//targets are in the instruction, so only jr has its target predicted, by the BTB.
+//
+//Every conditional branch trains the direction predictor and every jr the BTB,
+//whether or not they had to wait, and all of them are counted.
+
+enum PredictorType
+{
+    //No prediction: a branch waits in ID for its operands.
+    PREDICT_NONE,
+    //Always predicts not taken.
+    PREDICT_NOT_TAKEN,
+    //A table of 2-bit counters indexed by the PC.
+    PREDICT_BIMODAL,
+    //A table of 2-bit counters indexed by the PC XORed with the global history.
+    PREDICT_GSHARE,
+    //Bimodal and gshare, with a table of 2-bit counters indexed by the PC choosing
+    //between them.
+    PREDICT_TOURNAMENT
+};
+
+struct PredictorConfig
+{
+    PredictorType type = PREDICT_NONE;
+    //Counters in each table. Must be a power of two.
+    uint32_t entries = 1024;
+    //Outcomes of recent branches kept in the global history, for gshare and tournament.
+    uint32_t historyBits = 8;
+    //Entries of the direct-mapped BTB. A power of two, or 0 for no BTB, in which
+    //case jr always waits for its operands.
+    uint32_t btbEntries = 64;
+};
+
+//2-bit saturating counters: 0 and 1 predict not taken, 2 and 3 taken.
+#define COUNTER_WEAK_TAKEN 2
+#define COUNTER_MAX 3
+
+class BranchPredictor
+{
+    public:
+        BranchPredictor(): history(0), lookups(0), mispredicts(0), btbHits(0), btbMisses(0)
+        {
+        }
+
+        //Empties the tables and sets them up for config.
+        int init(const PredictorConfig & config)
+        {
+            bool powersOfTwo = config.entries && !(config.entries & (config.entries - 1)) &&
+                               !(config.btbEntries & (config.btbEntries - 1));
+            if(!powersOfTwo || config.historyBits > 31)
+            {
+                return -EINVAL;
+            }
+
+            cfg = config;
+
+            //Start out weakly not taken.
+            uint32_t tableEntries = cfg.type >= PREDICT_BIMODAL ? cfg.entries : 0;
+            bimodal.assign(cfg.type != PREDICT_GSHARE ? tableEntries : 0, COUNTER_WEAK_TAKEN - 1);
+            gshare.assign(cfg.type >= PREDICT_GSHARE ? tableEntries : 0, COUNTER_WEAK_TAKEN - 1);
+            chooser.assign(cfg.type == PREDICT_TOURNAMENT ? tableEntries : 0, COUNTER_WEAK_TAKEN - 1);
+            history = 0;
+
+            uint32_t btbEntries = cfg.type != PREDICT_NONE ? cfg.btbEntries : 0;
+            btbTags.assign(btbEntries, 0);
+            btbTargets.assign(btbEntries, 0);
+            btbValid.assign(btbEntries, 0);
+
+            lookups = 0;
+            mispredicts = 0;
+            btbHits = 0;
+            btbMisses = 0;
+            return 0;
+        }
+
+        const PredictorConfig & getConfig() const
+        {
+            return cfg;
+        }
+
+        bool isEnabled() const
+        {
+            return cfg.type != PREDICT_NONE;
+        }
+
+        //Predicts whether the conditional branch at pc is taken.
+        bool predict(uint32_t pc) const
+        {
+            switch(cfg.type)
+            {
+                case PREDICT_BIMODAL:
+                    return bimodal[getIndex(pc)] >= COUNTER_WEAK_TAKEN;
+                case PREDICT_GSHARE:
+                    return gshare[getSharedIndex(pc)] >= COUNTER_WEAK_TAKEN;
+                case PREDICT_TOURNAMENT:
+                    if(chooser[getIndex(pc)] >= COUNTER_WEAK_TAKEN)
+                    {
+                        return gshare[getSharedIndex(pc)] >= COUNTER_WEAK_TAKEN;
+                    }
+                    return bimodal[getIndex(pc)] >= COUNTER_WEAK_TAKEN;
+                default:
+                    return false;
+            }
+        }
+
+        //The conditional branch at pc resolved. Counts it, and a misprediction if
+        //predict was wrong, and trains the tables. Returns what predict said.
+        bool update(uint32_t pc, bool taken)
+        {
+            bool predicted = predict(pc);
+            lookups++;
+            mispredicts += predicted != taken;
+
+            if(cfg.type == PREDICT_TOURNAMENT)
+            {
+                //The chooser moves towards whichever of the two was right, if only one was.
+                bool local = bimodal[getIndex(pc)] >= COUNTER_WEAK_TAKEN;
+                bool global = gshare[getSharedIndex(pc)] >= COUNTER_WEAK_TAKEN;
+                if(local != global)
+                {
+                    train(chooser[getIndex(pc)], global == taken);
+                }
+            }
+
+            if(!bimodal.empty())
+            {
+                train(bimodal[getIndex(pc)], taken);
+            }
+
+            if(!gshare.empty())
+            {
+                train(gshare[getSharedIndex(pc)], taken);
+                history = ((history << 1) | (taken ? 1 : 0)) & ((1u << cfg.historyBits) - 1);
+            }
+
+            return predicted;
+        }
+
+        //Looks up the target of the jr at pc in the BTB.
+        bool lookupTarget(uint32_t pc, uint32_t & target) const
+        {
+            if(btbValid.empty())
+            {
+                return false;
+            }
+
+            uint32_t slot = getIndex(pc) & (cfg.btbEntries - 1);
+            if(!btbValid[slot] || btbTags[slot] != pc)
+            {
+                return false;
+            }
+
+            target = btbTargets[slot];
+            return true;
+        }
+
+        //The jr at pc went to target. Counts a hit if the BTB had it right, and
+        //returns whether it did.
+        bool updateTarget(uint32_t pc, uint32_t target)
+        {
+            uint32_t predicted = 0;
+            bool hit = lookupTarget(pc, predicted) && predicted == target;
+            btbHits += hit;
+            btbMisses += !hit;
+
+            if(!btbValid.empty())
+            {
+                uint32_t slot = getIndex(pc) & (cfg.btbEntries - 1);
+                btbValid[slot] = 1;
+                btbTags[slot] = pc;
+                btbTargets[slot] = target;
+            }
+
+            return hit;
+        }
+
+        //Conditional branches resolved, and how many of them predict got wrong.
+        uint32_t getLookups() const
+        {
+            return lookups;
+        }
+
+        uint32_t getMispredicts() const
+        {
+            return mispredicts;
+        }
+
+        //jr resolved with the target in the BTB, and without.
+        uint32_t getBtbHits() const
+        {
+            return btbHits;
+        }
+
+        uint32_t getBtbMisses() const
+        {
+            return btbMisses;
+        }
+
+        //The tables, history and counters, for checkpoints. The layout depends on
+        //the configuration only.
+        size_t getStateSize()
+        {
+            size_t size = 0;
+            visitState([&](void *, size_t bytes) { size += bytes; });
+            return size;
+        }
+
+        void saveState(uint8_t *dst)
+        {
+            visitState([&](void *ptr, size_t bytes)
+            {
+                memcpy(dst, ptr, bytes);
+                dst += bytes;
+            });
+        }
+
+        void loadState(const uint8_t *src)
+        {
+            visitState([&](void *ptr, size_t bytes)
+            {
+                memcpy(ptr, src, bytes);
+                src += bytes;
+            });
+        }
+
+    private:
+        PredictorConfig cfg;
+        std::vector<uint8_t> bimodal;
+        std::vector<uint8_t> gshare;
+        std::vector<uint8_t> chooser;
+        uint32_t history;
+        std::vector<uint32_t> btbTags;
+        std::vector<uint32_t> btbTargets;
+        std::vector<uint8_t> btbValid;
+        uint32_t lookups;
+        uint32_t mispredicts;
+        uint32_t btbHits;
+        uint32_t btbMisses;
+
+        uint32_t getIndex(uint32_t pc) const
+        {
+            return (pc >> 2) & (cfg.entries - 1);
+        }
+
+        uint32_t getSharedIndex(uint32_t pc) const
+        {
+            return ((pc >> 2) ^ history) & (cfg.entries - 1);
+        }
+
+        static void train(uint8_t & counter, bool taken)
+        {
+            if(taken && counter < COUNTER_MAX)
+            {
+                counter++;
+            }
+            else if(!taken && counter > 0)
+            {
+                counter--;
+            }
+        }
+
+        template <typename F>
+        void visitState(F f)
+        {
+            f(bimodal.data(), bimodal.size());
+            f(gshare.data(), gshare.size());
+            f(chooser.data(), chooser.size());
+            f(&history, sizeof(history));
+            f(btbTags.data(), btbTags.size() * sizeof(uint32_t));
+            f(btbTargets.data(), btbTargets.size() * sizeof(uint32_t));
+            f(btbValid.data(), btbValid.size());
+            f(&lookups, sizeof(lookups));
+            f(&mispredicts, sizeof(mispredicts));
+            f(&btbHits, sizeof(btbHits));
+            f(&btbMisses, sizeof(btbMisses));
+        }
+};
+
+#endif
@@ -1,9 +1,44 @@
+#ifndef CACHE_CONFIG_H
+#define CACHE_CONFIG_H
+
 #include <inttypes.h>
 
 enum CacheType
 {
     DIRECT_MAPPED,
-    TWO_WAY_SET_ASSOC
+    TWO_WAY_SET_ASSOC,
+    //Set-associative with CacheConfig::associativity ways.
+    N_WAY_SET_ASSOC,
+    //A single set holding every block.
+    FULLY_ASSOC
+};
+
+//Which block of a full set gets evicted.
+enum ReplacementPolicy
+{
+    //True least-recently-used.
+    REPLACE_LRU,
+    //Tree pseudo-LRU, one bit per internal node of a binary tree over the ways.
+    REPLACE_TREE_PLRU,
+    //A pseudo-random way (from a fixed seed, so runs are repeatable).
+    REPLACE_RANDOM,
+    //Static re-reference interval prediction with 2-bit counters.
+    REPLACE_SRRIP
+};
+
+//How a cache shares blocks with the caches stacked on it (see Cache), e.g. a unified
+//L2 with the L1 I- and D-caches.
+enum InclusionPolicy
+{
+    //Fills go into every level on the way up, and each level evicts on its own.
+    NON_INCLUSIVE,
+    //Everything held above is held here too: evicting a block here takes it out of
+    //the levels above, their dirty bytes coming along.
+    INCLUSIVE,
+    //Nothing held above is held here: a block moves up on a hit here, and comes back
+    //when the level above evicts it. Fills from memory skip this level. Block sizes
+    //have to be the same.
+    EXCLUSIVE
 };
 
 struct CacheConfig
@@ -12,8 +47,47 @@ struct CacheConfig
     uint32_t cacheSize;
     //Cache block size in bytes.
     uint32_t blockSize;
-    //Type of cache - direct-mapped or two-way set-assoc?
+    //Type of cache - direct-mapped, set-assoc or fully associative?
     CacheType type;
-    //Miss latency in cycles.
+    //Miss latency in cycles: the time to fetch a block from the level below. With
+    //another cache below, a miss there adds that cache's missLatency on top.
     uint32_t missLatency;
+    //Number of ways of an N_WAY_SET_ASSOC cache. Must be a power of two.
+    uint32_t associativity = 0;
+    //Replacement policy for caches with more than one way.
+    ReplacementPolicy replacement = REPLACE_LRU;
+    //Miss status holding registers, i.e. misses that can be outstanding at once. 0
+    //makes the cache blocking: an access that misses waits for its data. Otherwise
+    //a load that misses only holds up the instructions using the loaded register, a
+    //store that misses doesn't wait at all, and accesses to a block already on its
+    //way wait for it rather than missing again. Only the cycle simulator's D-cache
+    //models this.
+    uint32_t mshrs = 0;
+    //Critical word first: cycles between consecutive words of a block fill. The
+    //word that missed comes first and the others follow in wrap-around order, the
+    //last arriving missLatency cycles after the miss. 0 delivers the whole block at
+    //once. Also D-cache only.
+    uint32_t wordCycles = 0;
+    //Only matters for caches with others stacked on them.
+    InclusionPolicy inclusion = NON_INCLUSIVE;
 };
+
+//Number of ways in each set of a cache with the given configuration.
+inline uint32_t getCacheWays(const CacheConfig & cfg)
+{
+    switch(cfg.type)
+    {
+        case DIRECT_MAPPED:
+            return 1;
+        case TWO_WAY_SET_ASSOC:
+            return 2;
+        case N_WAY_SET_ASSOC:
+            return cfg.associativity;
+        case FULLY_ASSOC:
+            return cfg.cacheSize / cfg.blockSize;
+    }
+
+    return 1;
+}
+
+#endif
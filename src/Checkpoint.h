@@ -0,0 +1,219 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <iostream>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "MemoryStore.h"
+#include "CacheConfig.h"
+#include "BranchPredictor.h"
+
+//Binary checkpoints of a simulator run. A checkpoint is a CheckpointHeader followed
+//by one section per CheckpointSection, each starting on a page boundary:
+//  core    registers, PC, LL/SC state, pipeline latches and the cycle count
+//  memory  the memory image, MEMORY_SIZE bytes in big-endian byte order
+//  icache  the I-cache lines, replacement state and hit/miss counters
+//  dcache  the same for the D-cache
+//  l2      the same for the L2 cache, empty without one
+//  bpred   the branch predictor tables and BTB
+//Everything is stored in host byte order, so checkpoints are not meant to move
+//between machines. Files are written and read through mmap: restoring a checkpoint
+//only faults in the pages that are actually copied out of it.
+
+#define CHECKPOINT_MAGIC 0x54504b43
+#define CHECKPOINT_VERSION 8
+
+enum CheckpointSection
+{
+    CKPT_CORE,
+    CKPT_MEMORY,
+    CKPT_ICACHE,
+    CKPT_DCACHE,
+    CKPT_L2CACHE,
+    CKPT_PREDICTOR,
+    NUM_CKPT_SECTIONS
+};
+
+struct CheckpointHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    //MEMORY_SIZE of the simulator that wrote the checkpoint.
+    uint32_t memorySize;
+    uint32_t numSections;
+    //The caches and the branch predictor are rebuilt from these before their state
+    //is loaded.
+    CacheConfig icConfig;
+    CacheConfig dcConfig;
+    //A cacheSize of 0 for no L2.
+    CacheConfig l2Config;
+    PredictorConfig bpConfig;
+    uint64_t offset[NUM_CKPT_SECTIONS];
+    uint64_t size[NUM_CKPT_SECTIONS];
+};
+
+//A checkpoint file mapped into memory. One opened checkpoint can be restored into
+//any number of simulators.
+class Checkpoint
+{
+    public:
+        Checkpoint(): map(NULL), length(0)
+        {
+        }
+
+        ~Checkpoint()
+        {
+            close();
+        }
+
+        //Creates fileName with room for sections of the given sizes and maps it for
+        //writing. Everything but the section layout is left for the caller to fill in.
+        int create(const char *fileName, const uint64_t sizes[NUM_CKPT_SECTIONS])
+        {
+            close();
+
+            uint64_t offsets[NUM_CKPT_SECTIONS];
+            uint64_t end = roundToPage(sizeof(CheckpointHeader));
+            for(int i = 0 ; i < NUM_CKPT_SECTIONS ; i++)
+            {
+                offsets[i] = end;
+                end = roundToPage(end + sizes[i]);
+            }
+
+            int fd = ::open(fileName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if(fd < 0)
+            {
+                std::cout << "Could not create checkpoint file " << fileName << std::endl;
+                return -EBADF;
+            }
+
+            if(ftruncate(fd, end) || mapFile(fd, end, PROT_READ | PROT_WRITE, MAP_SHARED))
+            {
+                std::cout << "Could not map checkpoint file " << fileName << std::endl;
+                ::close(fd);
+                return -EIO;
+            }
+            ::close(fd);
+
+            CheckpointHeader & hdr = header();
+            hdr = CheckpointHeader();
+            hdr.magic = CHECKPOINT_MAGIC;
+            hdr.version = CHECKPOINT_VERSION;
+            hdr.memorySize = MEMORY_SIZE;
+            hdr.numSections = NUM_CKPT_SECTIONS;
+            for(int i = 0 ; i < NUM_CKPT_SECTIONS ; i++)
+            {
+                hdr.offset[i] = offsets[i];
+                hdr.size[i] = sizes[i];
+            }
+
+            return 0;
+        }
+
+        //Maps an existing checkpoint for reading and checks its header.
+        int open(const char *fileName)
+        {
+            close();
+
+            int fd = ::open(fileName, O_RDONLY);
+            if(fd < 0)
+            {
+                std::cout << "Could not open checkpoint file " << fileName << std::endl;
+                return -EBADF;
+            }
+
+            struct stat st;
+            if(fstat(fd, &st) || static_cast<uint64_t>(st.st_size) < sizeof(CheckpointHeader) ||
+               mapFile(fd, st.st_size, PROT_READ, MAP_PRIVATE))
+            {
+                std::cout << fileName << " is not a checkpoint file" << std::endl;
+                ::close(fd);
+                return -EINVAL;
+            }
+            ::close(fd);
+
+            const CheckpointHeader & hdr = header();
+            if(hdr.magic != CHECKPOINT_MAGIC)
+            {
+                std::cout << fileName << " is not a checkpoint file" << std::endl;
+                close();
+                return -EINVAL;
+            }
+
+            if(hdr.version != CHECKPOINT_VERSION || hdr.numSections != NUM_CKPT_SECTIONS ||
+               hdr.memorySize != MEMORY_SIZE)
+            {
+                std::cout << "Unsupported checkpoint version " << hdr.version << std::endl;
+                close();
+                return -EINVAL;
+            }
+
+            for(int i = 0 ; i < NUM_CKPT_SECTIONS ; i++)
+            {
+                if(hdr.offset[i] > length || hdr.size[i] > length - hdr.offset[i])
+                {
+                    std::cout << fileName << " is truncated" << std::endl;
+                    close();
+                    return -EINVAL;
+                }
+            }
+
+            return 0;
+        }
+
+        //Unmaps the file. A checkpoint being written is complete after this.
+        void close()
+        {
+            if(map)
+            {
+                munmap(map, length);
+                map = NULL;
+                length = 0;
+            }
+        }
+
+        CheckpointHeader & header()
+        {
+            return *reinterpret_cast<CheckpointHeader *>(map);
+        }
+
+        //Start of a section. Only writable in checkpoints made with create.
+        uint8_t *section(CheckpointSection sect)
+        {
+            return map + header().offset[sect];
+        }
+
+        uint64_t sectionSize(CheckpointSection sect)
+        {
+            return header().size[sect];
+        }
+
+    private:
+        uint8_t *map;
+        size_t length;
+
+        static uint64_t roundToPage(uint64_t value)
+        {
+            uint64_t page = sysconf(_SC_PAGESIZE);
+            return (value + page - 1) / page * page;
+        }
+
+        int mapFile(int fd, size_t size, int prot, int flags)
+        {
+            void *addr = mmap(NULL, size, prot, flags, fd, 0);
+            if(addr == MAP_FAILED)
+            {
+                return -EIO;
+            }
+
+            map = static_cast<uint8_t *>(addr);
+            length = size;
+            return 0;
+        }
+};
+
+#endif
@@ -0,0 +1,443 @@
+#ifndef CYCLE_SIM_H
+#define CYCLE_SIM_H
+
+#include "MemoryStore.h"
+#include "CacheConfig.h"
+#include "RegisterInfo.h"
+#include "DriverFunctions.h"
+#include "MipsDefs.h"
+#include "cache.h"
+#include "Checkpoint.h"
+#include "PipeTrace.h"
+#include "Profiler.h"
+#include "StatsRegistry.h"
+#include "StateHash.h"
+#include "BranchPredictor.h"
+
+//Why a bubble is in the pipeline, for the CPI stack. A bubble reaching WB is a
+//cycle lost to its cause.
+enum BubbleCause
+{
+    //Filling and draining the pipeline.
+    BUBBLE_BASE,
+    //ID waiting for a load in EX.
+    BUBBLE_LOAD_USE,
+    //A branch in ID waiting for the result of the instruction in EX or a load in MEM.
+    BUBBLE_BRANCH_HAZARD,
+    //ID waiting for a register still being filled by the D-cache.
+    BUBBLE_FILL_WAIT,
+    BUBBLE_ICACHE,
+    BUBBLE_DCACHE,
+    //Instructions dropped by an exception.
+    BUBBLE_FLUSH,
+    //An instruction fetched down the wrong path of a predicted branch, dropped.
+    BUBBLE_MISPREDICT,
+    NUM_BUBBLE_CAUSES
+};
+
+//An instruction in flight through the pipeline. A bubble has an all-zero word,
+//which dumpPipeState prints as a nop.
+struct PipeInst
+{
+    //Set for everything but bubbles (a nop has a zero word too).
+    bool valid;
+    uint32_t word;
+    uint32_t pc;
+    uint8_t opcode;
+    uint8_t funct;
+    uint8_t rs;
+    uint8_t rt;
+    uint8_t shamt;
+    //Register written in WB, 0 if none.
+    uint8_t dest;
+    //A BubbleCause, for bubbles.
+    uint8_t bubble;
+    //Extended immediate, branch displacement or jump target, like DecodedInst::imm.
+    uint32_t imm;
+    //Registers read and written, one bit per register, so that every hazard check is
+    //an AND of two masks. The zero register is never in either.
+    uint32_t srcMask;
+    uint32_t destMask;
+    //destMask of loads and SC, whose result is only known at the end of MEM, and 0
+    //for everything else. Such results can't be forwarded from MEM.
+    uint32_t lateMask;
+    //The result is only known at the end of MEM (loads and SC).
+    bool isLoad;
+    bool isStore;
+    bool isControl;
+    bool isHalt;
+    bool isIllegal;
+    //A branch that left ID before its operands were ready, on a prediction that
+    //fetching goes on at predictedPC after the delay slot.
+    bool speculated;
+    uint32_t predictedPC;
+    //Set once the stage holding the instruction has done its work, so stalled
+    //instructions don't do it again.
+    bool done;
+    //Operand values read in EX.
+    uint32_t rsVal;
+    uint32_t rtVal;
+    //ALU result, loaded value or link address.
+    uint32_t result;
+    uint32_t addr;
+};
+
+//Per-opcode counters: one per opcode, one per R-type funct and one for nops.
+#define NUM_OPCODE_STATS (64 + 64 + 1)
+
+//The counters CycleSim keeps in a StatsRegistry, all NULL without one.
+struct CycleStats
+{
+    StatCounter *cycles;
+    StatCounter *instructions;
+    StatCounter *loadUse;
+    StatCounter *branchHazard;
+    StatCounter *fillWait;
+    StatCounter *icacheStall;
+    StatCounter *dcacheStall;
+    StatCounter *flushes;
+    StatCounter *branches;
+    StatCounter *mispredicts;
+    StatCounter *speculated;
+    StatCounter *wrongPath;
+    StatCounter *btbHits;
+    StatCounter *btbMisses;
+    //The CPI stack component each cause is charged to.
+    StatCounter *cpi[NUM_BUBBLE_CAUSES];
+    //Registered as each opcode first retires.
+    StatCounter *opcodes[NUM_OPCODE_STATS];
+    StatHistogram *dcacheMissLatency;
+};
+
+//Most D-cache misses that can be outstanding at once (CacheConfig::mshrs).
+#define MAX_MSHRS 16
+
+//A D-cache block fill in flight - a miss status holding register.
+struct Mshr
+{
+    uint32_t blockAddr;
+    //The word that missed arrives at the end of firstCycle, and the rest of the
+    //block every CacheConfig::wordCycles cycles after it.
+    uint32_t firstCycle;
+    uint32_t firstWord;
+    //The whole block is in at the end of doneCycle, after which the MSHR is free.
+    uint32_t doneCycle;
+};
+
+//A five-stage MIPS pipeline (IF, ID, EX, MEM, WB) with split I- and D-caches.
+//Branches and jumps resolve in ID and have a delay slot, so without a branch
+//predictor (see BranchPredictor.h) nothing is ever fetched down a wrong path.
+//Results are forwarded to EX from MEM and WB, and to ID (for branches) from MEM and
+//WB. A load followed by a use stalls one cycle, a branch using the result of the
+//instruction right before it stalls one cycle (two after a load) unless it is
+//predicted. A cache miss holds its stage for the miss latency; a D-cache miss stalls
+//everything behind it. A non-blocking D-cache (see CacheConfig::mshrs) instead lets
+//loads that miss leave MEM and write their register once the data arrives, with ID
+//holding back anything that uses the register until then.
+//
+//An instance owns all architectural and microarchitectural state of one run, so
+//any number of them can run at once on different threads as long as each has its
+//own memory and dumps are turned off (the dump files are shared by name).
+class CycleSim
+{
+    public:
+        CycleSim();
+        ~CycleSim();
+
+        //Starts a run of the program in mainMem from address 0. mainMem is not owned
+        //and must outlive the simulator.
+        int init(CacheConfig & icConfig, CacheConfig & dcConfig, MemoryStore *mainMem);
+
+        //Runs the given number of cycles, or until the program halts, then dumps the
+        //state of the pipeline in the last cycle run.
+        int runCycles(uint32_t cycles);
+
+        //Runs until the program halts, then dumps the state of the pipeline.
+        int runTillHalt();
+
+        //Writes back the caches and dumps registers, memory and statistics.
+        int finalize();
+
+        //Turns the pipe_state.out/reg_state.out/mem_state.out/sim_stats.out dumps on
+        //or off. They are on by default.
+        void setDumpsEnabled(bool enabled)
+        {
+            dumps = enabled;
+        }
+
+        //Records the stages of every cycle run from now on in trace, which stays the
+        //caller's. NULL stops tracing.
+        void setPipeTrace(PipeTraceBuffer *trace)
+        {
+            pipeTrace = trace;
+        }
+
+        //Profiles every instruction retired from now on, with the cache misses,
+        //stall cycles and flushes it caused. NULL turns profiling off.
+        void setProfiler(Profiler *profiler)
+        {
+            this->profiler = profiler;
+        }
+
+        //Counts stalls, flushes, retired opcodes, D-cache miss latencies and the
+        //CPI stack (see StatsRegistry.h) in stats, which stays the caller's, from
+        //now on. NULL stops counting.
+        void setStats(StatsRegistry *stats);
+
+        //Predicts branches that would otherwise wait in ID for their operands (see
+        //BranchPredictor.h). Must be called after init, which starts out with no
+        //prediction.
+        int setBranchPredictor(const PredictorConfig & config);
+
+        //Puts a unified L2 cache between the L1 caches and memory, or takes it out
+        //again for a cacheSize of 0. Its blocks can't be smaller than those of the
+        //L1 caches. The L1 miss latencies become the time to fetch a block from the
+        //L2, and an L2 miss adds the L2's. Empties the caches, so it must be called
+        //after init (which starts out without an L2) and before running.
+        int setL2Cache(const CacheConfig & config);
+
+        const BranchPredictor & getBranchPredictor() const
+        {
+            return predictor;
+        }
+
+        //Reports every instruction retired, with its store, to hash from now on (see
+        //StateHash.h). NULL turns it off.
+        void setStateHash(StateHash *hash)
+        {
+            stateHash = hash;
+        }
+
+        bool isHalted() const
+        {
+            return halted;
+        }
+
+        SimulationStats getStats() const;
+
+        //The stages of the last cycle run.
+        PipeState getPipeState() const
+        {
+            return pipeState;
+        }
+
+        void fillRegisterState(RegisterInfo & reg) const;
+
+        //D-cache accesses to a block that was still being filled, and cycles MEM
+        //waited for a free MSHR.
+        uint32_t getDCacheMerged() const
+        {
+            return dcMerged;
+        }
+
+        uint32_t getMshrStallCycles() const
+        {
+            return mshrStalls;
+        }
+
+        //Branches that left ID on a prediction, and cycles lost to those predicted
+        //wrongly.
+        uint32_t getSpeculatedBranches() const
+        {
+            return speculatedBranches;
+        }
+
+        uint32_t getMispredictCycles() const
+        {
+            return mispredictCycles;
+        }
+
+        //Instructions that have left WB, not counting the end of the program.
+        uint64_t getRetired() const
+        {
+            return retired;
+        }
+
+        //Runs until count more instructions have retired or the program halts.
+        int runInstructions(uint64_t count);
+
+        //Stops fetching (apart from the delay slot of a branch already fetched) and
+        //runs until the pipeline is empty or the program halts. The architectural
+        //state is then exactly that of an instruction boundary.
+        int drain();
+
+        //Only meaningful on a drained pipeline.
+        void getArchState(ArchState & state) const;
+
+        //Continues from the given state with an empty pipeline. The caches, cycle
+        //count and retired count are kept.
+        void setArchState(const ArchState & state);
+
+        Cache *getICache()
+        {
+            return icache;
+        }
+
+        Cache *getDCache()
+        {
+            return dcache;
+        }
+
+        //NULL without an L2.
+        Cache *getL2Cache()
+        {
+            return l2cache;
+        }
+
+        //Writes every dirty line back to memory, through the L2 if there is one.
+        void writeBackCaches();
+
+        //Re-reads every cache line from memory, after it was changed behind the
+        //caches' back. They must have been written back first.
+        void reloadCaches();
+
+        //Writes everything needed to continue the run later - including memory and
+        //both caches - to a checkpoint file (see Checkpoint.h).
+        int saveCheckpoint(const char *fileName);
+
+        //Continues the run saved in a checkpoint, replacing whatever this simulator
+        //was doing. The memory image is loaded into mainMem, which becomes the
+        //simulator's memory like in init.
+        int restoreCheckpoint(Checkpoint & checkpoint, MemoryStore *mainMem);
+        int restoreCheckpoint(const char *fileName, MemoryStore *mainMem);
+
+    private:
+        MemoryStore *mem;
+        Cache *icache;
+        Cache *dcache;
+        Cache *l2cache;
+        CacheConfig icConfig;
+        CacheConfig dcConfig;
+        CacheConfig l2Config;
+
+        uint32_t regs[NUM_REGS];
+        bool ll_sc_flag;
+        uint32_t ll_sc_addr;
+
+        uint32_t cycle;
+        uint64_t retired;
+        bool halted;
+        bool dumps;
+        PipeState pipeState;
+        PipeTraceBuffer *pipeTrace;
+        Profiler *profiler;
+        StatsRegistry *statsRegistry;
+        StateHash *stateHash;
+        CycleStats stats;
+        //An exception dropped ID and IF this cycle.
+        bool flushed;
+        //A mispredicted branch dropped IF this cycle.
+        bool mispredicted;
+        BranchPredictor predictor;
+
+        //IF: the instruction being fetched, and the cycles left until it arrives.
+        bool ifValid;
+        uint32_t ifPC;
+        uint32_t ifWord;
+        uint32_t ifStall;
+        //Where the next fetch goes.
+        uint32_t fetchPC;
+        //A branch in ID was taken: fetch from branchTarget once the delay slot has left IF.
+        bool branchPending;
+        uint32_t branchTarget;
+        //The end of the program has been fetched.
+        bool fetchHalted;
+        //Set by drain: fetch only what delaySlotDue asks for.
+        bool draining;
+        //The last instruction fetched was a branch or jump.
+        bool delaySlotDue;
+        //A branch that left ID on a prediction hasn't resolved yet.
+        bool speculating;
+
+        PipeInst id;
+        PipeInst ex;
+        PipeInst memStage;
+        PipeInst wb;
+        //Cycles left until the D-cache miss of the instruction in MEM is served.
+        uint32_t memStall;
+
+        //D-cache fills in flight. A blocking D-cache only ever uses the first one.
+        Mshr mshrs[MAX_MSHRS];
+        uint32_t numMshrs;
+        //Loads that left MEM before their data arrived: register r gets
+        //pendingValue[r] at the end of pendingCycle[r] if its bit in pendingRegs is
+        //still set by then.
+        uint32_t pendingRegs;
+        uint32_t pendingCycle[NUM_REGS];
+        uint32_t pendingValue[NUM_REGS];
+        uint32_t dcMerged;
+        uint32_t mshrStalls;
+        uint32_t speculatedBranches;
+        uint32_t mispredictCycles;
+        //Why doDecode last stalled ID.
+        BubbleCause idStallCause;
+
+        void reset();
+        size_t getCoreStateSize();
+        static void decode(uint32_t word, uint32_t pc, PipeInst & inst);
+        uint32_t forward(uint8_t reg) const;
+        void raiseException(PipeInst & inst);
+        int startFetch();
+        int doMemAccess(PipeInst & inst);
+        Mshr *findFill(uint32_t addr);
+        Mshr *startFill(uint32_t addr, uint32_t latency, uint32_t & start);
+        uint32_t wordReady(const Mshr & fill, uint32_t addr) const;
+        void finishMemAccess(PipeInst & inst, bool missed, uint32_t latency);
+        void writeFilledRegs();
+        bool waitsForFill(const PipeInst & inst) const;
+        static uint32_t resolveBranch(const PipeInst & inst, uint32_t rsVal, uint32_t rtVal, bool & taken);
+        void trainPredictor(const PipeInst & inst, bool taken, uint32_t target);
+        bool speculate(PipeInst & inst);
+        void checkPrediction(const PipeInst & inst);
+        void doExecute(PipeInst & inst);
+        bool doDecode(PipeInst & inst);
+        bool isEmpty() const;
+        int step();
+        uint32_t idleCycles() const;
+        void skipCycles(uint32_t count);
+        void traceSkipped(uint32_t count);
+        void profileSkipped(uint32_t count);
+        void skipBubbles(uint32_t count);
+        void countRetired(const PipeInst & inst);
+        void hashRetired(const PipeInst & inst);
+        int advance(uint32_t maxCycles, uint32_t & ran);
+        void dumpPipe();
+
+        //Calls f(pointer, bytes) for every part of the core state, in checkpoint order.
+        template <typename F>
+        void visitCoreState(F f)
+        {
+            f(regs, sizeof(regs));
+            f(&ll_sc_flag, sizeof(ll_sc_flag));
+            f(&ll_sc_addr, sizeof(ll_sc_addr));
+            f(&cycle, sizeof(cycle));
+            f(&retired, sizeof(retired));
+            f(&halted, sizeof(halted));
+            f(&pipeState, sizeof(pipeState));
+            f(&ifValid, sizeof(ifValid));
+            f(&ifPC, sizeof(ifPC));
+            f(&ifWord, sizeof(ifWord));
+            f(&ifStall, sizeof(ifStall));
+            f(&fetchPC, sizeof(fetchPC));
+            f(&branchPending, sizeof(branchPending));
+            f(&branchTarget, sizeof(branchTarget));
+            f(&fetchHalted, sizeof(fetchHalted));
+            f(&delaySlotDue, sizeof(delaySlotDue));
+            f(&speculating, sizeof(speculating));
+            f(&id, sizeof(id));
+            f(&ex, sizeof(ex));
+            f(&memStage, sizeof(memStage));
+            f(&wb, sizeof(wb));
+            f(&memStall, sizeof(memStall));
+            f(mshrs, sizeof(mshrs));
+            f(&pendingRegs, sizeof(pendingRegs));
+            f(pendingCycle, sizeof(pendingCycle));
+            f(pendingValue, sizeof(pendingValue));
+            f(&dcMerged, sizeof(dcMerged));
+            f(&mshrStalls, sizeof(mshrStalls));
+            f(&speculatedBranches, sizeof(speculatedBranches));
+            f(&mispredictCycles, sizeof(mispredictCycles));
+        }
+};
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef DISASSEMBLER_H
+#define DISASSEMBLER_H
+
+#include <string>
+#include <stdio.h>
+#include "MipsDefs.h"
+
+//Disassembles instruction words into the same text dumpPipeState prints, for tools
+//that render instructions themselves (dumpPipeState only writes pipe_state.out).
+
+inline const char *getRegName(uint8_t reg)
+{
+    static const char *const names[NUM_REGS] =
+    {
+        "$zero", "$at", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3",
+        "$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7",
+        "$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7",
+        "$t8", "$t9", "$k0", "$k1", "$gp", "$sp", "$fp", "$ra"
+    };
+
+    return names[reg & 0x1f];
+}
+
+inline std::string disassemble(uint32_t word)
+{
+    if(word == 0)
+    {
+        return "nop";
+    }
+
+    if(word == MAGIC_DEMARC)
+    {
+        return "HALT";
+    }
+
+    const char *rs = getRegName((word >> 21) & 0x1f);
+    const char *rt = getRegName((word >> 16) & 0x1f);
+    const char *rd = getRegName((word >> 11) & 0x1f);
+    uint32_t imm = word & 0xffff;
+    int32_t offset = static_cast<int16_t>(imm);
+    const char *name = NULL;
+    char buf[64];
+
+    switch(getOpcode(word))
+    {
+        case OP_ZERO:
+            switch(word & 0x3f)
+            {
+                case FUN_SLL:
+                case FUN_SRL:
+                    snprintf(buf, sizeof(buf), "%s %s, %s, %u", (word & 0x3f) == FUN_SLL ? "sll" : "srl",
+                             rd, rt, (word >> 6) & 0x1f);
+                    return buf;
+                case FUN_JR:
+                    return std::string("jr ") + rs;
+                case FUN_ADD: name = "add"; break;
+                case FUN_ADDU: name = "addu"; break;
+                case FUN_AND: name = "and"; break;
+                case FUN_NOR: name = "nor"; break;
+                case FUN_OR: name = "or"; break;
+                case FUN_SLT: name = "slt"; break;
+                case FUN_SLTU: name = "sltu"; break;
+                case FUN_SUB: name = "sub"; break;
+                case FUN_SUBU: name = "subu"; break;
+                default: name = "ILLEGAL"; break;
+            }
+            snprintf(buf, sizeof(buf), "%s %s, %s, %s", name, rd, rs, rt);
+            return buf;
+        case OP_ADDI: name = "addi"; break;
+        case OP_ADDIU: name = "addiu"; break;
+        case OP_ANDI: name = "andi"; break;
+        case OP_ORI: name = "ori"; break;
+        case OP_SLTI: name = "slti"; break;
+        case OP_SLTIU: name = "sltiu"; break;
+        case OP_LUI:
+            snprintf(buf, sizeof(buf), "lui %s, 0x%x", rt, imm);
+            return buf;
+        case OP_BEQ:
+        case OP_BNE:
+            snprintf(buf, sizeof(buf), "%s %s, %s, 0x%x", getOpcode(word) == OP_BEQ ? "beq" : "bne", rs, rt, imm);
+            return buf;
+        case OP_LBU: name = "lbu"; break;
+        case OP_LHU: name = "lhu"; break;
+        case OP_LL: name = "ll"; break;
+        case OP_LW: name = "lw"; break;
+        case OP_SB: name = "sb"; break;
+        case OP_SC: name = "sc"; break;
+        case OP_SH: name = "sh"; break;
+        case OP_SW: name = "sw"; break;
+        case OP_J:
+        case OP_JAL:
+            snprintf(buf, sizeof(buf), "%s 0x%x", getOpcode(word) == OP_J ? "j" : "jal", word & 0x3ffffff);
+            return buf;
+        default:
+            return "ILLEGAL";
+    }
+
+    //What's left are the immediate ALU ops and the loads and stores.
+    switch(getOpcode(word))
+    {
+        case OP_ADDI:
+        case OP_ADDIU:
+        case OP_ANDI:
+        case OP_ORI:
+        case OP_SLTI:
+        case OP_SLTIU:
+            snprintf(buf, sizeof(buf), "%s %s, %s, 0x%x", name, rt, rs, imm);
+            break;
+        default:
+            snprintf(buf, sizeof(buf), "%s %s, %d(%s)", name, rt, offset, rs);
+            break;
+    }
+
+    return buf;
+}
+
+#endif
@@ -1,4 +1,8 @@
+#ifndef DRIVER_FUNCTIONS_H
+#define DRIVER_FUNCTIONS_H
+
 #include "CacheConfig.h"
+#include "MemoryStore.h"
 
 struct PipeState
 {
@@ -28,3 +32,5 @@ int initSimulator(CacheConfig & icConfig, CacheConfig & dcConfig, MemoryStore *m
 int runCycles(uint32_t cycles);
 int runTillHalt();
 int finalizeSimulator();
+
+#endif
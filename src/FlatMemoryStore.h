@@ -0,0 +1,235 @@
+#ifndef FLAT_MEMORY_STORE_H
+#define FLAT_MEMORY_STORE_H
+
+#include <iostream>
+#include <string.h>
+#include <errno.h>
+#include "MemoryStore.h"
+
+//Converts between host order and the big-endian order of the simulated machine.
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define HostToBigEndianWord(value) __builtin_bswap32(value)
+#define HostToBigEndianHalf(value) __builtin_bswap16(value)
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define HostToBigEndianWord(value) (value)
+#define HostToBigEndianHalf(value) (value)
+#else
+#include "EndianHelpers.h"
+#define HostToBigEndianWord(value) ConvertWordToBigEndian(value)
+#define HostToBigEndianHalf(value) ConvertHalfWordToBigEndian(value)
+#endif
+
+//A flat memory store with no virtual calls on its fast path. The whole MEMORY_SIZE
+//image lives in one array laid out exactly as the simulated memory is, so loading a
+//program image is a plain copy; half words and words are byte-swapped only when they
+//are accessed. Code holding a FlatMemoryStore pointer gets the inline accessors (and,
+//as the class is final, devirtualized getMemValue/setMemValue calls), while anything
+//else can keep using it through the MemoryStore interface.
+class FlatMemoryStore final : public MemoryStore, public BlockMemory
+{
+    public:
+        FlatMemoryStore()
+        {
+            memset(data, 0, sizeof(data));
+        }
+
+        //Is [address, address + size) accessible? See inMemoryRange.
+        static bool inRange(uint32_t address, uint32_t size)
+        {
+            return inMemoryRange(address, size);
+        }
+
+        //Unchecked accessors. Callers must have checked the range with inRange.
+        uint8_t readByte(uint32_t address) const
+        {
+            return data[address];
+        }
+
+        uint16_t readHalf(uint32_t address) const
+        {
+            uint16_t value;
+            memcpy(&value, data + address, sizeof(value));
+            return HostToBigEndianHalf(value);
+        }
+
+        uint32_t readWord(uint32_t address) const
+        {
+            uint32_t value;
+            memcpy(&value, data + address, sizeof(value));
+            return HostToBigEndianWord(value);
+        }
+
+        void writeByte(uint32_t address, uint8_t value)
+        {
+            data[address] = value;
+        }
+
+        void writeHalf(uint32_t address, uint16_t value)
+        {
+            value = HostToBigEndianHalf(value);
+            memcpy(data + address, &value, sizeof(value));
+        }
+
+        void writeWord(uint32_t address, uint32_t value)
+        {
+            value = HostToBigEndianWord(value);
+            memcpy(data + address, &value, sizeof(value));
+        }
+
+        //The raw memory image, in simulated (big-endian) byte order.
+        uint8_t *bytes()
+        {
+            return data;
+        }
+
+        const uint8_t *bytes() const
+        {
+            return data;
+        }
+
+        int getMemValue(uint32_t address, uint32_t & value, MemEntrySize size) override
+        {
+            if(!inRange(address, size))
+            {
+                std::cerr << "Address 0x" << std::hex << address << " is out of range" << std::endl;
+                return -EINVAL;
+            }
+
+            switch(size)
+            {
+                case BYTE_SIZE:
+                    value = readByte(address);
+                    break;
+                case HALF_SIZE:
+                    value = readHalf(address);
+                    break;
+                case WORD_SIZE:
+                    value = readWord(address);
+                    break;
+                default:
+                    std::cerr << "Invalid size passed, cannot read/write memory" << std::endl;
+                    return -EINVAL;
+            }
+
+            return 0;
+        }
+
+        int setMemValue(uint32_t address, uint32_t value, MemEntrySize size) override
+        {
+            if(!inRange(address, size))
+            {
+                std::cerr << "Address 0x" << std::hex << address << " is out of range" << std::endl;
+                return -EINVAL;
+            }
+
+            switch(size)
+            {
+                case BYTE_SIZE:
+                    writeByte(address, value);
+                    break;
+                case HALF_SIZE:
+                    writeHalf(address, value);
+                    break;
+                case WORD_SIZE:
+                    writeWord(address, value);
+                    break;
+                default:
+                    std::cerr << "Invalid size passed, cannot read/write memory" << std::endl;
+                    return -EINVAL;
+            }
+
+            return 0;
+        }
+
+        int readBlock(uint32_t address, uint8_t *dst, uint32_t size) override
+        {
+            if(inRange(address, size))
+            {
+                memcpy(dst, data + address, size);
+                return 0;
+            }
+
+            //Copy whatever is accessible, like reading a byte at a time would.
+            for(uint32_t i = 0 ; i < size ; i++)
+            {
+                dst[i] = inRange(address + i, BYTE_SIZE) ? data[address + i] : 0;
+            }
+
+            return blockOutOfRange(address, size);
+        }
+
+        int writeBlock(uint32_t address, const uint8_t *src, uint32_t size) override
+        {
+            if(inRange(address, size))
+            {
+                memcpy(data + address, src, size);
+                return 0;
+            }
+
+            for(uint32_t i = 0 ; i < size ; i++)
+            {
+                if(inRange(address + i, BYTE_SIZE))
+                {
+                    data[address + i] = src[i];
+                }
+            }
+
+            return blockOutOfRange(address, size);
+        }
+
+        //Printing goes through a copy in the reference store so that the output
+        //format is exactly the same as everywhere else.
+        int printMemory(uint32_t startAddress, uint32_t endAddress) override
+        {
+            MemoryStore *copy = copyToMemoryStore();
+            int ret = copy->printMemory(startAddress, endAddress);
+            delete copy;
+            return ret;
+        }
+
+        //Returns a copy of this memory in a store created by createMemoryStore.
+        MemoryStore *copyToMemoryStore() const
+        {
+            MemoryStore *copy = createMemoryStore();
+
+            uint32_t addr = 0;
+
+            for( ; inRange(addr, WORD_SIZE) ; addr += WORD_SIZE)
+            {
+                copy->setMemValue(addr, readWord(addr), WORD_SIZE);
+            }
+
+            for( ; inRange(addr, BYTE_SIZE) ; addr++)
+            {
+                copy->setMemValue(addr, readByte(addr), BYTE_SIZE);
+            }
+
+            return copy;
+        }
+
+    private:
+        uint8_t data[MEMORY_SIZE];
+
+        static int blockOutOfRange(uint32_t address, uint32_t size)
+        {
+            uint32_t bad = address;
+            while(inRange(bad, BYTE_SIZE) && bad - address < size)
+            {
+                bad++;
+            }
+
+            std::cerr << "Address 0x" << std::hex << bad << " is out of range" << std::endl;
+            return -EINVAL;
+        }
+};
+
+//dumpMemoryState only understands the stores made by createMemoryStore, so dump a
+//flat store through a copy.
+inline void dumpMemoryState(FlatMemoryStore *mem)
+{
+    MemoryStore *copy = mem->copyToMemoryStore();
+    dumpMemoryState(copy);
+    delete copy;
+}
+
+#endif
@@ -0,0 +1,2008 @@
+#include <iostream>
+#include <iomanip>
+#include <string.h>
+#include <errno.h>
+#include "FunctionalSim.h"
+
+//Note that an instruction that modifies the PC will never throw an
+//exception or be prone to errors from the memory abstraction.
+//Thus a single value is enough to depict the status of an instruction.
+#define NOINC_PC 1
+#define OVERFLOW 2
+#define ILLEGAL_INST 3
+
+//The JIT (see runProgramJit) needs an x86-64 host that hands out executable memory.
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__)) && !defined(NO_JIT)
+#define USE_JIT
+#include <stddef.h>
+#include "X86Emitter.h"
+
+//The part of the JIT state translated code reaches, through rbp.
+struct JitFrame
+{
+    FunctionalSim *sim;
+    //The jump a block left through, when the block it leads to may be chained to it.
+    uint8_t *chainSite;
+    //A JitStatus.
+    uint32_t status;
+};
+
+//A way out of a block, emitted after the block's code (see compileJit).
+struct JitExit
+{
+    uint8_t *site;
+    uint8_t kind;
+    uint32_t pc;
+};
+
+struct FunctionalSim::JitState
+{
+    X86Emitter code;
+    //Code shared by every block, at the start of the buffer: the entry stub and the
+    //ways back out of translated code.
+    uint8_t *entry;
+    uint8_t *epilogue;
+    uint8_t *chainEpilogue;
+    uint8_t *firstBlock;
+    //Translated block per word of memory, NULL until the PC is first run.
+    std::vector<uint8_t *> blocks;
+    //Words that have been translated or predecoded. Translated code leaves stores to
+    //them to doStore, which drops everything translated so far (see invalidateDecoded).
+    std::vector<uint8_t> codeWords;
+    bool flushPending;
+    JitFrame frame;
+};
+#endif
+
+//TODO: Fix the error messages to output the correct PC in case of errors.
+
+extern void dumpRegisterStateInternal(RegisterInfo & reg, std::ostream & reg_out);
+
+using namespace std;
+
+//Instruction handlers get the simulator they run on passed in, so they live in a
+//nested struct that can reach its private state.
+struct FunctionalSim::Handlers
+{
+    static int execAdd(FunctionalSim & sim, const DecodedInst & inst);
+    static int execAddu(FunctionalSim & sim, const DecodedInst & inst);
+    static int execAnd(FunctionalSim & sim, const DecodedInst & inst);
+    static int execJr(FunctionalSim & sim, const DecodedInst & inst);
+    static int execNor(FunctionalSim & sim, const DecodedInst & inst);
+    static int execOr(FunctionalSim & sim, const DecodedInst & inst);
+    static int execSlt(FunctionalSim & sim, const DecodedInst & inst);
+    static int execSltu(FunctionalSim & sim, const DecodedInst & inst);
+    static int execSll(FunctionalSim & sim, const DecodedInst & inst);
+    static int execSrl(FunctionalSim & sim, const DecodedInst & inst);
+    static int execSub(FunctionalSim & sim, const DecodedInst & inst);
+    static int execSubu(FunctionalSim & sim, const DecodedInst & inst);
+    static int execAddi(FunctionalSim & sim, const DecodedInst & inst);
+    static int execAddiu(FunctionalSim & sim, const DecodedInst & inst);
+    static int execAndi(FunctionalSim & sim, const DecodedInst & inst);
+    static int execBeq(FunctionalSim & sim, const DecodedInst & inst);
+    static int execBne(FunctionalSim & sim, const DecodedInst & inst);
+    static uint32_t effectiveAddr(FunctionalSim & sim, const DecodedInst & inst);
+    static int execLbu(FunctionalSim & sim, const DecodedInst & inst);
+    static int execLhu(FunctionalSim & sim, const DecodedInst & inst);
+    static int execLl(FunctionalSim & sim, const DecodedInst & inst);
+    static int execLui(FunctionalSim & sim, const DecodedInst & inst);
+    static int execLw(FunctionalSim & sim, const DecodedInst & inst);
+    static int execOri(FunctionalSim & sim, const DecodedInst & inst);
+    static int execSlti(FunctionalSim & sim, const DecodedInst & inst);
+    static int execSltiu(FunctionalSim & sim, const DecodedInst & inst);
+    static int execSb(FunctionalSim & sim, const DecodedInst & inst);
+    static int execSc(FunctionalSim & sim, const DecodedInst & inst);
+    static int execSh(FunctionalSim & sim, const DecodedInst & inst);
+    static int execSw(FunctionalSim & sim, const DecodedInst & inst);
+    static int execJ(FunctionalSim & sim, const DecodedInst & inst);
+    static int execJal(FunctionalSim & sim, const DecodedInst & inst);
+    static int execIllegal(FunctionalSim & sim, const DecodedInst & inst);
+
+    static InstHandler getOpZeroHandler(uint8_t funct);
+    static void decodeInstruction(uint32_t instr, DecodedInst & inst);
+
+    static bool isControlHandler(InstHandler handler);
+    static bool isAluHandler(InstHandler handler);
+    static bool aluReadsReg(const DecodedInst & inst, uint8_t reg);
+    static uint8_t getThreadedOp(const DecodedInst & inst);
+
+#ifdef USE_JIT
+    static bool isJitHandler(InstHandler handler);
+    static void emitJit(JitState & jit, std::vector<JitExit> & exits, const DecodedInst & inst, uint32_t pc,
+                        bool inDelaySlot, uint32_t faultPC);
+    static void emitJitMemory(JitState & jit, std::vector<JitExit> & exits, const DecodedInst & inst, uint32_t pc,
+                              bool inDelaySlot, uint32_t faultPC);
+    static int jitStore(JitFrame *frame, uint32_t addr, uint32_t value, uint32_t size);
+#endif
+};
+
+FunctionalSim::FunctionalSim(): progCounter(0), mem(NULL), flat(NULL), ll_sc_flag(false), ll_sc_addr(0),
+                                halted(false), tracer(NULL), fetchCount(0), warmICache(NULL), warmDCache(NULL),
+                                profiler(NULL), stateHash(NULL), jit(NULL)
+{
+    memset(regs, 0, sizeof(regs));
+    memset(&scratchDecoded, 0, sizeof(scratchDecoded));
+    memset(&scratchThreaded, 0, sizeof(scratchThreaded));
+}
+
+void FunctionalSim::init(MemoryStore *mem)
+{
+    this->mem = mem;
+    flat = dynamic_cast<FlatMemoryStore *>(mem);
+
+    for(int i = 0 ; i < NUM_REGS ; i++)
+    {
+        //This'll initialise the zero register appropriately too...
+        regs[i] = 0;
+    }
+
+    progCounter = 0;
+    ll_sc_flag = false;
+    ll_sc_addr = 0;
+    halted = false;
+    fetchCount = 0;
+
+    //Nothing decoded for the previous program may survive.
+    decodeCache.assign(NUM_DECODE_SLOTS, DecodedInst());
+    threadedCache.clear();
+}
+
+void FunctionalSim::setTracer(TraceWriter *tracer)
+{
+    this->tracer = tracer;
+}
+
+void FunctionalSim::setCacheWarming(Cache *icache, Cache *dcache)
+{
+    warmICache = icache;
+    warmDCache = dcache;
+}
+
+void FunctionalSim::setProfiler(Profiler *profiler)
+{
+    this->profiler = profiler;
+}
+
+void FunctionalSim::setStateHash(StateHash *hash)
+{
+    stateHash = hash;
+}
+
+void FunctionalSim::getArchState(ArchState & state) const
+{
+    state.pc = progCounter;
+    memcpy(state.regs, regs, sizeof(regs));
+    state.ll_sc_flag = ll_sc_flag;
+    state.ll_sc_addr = ll_sc_addr;
+}
+
+void FunctionalSim::setArchState(const ArchState & state)
+{
+    progCounter = state.pc;
+    memcpy(regs, state.regs, sizeof(regs));
+    ll_sc_flag = state.ll_sc_flag;
+    ll_sc_addr = state.ll_sc_addr;
+    halted = false;
+
+    decodeCache.assign(NUM_DECODE_SLOTS, DecodedInst());
+    threadedCache.clear();
+}
+
+//FlatMemoryStore is final, so accesses through flat bind statically.
+inline int FunctionalSim::readMem(uint32_t addr, uint32_t & value, MemEntrySize size)
+{
+    if(flat)
+    {
+        return flat->getMemValue(addr, value, size);
+    }
+
+    return mem->getMemValue(addr, value, size);
+}
+
+inline int FunctionalSim::writeMem(uint32_t addr, uint32_t value, MemEntrySize size)
+{
+    if(flat)
+    {
+        return flat->setMemValue(addr, value, size);
+    }
+
+    return mem->setMemValue(addr, value, size);
+}
+
+int FunctionalSim::doAddSub(uint8_t rd, uint32_t s1, uint32_t s2, bool isAdd, bool checkOverflow)
+{
+    bool overflow = false;
+    int32_t result = 0;
+
+    if(isAdd)
+    {
+        result = static_cast<int32_t>(s1) + static_cast<int32_t>(s2);
+    }
+    else
+    {
+        result = static_cast<int32_t>(s1) - static_cast<int32_t>(s2);
+    }
+
+    if(checkOverflow)
+    {
+        if(isAdd)
+        {
+            overflow = getSign(s1) == getSign(s2) && getSign(s2) != getSign(result);
+        }
+        else
+        {
+            overflow = getSign(s1) != getSign(s2) && getSign(s2) == getSign(result);
+        }
+    }
+
+    if(overflow)
+    {
+        //Inform the caller that overflow occurred so it can take appropriate action.
+        return OVERFLOW;
+    }
+
+    //Otherwise update state and return success.
+    regs[rd] = static_cast<uint32_t>(result);
+
+    return 0;
+}
+
+int FunctionalSim::doLoad(uint32_t addr, MemEntrySize size, uint8_t rt)
+{
+    uint32_t value = 0;
+    int ret = 0;
+
+    if(tracer)
+    {
+        tracer->record(TRACE_READ, addr, size, fetchCount);
+    }
+
+    if(warmDCache)
+    {
+        uint32_t misses = warmDCache->getMisses();
+        warmDCache->warm(addr, size);
+
+        //The instruction doing the access is the last one retired.
+        if(profiler && warmDCache->getMisses() != misses)
+        {
+            profiler->count(PROF_DC_MISSES, profiler->getLastPC());
+        }
+    }
+
+    ret = readMem(addr, value, size);
+    if(ret)
+    {
+        cout << "Could not get mem value" << endl;
+        return ret;
+    }
+
+    switch(size)
+    {
+        case BYTE_SIZE:
+            regs[rt] = value & 0xFF;
+            break;
+        case HALF_SIZE:
+            regs[rt] = value & 0xFFFF;
+            break;
+        case WORD_SIZE:
+            regs[rt] = value;
+            break;
+        default:
+            cerr << "Invalid size passed, cannot read/write memory" << endl;
+            return -EINVAL;
+    }
+
+    return 0;
+}
+
+void FunctionalSim::checkLLSCOverlap(uint32_t addr, MemEntrySize size)
+{
+    if(!ll_sc_flag)
+    {
+        //Atomicity either doesn't need to be checked or has already been broken,
+        //so there's nothing to do here.
+        return;
+    }
+
+    uint32_t store_start = addr;
+    uint32_t store_end = addr + static_cast<uint32_t>(size);
+    uint32_t ll_sc_start = ll_sc_addr;
+    uint32_t ll_sc_end = ll_sc_addr + static_cast<uint32_t>(WORD_SIZE);
+
+    if((store_start >= ll_sc_start && store_start < ll_sc_end) ||
+       (store_end > ll_sc_start && store_end <= ll_sc_end))
+    {
+        //We have an overlap.
+        ll_sc_flag = false;
+    }
+}
+
+//Drops any predecoded instructions overlapping a store so that self-modifying
+//code is decoded afresh the next time it is fetched.
+void FunctionalSim::invalidateDecoded(uint32_t addr, MemEntrySize size)
+{
+    uint32_t first = addr / WORD_SIZE;
+    uint32_t last = (addr + static_cast<uint32_t>(size) - 1) / WORD_SIZE;
+
+    //A superinstruction starting at the previous word may have absorbed this one.
+    if(!threadedCache.empty() && first > 0 && first - 1 < NUM_DECODE_SLOTS)
+    {
+        threadedCache[first - 1].first.handler = NULL;
+    }
+
+    for(uint32_t slot = first ; slot <= last && slot < NUM_DECODE_SLOTS ; slot++)
+    {
+        decodeCache[slot].handler = NULL;
+        if(!threadedCache.empty())
+        {
+            threadedCache[slot].first.handler = NULL;
+        }
+
+#ifdef USE_JIT
+        //Translations are only ever thrown away all at once, and only once the
+        //translated code has been left.
+        if(jit && jit->codeWords[slot])
+        {
+            jit->flushPending = true;
+        }
+#endif
+    }
+}
+
+int FunctionalSim::doStore(uint32_t addr, uint32_t value, MemEntrySize size)
+{
+    if(tracer)
+    {
+        tracer->record(TRACE_WRITE, addr, size, fetchCount);
+    }
+
+    if(warmDCache)
+    {
+        uint32_t misses = warmDCache->getMisses();
+        warmDCache->warm(addr, size);
+
+        if(profiler && warmDCache->getMisses() != misses)
+        {
+            profiler->count(PROF_DC_MISSES, profiler->getLastPC());
+        }
+    }
+
+    int ret = writeMem(addr, value, size);
+    invalidateDecoded(addr, size);
+
+    if(stateHash && !ret)
+    {
+        stateHash->store(addr, value, size);
+    }
+    return ret;
+}
+
+//Instruction handlers. Each of these only performs the operation itself; resetting
+//the zero register, running delay slots and advancing the PC is done in
+//executeDecoded for all of them.
+
+int FunctionalSim::Handlers::execAdd(FunctionalSim & sim, const DecodedInst & inst)
+{
+    return sim.doAddSub(inst.rd, sim.regs[inst.rs], sim.regs[inst.rt], true, true);
+}
+
+int FunctionalSim::Handlers::execAddu(FunctionalSim & sim, const DecodedInst & inst)
+{
+    //No overflow...
+    return sim.doAddSub(inst.rd, sim.regs[inst.rs], sim.regs[inst.rt], true, false);
+}
+
+int FunctionalSim::Handlers::execAnd(FunctionalSim & sim, const DecodedInst & inst)
+{
+    sim.regs[inst.rd] = sim.regs[inst.rs] & sim.regs[inst.rt];
+    return 0;
+}
+
+int FunctionalSim::Handlers::execJr(FunctionalSim & sim, const DecodedInst & inst)
+{
+    sim.progCounter = sim.regs[inst.rs];
+    return NOINC_PC;
+}
+
+int FunctionalSim::Handlers::execNor(FunctionalSim & sim, const DecodedInst & inst)
+{
+    sim.regs[inst.rd] = ~(sim.regs[inst.rs] | sim.regs[inst.rt]);
+    return 0;
+}
+
+int FunctionalSim::Handlers::execOr(FunctionalSim & sim, const DecodedInst & inst)
+{
+    sim.regs[inst.rd] = sim.regs[inst.rs] | sim.regs[inst.rt];
+    return 0;
+}
+
+int FunctionalSim::Handlers::execSlt(FunctionalSim & sim, const DecodedInst & inst)
+{
+    sim.regs[inst.rd] = (static_cast<int32_t>(sim.regs[inst.rs]) < static_cast<int32_t>(sim.regs[inst.rt])) ? 1 : 0;
+    return 0;
+}
+
+int FunctionalSim::Handlers::execSltu(FunctionalSim & sim, const DecodedInst & inst)
+{
+    sim.regs[inst.rd] = (sim.regs[inst.rs] < sim.regs[inst.rt]) ? 1 : 0;
+    return 0;
+}
+
+int FunctionalSim::Handlers::execSll(FunctionalSim & sim, const DecodedInst & inst)
+{
+    sim.regs[inst.rd] = sim.regs[inst.rt] << inst.shamt;
+    return 0;
+}
+
+int FunctionalSim::Handlers::execSrl(FunctionalSim & sim, const DecodedInst & inst)
+{
+    sim.regs[inst.rd] = sim.regs[inst.rt] >> inst.shamt;
+    return 0;
+}
+
+int FunctionalSim::Handlers::execSub(FunctionalSim & sim, const DecodedInst & inst)
+{
+    return sim.doAddSub(inst.rd, sim.regs[inst.rs], sim.regs[inst.rt], false, true);
+}
+
+int FunctionalSim::Handlers::execSubu(FunctionalSim & sim, const DecodedInst & inst)
+{
+    //No overflow...
+    return sim.doAddSub(inst.rd, sim.regs[inst.rs], sim.regs[inst.rt], false, false);
+}
+
+int FunctionalSim::Handlers::execAddi(FunctionalSim & sim, const DecodedInst & inst)
+{
+    return sim.doAddSub(inst.rt, sim.regs[inst.rs], inst.imm, true, true);
+}
+
+int FunctionalSim::Handlers::execAddiu(FunctionalSim & sim, const DecodedInst & inst)
+{
+    return sim.doAddSub(inst.rt, sim.regs[inst.rs], inst.imm, true, false);
+}
+
+int FunctionalSim::Handlers::execAndi(FunctionalSim & sim, const DecodedInst & inst)
+{
+    sim.regs[inst.rt] = sim.regs[inst.rs] & inst.imm;
+    return 0;
+}
+
+//Note that if a branch is not taken, we don't need to do anything with
+//regard to delay slots. The instruction after the branch will be executed
+//as required by the regular straight-line execution logic.
+int FunctionalSim::Handlers::execBeq(FunctionalSim & sim, const DecodedInst & inst)
+{
+    //Note that signs don't matter when you're checking for equality :).
+    if(sim.regs[inst.rs] == sim.regs[inst.rt])
+    {
+        sim.progCounter += inst.imm;
+        return NOINC_PC;
+    }
+
+    return 0;
+}
+
+int FunctionalSim::Handlers::execBne(FunctionalSim & sim, const DecodedInst & inst)
+{
+    if(sim.regs[inst.rs] != sim.regs[inst.rt])
+    {
+        sim.progCounter += inst.imm;
+        return NOINC_PC;
+    }
+
+    return 0;
+}
+
+//TODO: Do address calculations that overflow cause an overflow exception?
+//Probably not, because memory is always addressed by UNSIGNED numbers, not signed ones.
+uint32_t FunctionalSim::Handlers::effectiveAddr(FunctionalSim & sim, const DecodedInst & inst)
+{
+    return sim.regs[inst.rs] + inst.imm;
+}
+
+int FunctionalSim::Handlers::execLbu(FunctionalSim & sim, const DecodedInst & inst)
+{
+    return sim.doLoad(effectiveAddr(sim, inst), BYTE_SIZE, inst.rt);
+}
+
+int FunctionalSim::Handlers::execLhu(FunctionalSim & sim, const DecodedInst & inst)
+{
+    return sim.doLoad(effectiveAddr(sim, inst), HALF_SIZE, inst.rt);
+}
+
+int FunctionalSim::Handlers::execLl(FunctionalSim & sim, const DecodedInst & inst)
+{
+    //Set the ll_sc_flag. It'll be cleared on any exception or when the SC succeeds,
+    //or if there's an intervening store that overlaps with the ll word in any way.
+    uint32_t addr = effectiveAddr(sim, inst);
+    sim.ll_sc_flag = true;
+    sim.ll_sc_addr = addr;
+    return sim.doLoad(addr, WORD_SIZE, inst.rt);
+}
+
+int FunctionalSim::Handlers::execLui(FunctionalSim & sim, const DecodedInst & inst)
+{
+    sim.regs[inst.rt] = inst.imm;
+    return 0;
+}
+
+int FunctionalSim::Handlers::execLw(FunctionalSim & sim, const DecodedInst & inst)
+{
+    return sim.doLoad(effectiveAddr(sim, inst), WORD_SIZE, inst.rt);
+}
+
+int FunctionalSim::Handlers::execOri(FunctionalSim & sim, const DecodedInst & inst)
+{
+    sim.regs[inst.rt] = sim.regs[inst.rs] | inst.imm;
+    return 0;
+}
+
+int FunctionalSim::Handlers::execSlti(FunctionalSim & sim, const DecodedInst & inst)
+{
+    sim.regs[inst.rt] = (static_cast<int32_t>(sim.regs[inst.rs]) < static_cast<int32_t>(inst.imm)) ? 1 : 0;
+    return 0;
+}
+
+int FunctionalSim::Handlers::execSltiu(FunctionalSim & sim, const DecodedInst & inst)
+{
+    sim.regs[inst.rt] = (sim.regs[inst.rs] < inst.imm) ? 1 : 0;
+    return 0;
+}
+
+int FunctionalSim::Handlers::execSb(FunctionalSim & sim, const DecodedInst & inst)
+{
+    uint32_t addr = effectiveAddr(sim, inst);
+    int ret = sim.doStore(addr, sim.regs[inst.rt] & 0xFF, BYTE_SIZE);
+    sim.checkLLSCOverlap(addr, BYTE_SIZE);
+    return ret;
+}
+
+int FunctionalSim::Handlers::execSc(FunctionalSim & sim, const DecodedInst & inst)
+{
+    uint32_t addr = effectiveAddr(sim, inst);
+    int ret = 0;
+
+    if(addr == sim.ll_sc_addr)
+    {
+        if(sim.ll_sc_flag)
+        {
+            //We are atomic. Store the value.
+            ret = sim.doStore(addr, sim.regs[inst.rt], WORD_SIZE);
+        }
+
+        sim.regs[inst.rt] = (sim.ll_sc_flag) ? 1 : 0;
+    }
+    else
+    {
+        sim.regs[inst.rt] = 0;
+    }
+    sim.ll_sc_flag = false;
+
+    return ret;
+}
+
+int FunctionalSim::Handlers::execSh(FunctionalSim & sim, const DecodedInst & inst)
+{
+    uint32_t addr = effectiveAddr(sim, inst);
+    int ret = sim.doStore(addr, sim.regs[inst.rt] & 0xFFFF, HALF_SIZE);
+    sim.checkLLSCOverlap(addr, HALF_SIZE);
+    return ret;
+}
+
+int FunctionalSim::Handlers::execSw(FunctionalSim & sim, const DecodedInst & inst)
+{
+    uint32_t addr = effectiveAddr(sim, inst);
+    int ret = sim.doStore(addr, sim.regs[inst.rt], WORD_SIZE);
+    sim.checkLLSCOverlap(addr, WORD_SIZE);
+    return ret;
+}
+
+int FunctionalSim::Handlers::execJ(FunctionalSim & sim, const DecodedInst & inst)
+{
+    sim.progCounter = ((sim.progCounter + 4) & 0xf0000000) | inst.imm;
+    return NOINC_PC;
+}
+
+int FunctionalSim::Handlers::execJal(FunctionalSim & sim, const DecodedInst & inst)
+{
+    sim.regs[REG_RA] = sim.progCounter + 8;
+    return execJ(sim, inst);
+}
+
+int FunctionalSim::Handlers::execIllegal(FunctionalSim & sim, const DecodedInst &)
+{
+    //Illegal instruction. Trigger an exception.
+    cerr << "Illegal instruction at address " << "0x" << hex
+         << setfill('0') << setw(8) << sim.progCounter << endl;
+    return ILLEGAL_INST;
+}
+
+InstHandler FunctionalSim::Handlers::getOpZeroHandler(uint8_t funct)
+{
+    switch(funct)
+    {
+        case FUN_ADD:
+            return execAdd;
+        case FUN_ADDU:
+            return execAddu;
+        case FUN_AND:
+            return execAnd;
+        case FUN_JR:
+            return execJr;
+        case FUN_NOR:
+            return execNor;
+        case FUN_OR:
+            return execOr;
+        case FUN_SLT:
+            return execSlt;
+        case FUN_SLTU:
+            return execSltu;
+        case FUN_SLL:
+            return execSll;
+        case FUN_SRL:
+            return execSrl;
+        case FUN_SUB:
+            return execSub;
+        case FUN_SUBU:
+            return execSubu;
+        default:
+            return execIllegal;
+    }
+}
+
+void FunctionalSim::Handlers::decodeInstruction(uint32_t instr, DecodedInst & inst)
+{
+    uint16_t imm = instr & 0xffff;
+    //Sign extend the immediate...
+    uint32_t seImm = static_cast<uint32_t>(static_cast<int32_t>(static_cast<int16_t>(imm)));
+    uint32_t zeImm = imm;
+
+    inst.word = instr;
+    inst.rs = (instr >> 21) & 0x1f;
+    inst.rt = (instr >> 16) & 0x1f;
+    inst.rd = (instr >> 11) & 0x1f;
+    inst.shamt = (instr >> 6) & 0x1f;
+    inst.imm = seImm;
+
+    switch(getOpcode(instr))
+    {
+        //Everything with a zero opcode...
+        case OP_ZERO:
+            inst.handler = getOpZeroHandler(instr & 0x3f);
+            break;
+        case OP_ADDI:
+            inst.handler = execAddi;
+            break;
+        case OP_ADDIU:
+            inst.handler = execAddiu;
+            break;
+        case OP_ANDI:
+            inst.handler = execAndi;
+            inst.imm = zeImm;
+            break;
+        case OP_BEQ:
+            //MIPS multiplies immediates by 4 for branches...
+            inst.handler = execBeq;
+            inst.imm = 4 + (seImm << 2);
+            break;
+        case OP_BNE:
+            inst.handler = execBne;
+            inst.imm = 4 + (seImm << 2);
+            break;
+        case OP_LBU:
+            inst.handler = execLbu;
+            break;
+        case OP_LHU:
+            inst.handler = execLhu;
+            break;
+        case OP_LL:
+            inst.handler = execLl;
+            break;
+        case OP_LUI:
+            inst.handler = execLui;
+            inst.imm = zeImm << 16;
+            break;
+        case OP_LW:
+            inst.handler = execLw;
+            break;
+        case OP_ORI:
+            inst.handler = execOri;
+            inst.imm = zeImm;
+            break;
+        case OP_SLTI:
+            inst.handler = execSlti;
+            break;
+        case OP_SLTIU:
+            inst.handler = execSltiu;
+            break;
+        case OP_SB:
+            inst.handler = execSb;
+            break;
+        case OP_SC:
+            inst.handler = execSc;
+            break;
+        case OP_SH:
+            inst.handler = execSh;
+            break;
+        case OP_SW:
+            inst.handler = execSw;
+            break;
+        case OP_J:
+            inst.handler = execJ;
+            inst.imm = (instr & 0x3ffffff) << 2;
+            break;
+        case OP_JAL:
+            inst.handler = execJal;
+            inst.imm = (instr & 0x3ffffff) << 2;
+            break;
+        default:
+            //Note: Since we catch illegal instructions here, the handlers
+            //don't need to check for illegal instructions.
+            inst.handler = execIllegal;
+            break;
+    }
+}
+
+//Returns the decoded instruction at the given address, decoding it on a predecode
+//cache miss. PCs that can't be cached (unaligned or out of range) are decoded into a
+//scratch record every time, so the memory store still gets to report the error.
+inline int FunctionalSim::fetchDecoded(uint32_t addr, const DecodedInst * & inst)
+{
+    DecodedInst *slot = &scratchDecoded;
+
+    fetchCount++;
+
+    if(tracer)
+    {
+        tracer->record(TRACE_IFETCH, addr, WORD_SIZE, fetchCount);
+    }
+
+    if(warmICache)
+    {
+        uint32_t misses = warmICache->getMisses();
+        warmICache->warm(addr, WORD_SIZE);
+
+        if(profiler && warmICache->getMisses() != misses)
+        {
+            profiler->count(PROF_IC_MISSES, addr);
+        }
+    }
+
+    if((addr % WORD_SIZE) == 0 && addr < MEMORY_SIZE)
+    {
+        slot = &decodeCache[addr / WORD_SIZE];
+        if(slot->handler)
+        {
+            inst = slot;
+            return 0;
+        }
+    }
+
+    uint32_t word = 0;
+    int ret = readMem(addr, word, WORD_SIZE);
+    if(ret)
+    {
+        return ret;
+    }
+
+    Handlers::decodeInstruction(word, *slot);
+    inst = slot;
+    return 0;
+}
+
+int FunctionalSim::runDelayInstruction(uint32_t delayPC, int succRet)
+{
+    const DecodedInst *delayInst = NULL;
+    int ret = fetchDecoded(delayPC, delayInst);
+    if(ret)
+    {
+        return ret;
+    }
+
+    if(profiler)
+    {
+        profiler->retire(delayPC, delayInst->word);
+    }
+
+    ret = executeDecoded(*delayInst, delayPC, true);
+
+    if(ret)
+    {
+        return ret;
+    }
+
+    return succRet;
+}
+
+int FunctionalSim::executeDecoded(const DecodedInst & inst, uint32_t pc, bool isDelayInst)
+{
+    uint32_t oldPC = progCounter;
+
+    int ret = inst.handler(*this, inst);
+
+    //Reset the zero register...
+    regs[REG_ZERO] = 0;
+
+    //The instruction has retired, unless it raised an exception. A branch retires
+    //before its delay slot.
+    if(stateHash && (ret == 0 || ret == NOINC_PC))
+    {
+        uint8_t dest = getDestReg(inst.word);
+        stateHash->retire(pc, dest, regs[dest]);
+    }
+
+    //Did this instruction modify the PC? If so, execute the instruction
+    //in the delay slot and then return the return value of the branch's
+    //execution unless the delay slot instruction throws an exception,
+    //in which case just return the exception of that delay instruction.
+    //Note that inst may have been invalidated by now, so don't touch it again.
+    if(ret == NOINC_PC)
+    {
+        ret = runDelayInstruction(oldPC + 4, NOINC_PC);
+    }
+
+    if(ret == NOINC_PC)
+    {
+        //Don't increment the PC.
+        return 0;
+    }
+
+    if(ret == OVERFLOW || ret == ILLEGAL_INST)
+    {
+        //There was an exception. Clear the LL/SC flag, set the PC to the
+        //exception address and return 0. This is because nothing
+        //special needs to be done by the calling code except to not increment
+        //the PC - it should just continue execution from what the PC is like
+        //normal. In the case of a regular (non-delay) instruction, this is exactly
+        //what runProgram does. In the case of a delay instruction, returning 0 here
+        //causes the branch before the delay instruction to return NOINC_PC, which
+        //will result in the PC not getting incremented and execution continuing from
+        //whatever the PC is (which is now the exception address), which is exactly
+        //what we want.
+        //Note that this is the only function where progCounter is incremented.
+        ll_sc_flag = false;
+        progCounter = EXCEPTION_ADDR;
+
+        if(profiler)
+        {
+            profiler->flush(profiler->getLastPC(), profiler->getLastWord());
+        }
+        return 0;
+    }
+
+    if(ret)
+    {
+        //Memory error - pass it on.
+        return ret;
+    }
+
+    if(!isDelayInst)
+    {
+        progCounter += 4;
+    }
+
+    return 0;
+}
+
+void FunctionalSim::fillRegisterState(RegisterInfo & reg) const
+{
+    fillRegisterInfo(regs, reg);
+}
+
+//For delayed branches in combination with self-modifying code *shudder*, we should be
+//fine. Each instruction is fetched only once all previous instructions have finished
+//execution, and every store drops the predecoded copies of the words it touches,
+//so there should be no problem with stale values, etc.
+int FunctionalSim::runProgram()
+{
+    return runUntil(UINT64_MAX);
+}
+
+int FunctionalSim::runInstructions(uint64_t count)
+{
+    return runUntil(fetchCount + count);
+}
+
+int FunctionalSim::runUntil(uint64_t limit)
+{
+    while(!halted && fetchCount < limit)
+    {
+        const DecodedInst *inst = NULL;
+        //Store the current PC for printing out errors...
+        uint32_t curPC = progCounter;
+
+        if(fetchDecoded(progCounter, inst))
+        {
+            return -EBADF;
+        }
+
+        //Check for the end of the code segment.
+        uint32_t curInst = inst->word;
+        if(curInst == MAGIC_DEMARC)
+        {
+            halted = true;
+            break;
+        }
+
+        if(profiler)
+        {
+            profiler->retire(curPC, curInst);
+        }
+
+        int ret = executeDecoded(*inst, curPC, false);
+
+        if(ret)
+        {
+            //There was an error executing the instruction.
+            //Note that this won't give appropriate info for delayed branches...TODO: fix this...
+            cerr << "Error executing instruction " << "0x" << hex << setfill('0')
+                 << setw(8) << curInst << " at address " << "0x" << curPC << endl;
+            return -EINVAL;
+        }
+
+        //Dump the state of the system after every instruction for debugging purposes.
+        //Commented out by default.
+        /*cout << endl;
+        cout << "Finished executing instruction " << "0x" << hex << setfill('0')
+             << setw(8) << curInst << " at address " << "0x" << curPC << endl;
+        RegisterInfo reg;
+        memset(&reg, 0, sizeof(RegisterInfo));
+        fillRegisterState(reg);
+        dumpRegisterStateInternal(reg, std::cout);
+        dumpMemoryState(mem);*/
+
+        //The PC will be appropriately set by executeDecoded.
+        //We don't have to do anything here.
+    }
+
+    return 0;
+}
+
+//Threaded engine. An alternative to runProgram selected with --threaded; it must leave
+//registers and memory in exactly the same state. Instructions are predecoded into
+//ThreadedInst records, each carrying the address of the code implementing it, and
+//every operation dispatches straight to the next one instead of returning to a
+//central loop. Common pairs are fused into superinstructions at decode time.
+//Compilers without computed goto (or builds with NO_COMPUTED_GOTO) fall back to a
+//switch over the same operations.
+#if defined(__GNUC__) && !defined(NO_COMPUTED_GOTO)
+#define USE_COMPUTED_GOTO
+#endif
+
+bool FunctionalSim::Handlers::isControlHandler(InstHandler handler)
+{
+    return handler == execBeq || handler == execBne || handler == execJ ||
+           handler == execJal || handler == execJr;
+}
+
+//ALU instructions never touch memory or the PC, so they're safe to execute as the
+//second half of a superinstruction.
+bool FunctionalSim::Handlers::isAluHandler(InstHandler handler)
+{
+    return handler == execAdd || handler == execAddu || handler == execAnd ||
+           handler == execNor || handler == execOr || handler == execSlt ||
+           handler == execSltu || handler == execSll || handler == execSrl ||
+           handler == execSub || handler == execSubu || handler == execAddi ||
+           handler == execAddiu || handler == execAndi || handler == execOri ||
+           handler == execSlti || handler == execSltiu;
+}
+
+//Does the given ALU instruction read reg?
+bool FunctionalSim::Handlers::aluReadsReg(const DecodedInst & inst, uint8_t reg)
+{
+    if(inst.handler == execSll || inst.handler == execSrl)
+    {
+        return inst.rt == reg;
+    }
+
+    if(getOpcode(inst.word) == OP_ZERO)
+    {
+        return inst.rs == reg || inst.rt == reg;
+    }
+
+    return inst.rs == reg;
+}
+
+uint8_t FunctionalSim::Handlers::getThreadedOp(const DecodedInst & inst)
+{
+    InstHandler handler = inst.handler;
+
+    if(inst.word == MAGIC_DEMARC)
+    {
+        return TOP_HALT;
+    }
+
+    if(handler == execAddu)
+    {
+        return TOP_ADDU;
+    }
+    if(handler == execAddiu)
+    {
+        return TOP_ADDIU;
+    }
+    if(handler == execSubu)
+    {
+        return TOP_SUBU;
+    }
+    if(handler == execAnd)
+    {
+        return TOP_AND;
+    }
+    if(handler == execAndi)
+    {
+        return TOP_ANDI;
+    }
+    if(handler == execOr)
+    {
+        return TOP_OR;
+    }
+    if(handler == execOri)
+    {
+        return TOP_ORI;
+    }
+    if(handler == execNor)
+    {
+        return TOP_NOR;
+    }
+    if(handler == execSll)
+    {
+        return TOP_SLL;
+    }
+    if(handler == execSrl)
+    {
+        return TOP_SRL;
+    }
+    if(handler == execSlt)
+    {
+        return TOP_SLT;
+    }
+    if(handler == execSltu)
+    {
+        return TOP_SLTU;
+    }
+    if(handler == execLui)
+    {
+        return TOP_LUI;
+    }
+    if(handler == execLw)
+    {
+        return TOP_LW;
+    }
+    if(handler == execSw)
+    {
+        return TOP_SW;
+    }
+
+    return TOP_GENERIC;
+}
+
+//Tries to fuse the instruction at addr with the one following it.
+void FunctionalSim::fuseThreaded(uint32_t addr, ThreadedInst & inst)
+{
+    uint32_t nextWord = 0;
+
+    //The lookahead must never make an access that fails, since the memory store would
+    //report it: the interpreter doesn't read the next word at all.
+    if(!inMemoryRange(addr + WORD_SIZE, WORD_SIZE) || readMem(addr + WORD_SIZE, nextWord, WORD_SIZE))
+    {
+        return;
+    }
+
+    //Never swallow the end of the program.
+    if(nextWord == MAGIC_DEMARC)
+    {
+        return;
+    }
+
+    Handlers::decodeInstruction(nextWord, inst.second);
+
+    InstHandler first = inst.first.handler;
+    InstHandler second = inst.second.handler;
+
+    //Branches in delay slots are left to the generic path, which knows how to
+    //nest delay slots.
+    if(Handlers::isControlHandler(first) && !Handlers::isControlHandler(second) &&
+       second != Handlers::execIllegal)
+    {
+        inst.op = TOP_BRANCH_DELAY;
+    }
+    else if(first == Handlers::execLui && second == Handlers::execOri &&
+            inst.second.rs == inst.first.rt && inst.second.rt == inst.first.rt)
+    {
+        inst.op = TOP_LUI_ORI;
+    }
+    else if(first == Handlers::execLw && Handlers::isAluHandler(second) &&
+            Handlers::aluReadsReg(inst.second, inst.first.rt))
+    {
+        inst.op = TOP_LW_ALU;
+    }
+}
+
+//Decodes (and, if possible, fuses and caches) the instruction at addr.
+int FunctionalSim::decodeThreaded(uint32_t addr, const ThreadedInst * & inst, const void * const *labels)
+{
+    ThreadedInst *slot = &scratchThreaded;
+    bool cacheable = (addr % WORD_SIZE) == 0 && addr < MEMORY_SIZE;
+
+    if(cacheable)
+    {
+        slot = &threadedCache[addr / WORD_SIZE];
+    }
+
+    uint32_t word = 0;
+    int ret = readMem(addr, word, WORD_SIZE);
+    if(ret)
+    {
+        return ret;
+    }
+
+    Handlers::decodeInstruction(word, slot->first);
+    slot->op = Handlers::getThreadedOp(slot->first);
+
+    if(cacheable)
+    {
+        fuseThreaded(addr, *slot);
+    }
+
+    slot->target = labels ? labels[slot->op] : NULL;
+    inst = slot;
+    return 0;
+}
+
+//The dispatch path: a cached record is used as is, anything else is decoded.
+inline int FunctionalSim::fetchThreaded(uint32_t addr, const ThreadedInst * & inst, const void * const *labels)
+{
+    if((addr % WORD_SIZE) == 0 && addr < MEMORY_SIZE)
+    {
+        const ThreadedInst *slot = &threadedCache[addr / WORD_SIZE];
+        if(slot->first.handler)
+        {
+            inst = slot;
+            return 0;
+        }
+    }
+
+    return decodeThreaded(addr, inst, labels);
+}
+
+#ifdef USE_COMPUTED_GOTO
+#define THREADED_OP(op, label) label:
+#define THREADED_NEXT()                                             \
+    do                                                              \
+    {                                                               \
+        curPC = progCounter;                                        \
+        if(fetchThreaded(curPC, inst, labels))                      \
+        {                                                           \
+            return -EBADF;                                          \
+        }                                                           \
+        curInst = inst->first.word;                                 \
+        goto *inst->target;                                         \
+    } while(0)
+#else
+#define THREADED_OP(op, label) case op:
+#define THREADED_NEXT() continue
+#endif
+
+int FunctionalSim::runProgramThreaded()
+{
+#ifdef USE_COMPUTED_GOTO
+    static const void * const labels[NUM_THREADED_OPS] =
+    {
+        &&op_generic,
+        &&op_halt,
+        &&op_addu,
+        &&op_addiu,
+        &&op_subu,
+        &&op_and,
+        &&op_andi,
+        &&op_or,
+        &&op_ori,
+        &&op_nor,
+        &&op_sll,
+        &&op_srl,
+        &&op_slt,
+        &&op_sltu,
+        &&op_lui,
+        &&op_lw,
+        &&op_sw,
+        &&op_branch_delay,
+        &&op_lui_ori,
+        &&op_lw_alu
+    };
+#else
+    static const void * const *labels = NULL;
+#endif
+
+    if(threadedCache.empty())
+    {
+        threadedCache.assign(NUM_DECODE_SLOTS, ThreadedInst());
+    }
+
+    const ThreadedInst *inst = NULL;
+    //Store the current PC and instruction for printing out errors...
+    uint32_t curPC = 0;
+    uint32_t curInst = 0;
+    uint32_t addr = 0;
+    bool taken = false;
+    int ret = 0;
+
+    while(true)
+    {
+        curPC = progCounter;
+        if(fetchThreaded(curPC, inst, labels))
+        {
+            return -EBADF;
+        }
+        curInst = inst->first.word;
+
+#ifdef USE_COMPUTED_GOTO
+        goto *inst->target;
+#else
+        switch(inst->op)
+#endif
+        {
+            THREADED_OP(TOP_GENERIC, op_generic)
+                ret = executeDecoded(inst->first, curPC, false);
+                if(ret)
+                {
+                    goto op_error;
+                }
+                THREADED_NEXT();
+
+            THREADED_OP(TOP_HALT, op_halt)
+                return 0;
+
+            THREADED_OP(TOP_ADDU, op_addu)
+                regs[inst->first.rd] = regs[inst->first.rs] + regs[inst->first.rt];
+                regs[REG_ZERO] = 0;
+                progCounter += 4;
+                THREADED_NEXT();
+
+            THREADED_OP(TOP_ADDIU, op_addiu)
+                regs[inst->first.rt] = regs[inst->first.rs] + inst->first.imm;
+                regs[REG_ZERO] = 0;
+                progCounter += 4;
+                THREADED_NEXT();
+
+            THREADED_OP(TOP_SUBU, op_subu)
+                regs[inst->first.rd] = regs[inst->first.rs] - regs[inst->first.rt];
+                regs[REG_ZERO] = 0;
+                progCounter += 4;
+                THREADED_NEXT();
+
+            THREADED_OP(TOP_AND, op_and)
+                regs[inst->first.rd] = regs[inst->first.rs] & regs[inst->first.rt];
+                regs[REG_ZERO] = 0;
+                progCounter += 4;
+                THREADED_NEXT();
+
+            THREADED_OP(TOP_ANDI, op_andi)
+                regs[inst->first.rt] = regs[inst->first.rs] & inst->first.imm;
+                regs[REG_ZERO] = 0;
+                progCounter += 4;
+                THREADED_NEXT();
+
+            THREADED_OP(TOP_OR, op_or)
+                regs[inst->first.rd] = regs[inst->first.rs] | regs[inst->first.rt];
+                regs[REG_ZERO] = 0;
+                progCounter += 4;
+                THREADED_NEXT();
+
+            THREADED_OP(TOP_ORI, op_ori)
+                regs[inst->first.rt] = regs[inst->first.rs] | inst->first.imm;
+                regs[REG_ZERO] = 0;
+                progCounter += 4;
+                THREADED_NEXT();
+
+            THREADED_OP(TOP_NOR, op_nor)
+                regs[inst->first.rd] = ~(regs[inst->first.rs] | regs[inst->first.rt]);
+                regs[REG_ZERO] = 0;
+                progCounter += 4;
+                THREADED_NEXT();
+
+            THREADED_OP(TOP_SLL, op_sll)
+                regs[inst->first.rd] = regs[inst->first.rt] << inst->first.shamt;
+                regs[REG_ZERO] = 0;
+                progCounter += 4;
+                THREADED_NEXT();
+
+            THREADED_OP(TOP_SRL, op_srl)
+                regs[inst->first.rd] = regs[inst->first.rt] >> inst->first.shamt;
+                regs[REG_ZERO] = 0;
+                progCounter += 4;
+                THREADED_NEXT();
+
+            THREADED_OP(TOP_SLT, op_slt)
+                regs[inst->first.rd] = (static_cast<int32_t>(regs[inst->first.rs]) <
+                                        static_cast<int32_t>(regs[inst->first.rt])) ? 1 : 0;
+                regs[REG_ZERO] = 0;
+                progCounter += 4;
+                THREADED_NEXT();
+
+            THREADED_OP(TOP_SLTU, op_sltu)
+                regs[inst->first.rd] = (regs[inst->first.rs] < regs[inst->first.rt]) ? 1 : 0;
+                regs[REG_ZERO] = 0;
+                progCounter += 4;
+                THREADED_NEXT();
+
+            THREADED_OP(TOP_LUI, op_lui)
+                regs[inst->first.rt] = inst->first.imm;
+                regs[REG_ZERO] = 0;
+                progCounter += 4;
+                THREADED_NEXT();
+
+            THREADED_OP(TOP_LW, op_lw)
+                ret = doLoad(regs[inst->first.rs] + inst->first.imm, WORD_SIZE, inst->first.rt);
+                if(ret)
+                {
+                    goto op_error;
+                }
+                regs[REG_ZERO] = 0;
+                progCounter += 4;
+                THREADED_NEXT();
+
+            THREADED_OP(TOP_SW, op_sw)
+                addr = regs[inst->first.rs] + inst->first.imm;
+                ret = doStore(addr, regs[inst->first.rt], WORD_SIZE);
+                checkLLSCOverlap(addr, WORD_SIZE);
+                if(ret)
+                {
+                    goto op_error;
+                }
+                progCounter += 4;
+                THREADED_NEXT();
+
+            THREADED_OP(TOP_BRANCH_DELAY, op_branch_delay)
+                //The branch handler updates the PC (and $ra) before the delay slot runs,
+                //just like runDelayInstruction. A branch that isn't taken simply falls
+                //through into its delay slot, so run that here as well.
+                taken = (inst->first.handler(*this, inst->first) == NOINC_PC);
+                regs[REG_ZERO] = 0;
+                ret = inst->second.handler(*this, inst->second);
+                regs[REG_ZERO] = 0;
+                if(ret == OVERFLOW || ret == ILLEGAL_INST)
+                {
+                    goto op_exception;
+                }
+                if(ret)
+                {
+                    if(!taken)
+                    {
+                        curPC += 4;
+                        curInst = inst->second.word;
+                    }
+                    goto op_error;
+                }
+                if(!taken)
+                {
+                    progCounter = curPC + 8;
+                }
+                THREADED_NEXT();
+
+            THREADED_OP(TOP_LUI_ORI, op_lui_ori)
+                regs[inst->first.rt] = inst->first.imm | inst->second.imm;
+                regs[REG_ZERO] = 0;
+                progCounter += 8;
+                THREADED_NEXT();
+
+            THREADED_OP(TOP_LW_ALU, op_lw_alu)
+                ret = doLoad(regs[inst->first.rs] + inst->first.imm, WORD_SIZE, inst->first.rt);
+                if(ret)
+                {
+                    goto op_error;
+                }
+                regs[REG_ZERO] = 0;
+                ret = inst->second.handler(*this, inst->second);
+                regs[REG_ZERO] = 0;
+                if(ret)
+                {
+                    //ALU instructions can only fail with an overflow.
+                    goto op_exception;
+                }
+                progCounter += 8;
+                THREADED_NEXT();
+
+            op_exception:
+                //Same as the exception handling in executeDecoded.
+                ll_sc_flag = false;
+                progCounter = EXCEPTION_ADDR;
+                THREADED_NEXT();
+
+            op_error:
+                //There was an error executing the instruction.
+                cerr << "Error executing instruction " << "0x" << hex << setfill('0')
+                     << setw(8) << curInst << " at address " << "0x" << curPC << endl;
+                return -EINVAL;
+        }
+    }
+}
+
+#undef THREADED_OP
+#undef THREADED_NEXT
+
+//JIT engine. Another alternative to runProgram, which must leave registers and memory
+//in exactly the same state. Straight-line runs of instructions are translated into
+//x86-64 code the first time their first PC is reached, up to and including the
+//first branch or jump and its delay slot. Guest registers stay in regs, and each
+//block ends by jumping straight into the block that follows it once that one has
+//been translated, so loops run without ever coming back to the dispatcher.
+//
+//The dispatcher interprets (with runUntil) whatever translated code leaves to it:
+//LL, SC, illegal instructions, the end of the program, branches whose delay slot
+//can't be translated, and any load or store outside memory, which is run again by
+//the interpreter so that the error is reported in the usual way. Overflow leaves
+//the block straight for the exception handler. A store to a word that has been
+//translated or predecoded goes through doStore, which drops every translation;
+//the block leaves right after the store and everything is translated afresh.
+#ifdef USE_JIT
+
+//Executable memory for translations. It is all thrown away once it fills up.
+#define JIT_CODE_SIZE (4 << 20)
+//Instructions per block, and room for the code of the longest block.
+#define JIT_MAX_BLOCK_INSTS 64
+#define JIT_MAX_BLOCK_CODE (JIT_MAX_BLOCK_INSTS * 192)
+
+//Marks a PC whose first instruction is left to the interpreter.
+#define JIT_NO_BLOCK (reinterpret_cast<uint8_t *>(1))
+
+//Host registers holding the translated code's state.
+#define JIT_REGS X86_RBX
+#define JIT_FRAME X86_RBP
+#define JIT_MEM X86_R12
+#define JIT_CODE_WORDS X86_R13
+//Where a branch goes, from before its delay slot runs.
+#define JIT_NEXT_PC X86_R14
+#define JIT_LL_SC_FLAG X86_R15
+
+//How a block was left, in JitFrame::status.
+enum JitStatus
+{
+    JIT_NEXT,
+    JIT_EXCEPTION,
+    //Interpret the instruction at the PC returned.
+    JIT_INTERPRET
+};
+
+enum JitExitKind
+{
+    //To a constant PC, through a jump that can later be chained to the block there.
+    JIT_EXIT_CHAIN,
+    //To a constant PC, after a store that may have dropped the translations.
+    JIT_EXIT_NEXT,
+    //To the PC in JIT_NEXT_PC.
+    JIT_EXIT_NEXT_DYNAMIC,
+    JIT_EXIT_INTERPRET,
+    JIT_EXIT_EXCEPTION
+};
+
+typedef uint32_t (*JitEntry)(uint32_t *regs, JitFrame *frame, uint8_t *mem, uint8_t *codeWords, bool *llscFlag,
+                             const uint8_t *block);
+
+static void loadJitReg(X86Emitter & code, int host, uint8_t guest)
+{
+    if(guest)
+    {
+        code.load(host, JIT_REGS, guest * WORD_SIZE);
+    }
+    else
+    {
+        code.alu(X86_XOR, host, host);
+    }
+}
+
+static void aluJitReg(X86Emitter & code, X86Alu op, int host, uint8_t guest)
+{
+    if(guest)
+    {
+        code.aluLoad(op, host, JIT_REGS, guest * WORD_SIZE);
+    }
+    else
+    {
+        code.aluImm(op, host, 0);
+    }
+}
+
+//Writes to the zero register are simply dropped.
+static void storeJitReg(X86Emitter & code, uint8_t guest, int host)
+{
+    if(guest)
+    {
+        code.store(WORD_SIZE, JIT_REGS, guest * WORD_SIZE, host);
+    }
+}
+
+static void addJitExit(std::vector<JitExit> & exits, uint8_t *site, JitExitKind kind, uint32_t pc)
+{
+    JitExit exit;
+    exit.site = site;
+    exit.kind = kind;
+    exit.pc = pc;
+    exits.push_back(exit);
+}
+
+bool FunctionalSim::Handlers::isJitHandler(InstHandler handler)
+{
+    return isAluHandler(handler) || isControlHandler(handler) || handler == execLui ||
+           handler == execLw || handler == execLbu || handler == execLhu ||
+           handler == execSw || handler == execSh || handler == execSb;
+}
+
+//Stores that translated code doesn't do itself: to words holding code, to unaligned
+//addresses and while an LL is pending. The address has been checked already, so the
+//store can't fail. Returns non-zero if the translations have to be dropped.
+int FunctionalSim::Handlers::jitStore(JitFrame *frame, uint32_t addr, uint32_t value, uint32_t size)
+{
+    FunctionalSim & sim = *frame->sim;
+    MemEntrySize entrySize = static_cast<MemEntrySize>(size);
+    uint32_t mask = (size == WORD_SIZE) ? 0xffffffff : (1u << (8 * size)) - 1;
+
+    sim.doStore(addr, value & mask, entrySize);
+    sim.checkLLSCOverlap(addr, entrySize);
+    return sim.jit->flushPending;
+}
+
+//Loads and stores. faultPC is where the interpreter picks up if the address is
+//outside memory: the instruction itself, or the branch before it in a delay slot.
+void FunctionalSim::Handlers::emitJitMemory(JitState & jit, std::vector<JitExit> & exits, const DecodedInst & inst,
+                                            uint32_t pc, bool inDelaySlot, uint32_t faultPC)
+{
+    X86Emitter & code = jit.code;
+    InstHandler handler = inst.handler;
+    uint32_t size = (handler == execLbu || handler == execSb) ? BYTE_SIZE :
+                    ((handler == execLhu || handler == execSh) ? HALF_SIZE : WORD_SIZE);
+
+    //eax = address, checked like inMemoryRange.
+    loadJitReg(code, X86_RAX, inst.rs);
+    code.aluImm(X86_ADD, X86_RAX, inst.imm);
+    code.aluImm(X86_CMP, X86_RAX, MEMORY_SIZE - size - 1);
+    addJitExit(exits, code.jcc(X86_CC_A), JIT_EXIT_INTERPRET, faultPC);
+
+    if(handler == execLw || handler == execLbu || handler == execLhu)
+    {
+        if(size == WORD_SIZE)
+        {
+            code.load(X86_RCX, JIT_MEM, 0, X86_RAX);
+            code.bswap(X86_RCX);
+        }
+        else
+        {
+            code.loadZx(X86_RCX, size, JIT_MEM, 0, X86_RAX);
+            if(size == HALF_SIZE)
+            {
+                code.bswap16(X86_RCX);
+            }
+        }
+
+        storeJitReg(code, inst.rt, X86_RCX);
+        return;
+    }
+
+    loadJitReg(code, X86_RDX, inst.rt);
+
+    //Anything but an aligned store to a word that isn't code while no LL is
+    //pending goes to jitStore.
+    uint8_t *slow[3] = { NULL, NULL, NULL };
+    if(size != BYTE_SIZE)
+    {
+        code.testImm(X86_RAX, size - 1);
+        slow[0] = code.jcc(X86_CC_NE);
+    }
+    code.mov(X86_RCX, X86_RAX);
+    code.shr(X86_RCX, 2);
+    code.cmpByteImm(JIT_CODE_WORDS, 0, 0, X86_RCX);
+    slow[1] = code.jcc(X86_CC_NE);
+    code.cmpByteImm(JIT_LL_SC_FLAG, 0, 0);
+    slow[2] = code.jcc(X86_CC_NE);
+
+    if(size == WORD_SIZE)
+    {
+        code.bswap(X86_RDX);
+    }
+    else if(size == HALF_SIZE)
+    {
+        code.bswap16(X86_RDX);
+    }
+    code.store(size, JIT_MEM, 0, X86_RDX, X86_RAX);
+    uint8_t *done = code.jmp();
+
+    for(int i = 0 ; i < 3 ; i++)
+    {
+        if(slow[i])
+        {
+            X86Emitter::patch(slow[i], code.cur());
+        }
+    }
+
+    code.mov64(X86_RDI, JIT_FRAME);
+    code.mov(X86_RSI, X86_RAX);
+    code.movImm(X86_RCX, size);
+    code.movImm64(X86_RAX, reinterpret_cast<uint64_t>(&jitStore));
+    code.callReg(X86_RAX);
+    code.aluImm(X86_CMP, X86_RAX, 0);
+    addJitExit(exits, code.jcc(X86_CC_NE), inDelaySlot ? JIT_EXIT_NEXT_DYNAMIC : JIT_EXIT_NEXT, pc + 4);
+
+    X86Emitter::patch(done, code.cur());
+}
+
+//Everything but branches and jumps.
+void FunctionalSim::Handlers::emitJit(JitState & jit, std::vector<JitExit> & exits, const DecodedInst & inst,
+                                      uint32_t pc, bool inDelaySlot, uint32_t faultPC)
+{
+    X86Emitter & code = jit.code;
+    InstHandler handler = inst.handler;
+
+    if(handler == execAdd || handler == execAddu || handler == execSub || handler == execSubu ||
+       handler == execAnd || handler == execOr || handler == execNor)
+    {
+        X86Alu op = (handler == execAdd || handler == execAddu) ? X86_ADD :
+                    ((handler == execSub || handler == execSubu) ? X86_SUB :
+                    (handler == execAnd ? X86_AND : X86_OR));
+
+        loadJitReg(code, X86_RAX, inst.rs);
+        aluJitReg(code, op, X86_RAX, inst.rt);
+        if(handler == execAdd || handler == execSub)
+        {
+            //Like doAddSub, rd is left alone on overflow.
+            addJitExit(exits, code.jcc(X86_CC_O), JIT_EXIT_EXCEPTION, pc);
+        }
+        if(handler == execNor)
+        {
+            code.notReg(X86_RAX);
+        }
+        storeJitReg(code, inst.rd, X86_RAX);
+    }
+    else if(handler == execSlt || handler == execSltu)
+    {
+        loadJitReg(code, X86_RAX, inst.rs);
+        aluJitReg(code, X86_CMP, X86_RAX, inst.rt);
+        code.setcc(handler == execSlt ? X86_CC_L : X86_CC_B, X86_RAX);
+        storeJitReg(code, inst.rd, X86_RAX);
+    }
+    else if(handler == execSll || handler == execSrl)
+    {
+        loadJitReg(code, X86_RAX, inst.rt);
+        if(inst.shamt && handler == execSll)
+        {
+            code.shl(X86_RAX, inst.shamt);
+        }
+        else if(inst.shamt)
+        {
+            code.shr(X86_RAX, inst.shamt);
+        }
+        storeJitReg(code, inst.rd, X86_RAX);
+    }
+    else if(handler == execAddi || handler == execAddiu || handler == execAndi || handler == execOri)
+    {
+        X86Alu op = (handler == execAndi) ? X86_AND : (handler == execOri ? X86_OR : X86_ADD);
+
+        loadJitReg(code, X86_RAX, inst.rs);
+        code.aluImm(op, X86_RAX, inst.imm);
+        if(handler == execAddi)
+        {
+            addJitExit(exits, code.jcc(X86_CC_O), JIT_EXIT_EXCEPTION, pc);
+        }
+        storeJitReg(code, inst.rt, X86_RAX);
+    }
+    else if(handler == execSlti || handler == execSltiu)
+    {
+        loadJitReg(code, X86_RAX, inst.rs);
+        code.aluImm(X86_CMP, X86_RAX, inst.imm);
+        code.setcc(handler == execSlti ? X86_CC_L : X86_CC_B, X86_RAX);
+        storeJitReg(code, inst.rt, X86_RAX);
+    }
+    else if(handler == execLui)
+    {
+        if(inst.rt)
+        {
+            code.storeImm(JIT_REGS, inst.rt * WORD_SIZE, inst.imm);
+        }
+    }
+    else
+    {
+        emitJitMemory(jit, exits, inst, pc, inDelaySlot, faultPC);
+    }
+}
+
+//Empties the buffer and the tables, keeping the shared code at the start.
+void FunctionalSim::resetJit()
+{
+    jit->code.rewind(jit->firstBlock);
+    std::fill(jit->blocks.begin(), jit->blocks.end(), static_cast<uint8_t *>(NULL));
+    std::fill(jit->codeWords.begin(), jit->codeWords.end(), 0);
+    jit->flushPending = false;
+
+    //Stores from translated code don't drop predecoded instructions, so only ones
+    //recorded in codeWords from now on may be kept.
+    decodeCache.assign(NUM_DECODE_SLOTS, DecodedInst());
+    threadedCache.clear();
+}
+
+//Decodes the instruction at addr if it can be translated.
+bool FunctionalSim::decodeJit(uint32_t addr, DecodedInst & inst)
+{
+    if(addr >= MEMORY_SIZE || !FlatMemoryStore::inRange(addr, WORD_SIZE))
+    {
+        return false;
+    }
+
+    uint32_t word = flat->readWord(addr);
+    if(word == MAGIC_DEMARC)
+    {
+        return false;
+    }
+
+    Handlers::decodeInstruction(word, inst);
+    return Handlers::isJitHandler(inst.handler);
+}
+
+//Translates the block starting at pc, or returns JIT_NO_BLOCK if its first
+//instruction can't be translated. There must be JIT_MAX_BLOCK_CODE bytes left.
+uint8_t *FunctionalSim::compileJit(uint32_t pc)
+{
+    X86Emitter & code = jit->code;
+    uint8_t *block = code.cur();
+    std::vector<JitExit> exits;
+    uint32_t addr = pc;
+    bool ended = false;
+
+    for(int count = 0 ; count < JIT_MAX_BLOCK_INSTS ; count++)
+    {
+        DecodedInst inst;
+        if(!decodeJit(addr, inst))
+        {
+            break;
+        }
+
+        if(!Handlers::isControlHandler(inst.handler))
+        {
+            Handlers::emitJit(*jit, exits, inst, addr, false, addr);
+            jit->codeWords[addr / WORD_SIZE] = 1;
+            addr += 4;
+            continue;
+        }
+
+        //Branches in delay slots are left to the interpreter.
+        DecodedInst delay;
+        if(!decodeJit(addr + 4, delay) || Handlers::isControlHandler(delay.handler))
+        {
+            break;
+        }
+
+        //Work out where the branch goes before the delay slot can change its
+        //operands, and link like execJal.
+        InstHandler handler = inst.handler;
+        uint32_t fallThrough = addr + 8;
+        uint32_t target = addr + inst.imm;
+
+        if(handler == Handlers::execBeq || handler == Handlers::execBne)
+        {
+            loadJitReg(code, X86_RAX, inst.rs);
+            aluJitReg(code, X86_CMP, X86_RAX, inst.rt);
+            code.movImm(JIT_NEXT_PC, fallThrough);
+            code.movImm(X86_RCX, target);
+            code.cmov(handler == Handlers::execBeq ? X86_CC_E : X86_CC_NE, JIT_NEXT_PC, X86_RCX);
+        }
+        else if(handler == Handlers::execJr)
+        {
+            loadJitReg(code, JIT_NEXT_PC, inst.rs);
+        }
+        else
+        {
+            target = ((addr + 4) & 0xf0000000) | inst.imm;
+            if(handler == Handlers::execJal)
+            {
+                code.storeImm(JIT_REGS, REG_RA * WORD_SIZE, addr + 8);
+            }
+        }
+
+        Handlers::emitJit(*jit, exits, delay, addr + 4, true, addr);
+
+        if(handler == Handlers::execJr)
+        {
+            //Look the target up in the block table, and only leave if it hasn't
+            //been translated.
+            code.mov(X86_RAX, JIT_NEXT_PC);
+            code.testImm(X86_RAX, WORD_SIZE - 1);
+            addJitExit(exits, code.jcc(X86_CC_NE), JIT_EXIT_NEXT_DYNAMIC, 0);
+            code.aluImm(X86_CMP, X86_RAX, MEMORY_SIZE);
+            addJitExit(exits, code.jcc(X86_CC_AE), JIT_EXIT_NEXT_DYNAMIC, 0);
+            code.movImm64(X86_RCX, reinterpret_cast<uint64_t>(&jit->blocks[0]));
+            //The table holds a pointer per word, so the byte offset is pc * 2.
+            code.load64(X86_RAX, X86_RCX, 0, X86_RAX, 2);
+            code.aluImm64(X86_CMP, X86_RAX, 1);
+            addJitExit(exits, code.jcc(X86_CC_BE), JIT_EXIT_NEXT_DYNAMIC, 0);
+            code.jmpReg(X86_RAX);
+        }
+        else if((handler == Handlers::execBeq || handler == Handlers::execBne) && target != fallThrough)
+        {
+            code.aluImm(X86_CMP, JIT_NEXT_PC, target);
+            addJitExit(exits, code.jcc(X86_CC_E), JIT_EXIT_CHAIN, target);
+            addJitExit(exits, code.jmp(), JIT_EXIT_CHAIN, fallThrough);
+        }
+        else
+        {
+            addJitExit(exits, code.jmp(), JIT_EXIT_CHAIN, target);
+        }
+
+        jit->codeWords[addr / WORD_SIZE] = 1;
+        jit->codeWords[addr / WORD_SIZE + 1] = 1;
+        ended = true;
+        break;
+    }
+
+    if(code.cur() == block)
+    {
+        return JIT_NO_BLOCK;
+    }
+
+    if(!ended)
+    {
+        //Carry on at the instruction that stopped the block.
+        addJitExit(exits, code.jmp(), JIT_EXIT_CHAIN, addr);
+    }
+
+    for(size_t i = 0 ; i < exits.size() ; i++)
+    {
+        const JitExit & exit = exits[i];
+        X86Emitter::patch(exit.site, code.cur());
+
+        switch(exit.kind)
+        {
+            case JIT_EXIT_CHAIN:
+                code.movImm(X86_RAX, exit.pc);
+                code.movImm64(X86_RDX, reinterpret_cast<uint64_t>(exit.site));
+                code.jmpTo(jit->chainEpilogue);
+                break;
+            case JIT_EXIT_NEXT:
+                code.movImm(X86_RAX, exit.pc);
+                code.jmpTo(jit->epilogue);
+                break;
+            case JIT_EXIT_NEXT_DYNAMIC:
+                code.mov(X86_RAX, JIT_NEXT_PC);
+                code.jmpTo(jit->epilogue);
+                break;
+            case JIT_EXIT_INTERPRET:
+                code.storeImm(JIT_FRAME, offsetof(JitFrame, status), JIT_INTERPRET);
+                code.movImm(X86_RAX, exit.pc);
+                code.jmpTo(jit->epilogue);
+                break;
+            default:
+                code.storeImm(JIT_FRAME, offsetof(JitFrame, status), JIT_EXCEPTION);
+                code.jmpTo(jit->epilogue);
+                break;
+        }
+    }
+
+    return block;
+}
+
+int FunctionalSim::runProgramJit()
+{
+    //Translated code doesn't report its loads and stores to anyone.
+    JitState state;
+    if(!flat || tracer || warmICache || warmDCache || profiler || stateHash || !state.code.init(JIT_CODE_SIZE))
+    {
+        return runProgram();
+    }
+
+    //The shared code. Translated code is entered through a function call that
+    //saves the callee-saved registers it uses, with the stack kept aligned for
+    //calls to jitStore, and returns the next PC.
+    X86Emitter & code = state.code;
+    state.entry = code.cur();
+    code.push(X86_RBX);
+    code.push(X86_RBP);
+    code.push(X86_R12);
+    code.push(X86_R13);
+    code.push(X86_R14);
+    code.push(X86_R15);
+    code.aluImm64(X86_SUB, X86_RSP, 8);
+    code.mov64(JIT_REGS, X86_RDI);
+    code.mov64(JIT_FRAME, X86_RSI);
+    code.mov64(JIT_MEM, X86_RDX);
+    code.mov64(JIT_CODE_WORDS, X86_RCX);
+    code.mov64(JIT_LL_SC_FLAG, X86_R8);
+    code.jmpReg(X86_R9);
+
+    state.epilogue = code.cur();
+    code.aluImm64(X86_ADD, X86_RSP, 8);
+    code.pop(X86_R15);
+    code.pop(X86_R14);
+    code.pop(X86_R13);
+    code.pop(X86_R12);
+    code.pop(X86_RBP);
+    code.pop(X86_RBX);
+    code.ret();
+
+    state.chainEpilogue = code.cur();
+    code.store64(JIT_FRAME, offsetof(JitFrame, chainSite), X86_RDX);
+    code.jmpTo(state.epilogue);
+
+    state.firstBlock = code.cur();
+    state.blocks.assign(NUM_DECODE_SLOTS, NULL);
+    state.codeWords.assign(NUM_DECODE_SLOTS, 0);
+    state.frame.sim = this;
+    jit = &state;
+    resetJit();
+
+    JitEntry enter = reinterpret_cast<JitEntry>(state.entry);
+    uint8_t *chainSite = NULL;
+    bool interpret = false;
+    int ret = 0;
+
+    while(!halted)
+    {
+        if(state.flushPending || code.left() < JIT_MAX_BLOCK_CODE)
+        {
+            resetJit();
+            chainSite = NULL;
+        }
+
+        uint32_t pc = progCounter;
+        uint8_t *block = JIT_NO_BLOCK;
+
+        if(!interpret && (pc % WORD_SIZE) == 0 && pc < MEMORY_SIZE)
+        {
+            uint8_t * & slot = state.blocks[pc / WORD_SIZE];
+            if(!slot)
+            {
+                slot = compileJit(pc);
+            }
+            block = slot;
+        }
+
+        //The block just left can jump straight here next time.
+        if(chainSite && block != JIT_NO_BLOCK)
+        {
+            X86Emitter::patch(chainSite, block);
+        }
+        chainSite = NULL;
+
+        if(block != JIT_NO_BLOCK)
+        {
+            state.frame.chainSite = NULL;
+            state.frame.status = JIT_NEXT;
+            progCounter = enter(regs, &state.frame, flat->bytes(), &state.codeWords[0], &ll_sc_flag, block);
+
+            if(state.frame.status == JIT_EXCEPTION)
+            {
+                //Same as the exception handling in executeDecoded.
+                ll_sc_flag = false;
+                progCounter = EXCEPTION_ADDR;
+            }
+            interpret = state.frame.status == JIT_INTERPRET;
+            chainSite = state.frame.chainSite;
+            continue;
+        }
+
+        //One instruction (and its delay slot) on the interpreter, which predecodes
+        //them, so stores to them have to go through doStore from now on.
+        interpret = false;
+        if((pc % WORD_SIZE) == 0 && pc < MEMORY_SIZE)
+        {
+            state.codeWords[pc / WORD_SIZE] = 1;
+            if(pc / WORD_SIZE + 1 < NUM_DECODE_SLOTS)
+            {
+                state.codeWords[pc / WORD_SIZE + 1] = 1;
+            }
+        }
+
+        ret = runUntil(fetchCount + 1);
+        if(ret)
+        {
+            break;
+        }
+    }
+
+    jit = NULL;
+    return ret;
+}
+
+#else
+
+int FunctionalSim::runProgramJit()
+{
+    return runProgram();
+}
+
+#endif
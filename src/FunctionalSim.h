@@ -0,0 +1,227 @@
+#ifndef FUNCTIONAL_SIM_H
+#define FUNCTIONAL_SIM_H
+
+#include <vector>
+#include "MemoryStore.h"
+#include "FlatMemoryStore.h"
+#include "RegisterInfo.h"
+#include "MipsDefs.h"
+#include "Trace.h"
+#include "cache.h"
+#include "Profiler.h"
+#include "StateHash.h"
+
+class FunctionalSim;
+
+//A predecoded instruction. The first time the word at a given address is executed
+//it is decoded into one of these: the handler for its opcode/function plus the
+//operand fields and the already extended immediate. Later executions of the same
+//address skip the memory fetch and the decode entirely.
+struct DecodedInst;
+
+typedef int (*InstHandler)(FunctionalSim & sim, const DecodedInst & inst);
+
+struct DecodedInst
+{
+    //Executes the instruction. Returns 0, NOINC_PC or an exception/error code,
+    //exactly like the old per-format handlers did. A null handler marks an
+    //empty slot in the predecode cache.
+    InstHandler handler;
+    //The raw instruction word, kept for the halt check and error messages.
+    uint32_t word;
+    //Sign- or zero-extended immediate, the shifted LUI value, the branch
+    //displacement (relative to the branch) or the shifted jump target,
+    //depending on the instruction.
+    uint32_t imm;
+    uint8_t rs;
+    uint8_t rt;
+    uint8_t rd;
+    uint8_t shamt;
+};
+
+//One predecode slot per word of memory. Instructions can only be fetched from
+//word-aligned addresses inside the memory, so this covers every cacheable PC.
+#define NUM_DECODE_SLOTS (MEMORY_SIZE / WORD_SIZE)
+
+//Operations of the threaded engine (see runProgramThreaded). The simple ALU ops are
+//executed inline, everything else goes through the regular handlers. The last three
+//are superinstructions covering two words each.
+enum ThreadedOp
+{
+    TOP_GENERIC,
+    TOP_HALT,
+    TOP_ADDU,
+    TOP_ADDIU,
+    TOP_SUBU,
+    TOP_AND,
+    TOP_ANDI,
+    TOP_OR,
+    TOP_ORI,
+    TOP_NOR,
+    TOP_SLL,
+    TOP_SRL,
+    TOP_SLT,
+    TOP_SLTU,
+    TOP_LUI,
+    TOP_LW,
+    TOP_SW,
+    //A branch or jump together with the instruction in its delay slot.
+    TOP_BRANCH_DELAY,
+    //lui $x, hi followed by ori $x, $x, lo.
+    TOP_LUI_ORI,
+    //lw $x followed by an ALU instruction reading $x.
+    TOP_LW_ALU,
+    NUM_THREADED_OPS
+};
+
+//A threaded-code record. first is the instruction at the record's address; second
+//is the following instruction when the pair has been fused into a superinstruction.
+struct ThreadedInst
+{
+    //Address of the label implementing op, when computed goto is available.
+    const void *target;
+    uint8_t op;
+    DecodedInst first;
+    DecodedInst second;
+};
+
+//The functional simulator. An instance owns everything a run touches apart from the
+//memory: registers, PC, LL/SC state and the predecode tables. Instances share no
+//state, so several of them can run at once on different threads, each on its own
+//memory store.
+class FunctionalSim
+{
+    public:
+        FunctionalSim();
+
+        //Prepares a run of the program in mem: all registers and the PC are zeroed.
+        //mem is not owned and must outlive the run. Runs on a FlatMemoryStore bind
+        //every access statically.
+        void init(MemoryStore *mem);
+
+        //Records every access from now on, stamped with the number of instructions
+        //fetched so far. NULL turns tracing off. The threaded engine executes most
+        //instructions inline and does not feed the tracer.
+        void setTracer(TraceWriter *tracer);
+
+        //Feeds every fetch to icache and every load and store to dcache from now on,
+        //so their contents stay warm while the program runs functionally (see
+        //Cache::warm). NULL turns warming off. Like tracing, only runProgram and
+        //runInstructions do this.
+        void setCacheWarming(Cache *icache, Cache *dcache);
+
+        //Profiles every instruction from now on, along with the misses of the
+        //warming caches and the exceptions taken. NULL turns profiling off. Only
+        //runProgram and runInstructions do this.
+        void setProfiler(Profiler *profiler);
+
+        //Reports every instruction retired and every store to hash from now on (see
+        //StateHash.h). NULL turns it off. Only runProgram and runInstructions do this.
+        void setStateHash(StateHash *hash);
+
+        //Runs until the end of the code segment. Returns 0, or a negative error code
+        //if an instruction could not be fetched or executed.
+        int runProgram();
+
+        //An alternative to runProgram built on threaded code. It must leave registers
+        //and memory in exactly the same state.
+        int runProgramThreaded();
+
+        //Another alternative that translates basic blocks into x86-64 code (see
+        //FunctionalSim.cpp), with the same guarantee. Other hosts, memory stores
+        //other than FlatMemoryStore, runs with a tracer, profiler, warmed caches or
+        //state hash, and systems that refuse executable memory get runProgram
+        //instead. Only the instructions left to the interpreter are counted.
+        int runProgramJit();
+
+        //Like runProgram, but returns after count more instructions have been
+        //fetched. A branch and its delay slot run together, so this can run one more.
+        int runInstructions(uint64_t count);
+
+        //Has the end of the code segment been reached?
+        bool isHalted() const
+        {
+            return halted;
+        }
+
+        //Instructions fetched so far by runProgram and runInstructions, including the
+        //end of the code segment.
+        uint64_t getInstructionCount() const
+        {
+            return fetchCount;
+        }
+
+        void getArchState(ArchState & state) const;
+
+        //Continues from the given state. Memory may have been changed by someone
+        //else in the meantime, so nothing predecoded is kept.
+        void setArchState(const ArchState & state);
+
+        //Sets the register values in reg for printing.
+        void fillRegisterState(RegisterInfo & reg) const;
+
+        uint32_t getPC() const
+        {
+            return progCounter;
+        }
+
+        uint32_t getReg(uint32_t reg) const
+        {
+            return regs[reg];
+        }
+
+    private:
+        //The instruction handlers and the decoder, in FunctionalSim.cpp.
+        struct Handlers;
+
+        uint32_t progCounter;
+        uint32_t regs[NUM_REGS];
+        MemoryStore *mem;
+        //mem, when it is a flat store.
+        FlatMemoryStore *flat;
+
+        bool ll_sc_flag;
+        uint32_t ll_sc_addr;
+        bool halted;
+
+        TraceWriter *tracer;
+        uint64_t fetchCount;
+        Cache *warmICache;
+        Cache *warmDCache;
+        Profiler *profiler;
+        StateHash *stateHash;
+
+        std::vector<DecodedInst> decodeCache;
+        //Only allocated once the threaded engine runs.
+        std::vector<ThreadedInst> threadedCache;
+        //Decoded copies of instructions at PCs that can't be cached.
+        DecodedInst scratchDecoded;
+        ThreadedInst scratchThreaded;
+        //Translations of a runProgramJit run, NULL at any other time.
+        struct JitState;
+        JitState *jit;
+
+        int readMem(uint32_t addr, uint32_t & value, MemEntrySize size);
+        int writeMem(uint32_t addr, uint32_t value, MemEntrySize size);
+
+        int doAddSub(uint8_t rd, uint32_t s1, uint32_t s2, bool isAdd, bool checkOverflow);
+        int doLoad(uint32_t addr, MemEntrySize size, uint8_t rt);
+        void checkLLSCOverlap(uint32_t addr, MemEntrySize size);
+        void invalidateDecoded(uint32_t addr, MemEntrySize size);
+        int doStore(uint32_t addr, uint32_t value, MemEntrySize size);
+
+        int runUntil(uint64_t limit);
+        int fetchDecoded(uint32_t addr, const DecodedInst * & inst);
+        int runDelayInstruction(uint32_t delayPC, int succRet);
+        int executeDecoded(const DecodedInst & inst, uint32_t pc, bool isDelayInst);
+
+        void fuseThreaded(uint32_t addr, ThreadedInst & inst);
+        int decodeThreaded(uint32_t addr, const ThreadedInst * & inst, const void * const *labels);
+        int fetchThreaded(uint32_t addr, const ThreadedInst * & inst, const void * const *labels);
+
+        void resetJit();
+        bool decodeJit(uint32_t addr, DecodedInst & inst);
+        uint8_t *compileJit(uint32_t pc);
+};
+
+#endif
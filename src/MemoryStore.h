@@ -1,3 +1,6 @@
+#ifndef MEMORY_STORE_H
+#define MEMORY_STORE_H
+
 #include <inttypes.h>
 
 //The memory is 64 KB large.
@@ -11,6 +14,26 @@ enum MemEntrySize
     WORD_SIZE = 4
 };
 
+//Is [address, address + size) accessible? The store made by createMemoryStore never
+//allows access to the very last byte, and every other store follows it so that
+//programs running off the end of memory fail at the same address.
+inline bool inMemoryRange(uint32_t address, uint32_t size)
+{
+    return address < MEMORY_SIZE && size < MEMORY_SIZE - address;
+}
+
+//Implemented by stores that can move a whole span of bytes at once. Blocks are in
+//memory order, i.e. big-endian, like the simulated memory. This is separate from
+//MemoryStore because MemoryStore can't grow new virtual functions: the store made by
+//createMemoryStore is prebuilt against its current vtable.
+class BlockMemory
+{
+    public:
+        virtual int readBlock(uint32_t address, uint8_t *dst, uint32_t size) = 0;
+        virtual int writeBlock(uint32_t address, const uint8_t *src, uint32_t size) = 0;
+        virtual ~BlockMemory() {}
+};
+
 //A memory abstraction interface. Allows values to be set and retrieved at a number of
 //different size granularities. The implementation is also capable of printing out memory
 //values over a given address range.
@@ -21,10 +44,96 @@ class MemoryStore
         virtual int setMemValue(uint32_t address, uint32_t value, MemEntrySize size) = 0;
         virtual int printMemory(uint32_t startAddress, uint32_t endAddress) = 0;
         virtual ~MemoryStore() {}
+
+        //Copies size bytes starting at address. Stores implementing BlockMemory do
+        //this in one go, anything else a word at a time (a byte at a time where a
+        //whole word isn't accessible). Bytes that can't be read are zero, and the
+        //first error is returned.
+        int readBlock(uint32_t address, uint8_t *dst, uint32_t size);
+        int writeBlock(uint32_t address, const uint8_t *src, uint32_t size);
 };
 
+inline int MemoryStore::readBlock(uint32_t address, uint8_t *dst, uint32_t size)
+{
+    BlockMemory *block = dynamic_cast<BlockMemory *>(this);
+    if(block)
+    {
+        return block->readBlock(address, dst, size);
+    }
+
+    int ret = 0;
+    uint32_t i = 0;
+
+    while(i < size)
+    {
+        uint32_t addr = address + i;
+        uint32_t value = 0;
+        int err = 0;
+
+        if((addr % WORD_SIZE) == 0 && size - i >= WORD_SIZE && inMemoryRange(addr, WORD_SIZE))
+        {
+            err = getMemValue(addr, value, WORD_SIZE);
+            for(int b = 0 ; b < WORD_SIZE ; b++)
+            {
+                dst[i + b] = value >> (8 * (WORD_SIZE - 1 - b));
+            }
+            i += WORD_SIZE;
+        }
+        else
+        {
+            err = getMemValue(addr, value, BYTE_SIZE);
+            dst[i] = value;
+            i++;
+        }
+
+        ret = ret ? ret : err;
+    }
+
+    return ret;
+}
+
+inline int MemoryStore::writeBlock(uint32_t address, const uint8_t *src, uint32_t size)
+{
+    BlockMemory *block = dynamic_cast<BlockMemory *>(this);
+    if(block)
+    {
+        return block->writeBlock(address, src, size);
+    }
+
+    int ret = 0;
+    uint32_t i = 0;
+
+    while(i < size)
+    {
+        uint32_t addr = address + i;
+        int err = 0;
+
+        if((addr % WORD_SIZE) == 0 && size - i >= WORD_SIZE && inMemoryRange(addr, WORD_SIZE))
+        {
+            uint32_t value = 0;
+            for(int b = 0 ; b < WORD_SIZE ; b++)
+            {
+                value = (value << 8) | src[i + b];
+            }
+            err = setMemValue(addr, value, WORD_SIZE);
+            i += WORD_SIZE;
+        }
+        else
+        {
+            err = setMemValue(addr, src[i], BYTE_SIZE);
+            i++;
+        }
+
+        ret = ret ? ret : err;
+    }
+
+    return ret;
+}
+
 //Creates a memory store.
 extern MemoryStore *createMemoryStore();
 
 //Dumps the section of memory relevant for the test.
 extern void dumpMemoryState(MemoryStore *mem);
+
+#endif
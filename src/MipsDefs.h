@@ -0,0 +1,175 @@
+#ifndef MIPS_DEFS_H
+#define MIPS_DEFS_H
+
+#include <inttypes.h>
+#include "RegisterInfo.h"
+
+//Definitions shared by the functional and the cycle-accurate simulator.
+
+//Marks the end of the code segment.
+#define MAGIC_DEMARC 0xfeedfeed
+//Where execution continues after an overflow or an illegal instruction.
+#define EXCEPTION_ADDR 0x8000
+
+enum REG_IDS
+{
+    REG_ZERO,
+    REG_AT,
+    REG_V0,
+    REG_V1,
+    REG_A0,
+    REG_A1,
+    REG_A2,
+    REG_A3,
+    REG_T0,
+    REG_T1,
+    REG_T2,
+    REG_T3,
+    REG_T4,
+    REG_T5,
+    REG_T6,
+    REG_T7,
+    REG_S0,
+    REG_S1,
+    REG_S2,
+    REG_S3,
+    REG_S4,
+    REG_S5,
+    REG_S6,
+    REG_S7,
+    REG_T8,
+    REG_T9,
+    REG_K0,
+    REG_K1,
+    REG_GP,
+    REG_SP,
+    REG_FP,
+    REG_RA,
+    NUM_REGS
+};
+
+enum OP_IDS
+{
+    //R-type opcodes...
+    OP_ZERO = 0,
+    //I-type opcodes...
+    OP_ADDI = 0x8,
+    OP_ADDIU = 0x9,
+    OP_ANDI = 0xc,
+    OP_BEQ = 0x4,
+    OP_BNE = 0x5,
+    OP_LBU = 0x24,
+    OP_LHU = 0x25,
+    OP_LL = 0x30,
+    OP_LUI = 0xf,
+    OP_LW = 0x23,
+    OP_ORI = 0xd,
+    OP_SLTI = 0xa,
+    OP_SLTIU = 0xb,
+    OP_SB = 0x28,
+    OP_SC = 0x38,
+    OP_SH = 0x29,
+    OP_SW = 0x2b,
+    //J-type opcodes...
+    OP_J = 0x2,
+    OP_JAL = 0x3
+};
+
+enum FUN_IDS
+{
+    FUN_ADD = 0x20,
+    FUN_ADDU = 0x21,
+    FUN_AND = 0x24,
+    FUN_JR = 0x08,
+    FUN_NOR = 0x27,
+    FUN_OR = 0x25,
+    FUN_SLT = 0x2a,
+    FUN_SLTU = 0x2b,
+    FUN_SLL = 0x00,
+    FUN_SRL = 0x02,
+    FUN_SUB = 0x22,
+    FUN_SUBU = 0x23
+};
+
+//Architectural state of a run at an instruction boundary, handed from one simulator
+//to another (see sampled_sim.cpp). Memory is not included; the simulators share it.
+struct ArchState
+{
+    uint32_t pc;
+    uint32_t regs[NUM_REGS];
+    bool ll_sc_flag;
+    uint32_t ll_sc_addr;
+};
+
+//Byte's the smallest thing that can hold the opcode...
+inline uint8_t getOpcode(uint32_t instr)
+{
+    return (uint8_t)((instr >> 26) & 0x3f);
+}
+
+inline uint8_t getSign(uint32_t value)
+{
+    return (value >> 31) & 0x1;
+}
+
+//Branches and jumps, which all have a delay slot.
+inline bool isControlWord(uint32_t instr)
+{
+    switch(getOpcode(instr))
+    {
+        case OP_ZERO:
+            return (instr & 0x3f) == FUN_JR;
+        case OP_BEQ:
+        case OP_BNE:
+        case OP_J:
+        case OP_JAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+//Copies a register file indexed by REG_IDS into reg for printing.
+inline void fillRegisterInfo(const uint32_t *regs, RegisterInfo & reg)
+{
+    reg.at = regs[REG_AT];
+
+    for(int i = 0 ; i < V_REG_SIZE ; i++)
+    {
+        reg.v[i] = regs[i + REG_V0];
+    }
+
+    for(int i = 0 ; i < A_REG_SIZE ; i++)
+    {
+        reg.a[i] = regs[i + REG_A0];
+    }
+
+    //Remember, t8 and t9 are handled separately...
+    for(int i = 0 ; i < T_REG_SIZE - 2 ; i++)
+    {
+        reg.t[i] = regs[i + REG_T0];
+    }
+
+    for(int i = 0 ; i < S_REG_SIZE ; i++)
+    {
+        reg.s[i] = regs[i + REG_S0];
+    }
+
+    //t8 and t9...
+    for(int i = 0 ; i < 2 ; i++)
+    {
+        reg.t[i + 8] = regs[i + REG_T8];
+    }
+
+    for(int i = 0 ; i < K_REG_SIZE ; i++)
+    {
+        reg.k[i] = regs[i + REG_K0];
+    }
+
+    reg.gp = regs[REG_GP];
+    reg.sp = regs[REG_SP];
+    reg.fp = regs[REG_FP];
+    reg.ra = regs[REG_RA];
+}
+
+#endif
@@ -0,0 +1,363 @@
+#ifndef PAGED_MEMORY_STORE_H
+#define PAGED_MEMORY_STORE_H
+
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <string.h>
+#include <errno.h>
+#include "MemoryStore.h"
+
+//A sparse memory store covering the whole 32-bit address space. Memory is kept in
+//4 KB pages that are allocated the first time they are written; reading memory that
+//was never written gives zeros without allocating anything, so the footprint follows
+//the pages a program actually touches rather than the addresses it uses. Addresses
+//are translated through a two-level page table: the top 10 bits pick a table, the
+//next 10 a page in it.
+//
+//fork() makes a copy that shares every page with the original. A shared page is
+//copied by whichever store writes to it first, so one loaded program can back any
+//number of simulations, each running on its own fork and on any thread. A store
+//must not be written to while it is being forked.
+
+#define MEM_PAGE_BITS 12
+#define MEM_PAGE_SIZE (1u << MEM_PAGE_BITS)
+#define MEM_TABLE_BITS 10
+#define MEM_TABLE_SIZE (1u << MEM_TABLE_BITS)
+#define MEM_DIR_SIZE (1u << (32 - MEM_TABLE_BITS - MEM_PAGE_BITS))
+
+class PagedMemoryStore final : public MemoryStore, public BlockMemory
+{
+    public:
+        PagedMemoryStore(): pageCount(0)
+        {
+            memset(dir, 0, sizeof(dir));
+        }
+
+        ~PagedMemoryStore() override
+        {
+            for(uint32_t t = 0 ; t < MEM_DIR_SIZE ; t++)
+            {
+                if(!dir[t])
+                {
+                    continue;
+                }
+
+                for(uint32_t p = 0 ; p < MEM_TABLE_SIZE ; p++)
+                {
+                    if(dir[t]->pages[p])
+                    {
+                        release(dir[t]->pages[p]);
+                    }
+                }
+
+                delete dir[t];
+            }
+        }
+
+        //Is [address, address + size) inside the address space?
+        static bool inRange(uint32_t address, uint32_t size)
+        {
+            return static_cast<uint64_t>(address) + size <= (1ull << 32);
+        }
+
+        //Returns a copy of this memory that shares all of its pages. The copy
+        //costs one page table per 4 MB region in use, not the pages themselves.
+        PagedMemoryStore *fork() const
+        {
+            PagedMemoryStore *copy = new PagedMemoryStore();
+
+            for(uint32_t t = 0 ; t < MEM_DIR_SIZE ; t++)
+            {
+                if(!dir[t])
+                {
+                    continue;
+                }
+
+                copy->dir[t] = new PageTable(*dir[t]);
+                for(uint32_t p = 0 ; p < MEM_TABLE_SIZE ; p++)
+                {
+                    if(dir[t]->pages[p])
+                    {
+                        dir[t]->pages[p]->refs.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            copy->pageCount = pageCount;
+            return copy;
+        }
+
+        //Pages mapped by this store, including the ones it shares with forks.
+        uint32_t getPageCount() const
+        {
+            return pageCount;
+        }
+
+        int getMemValue(uint32_t address, uint32_t & value, MemEntrySize size) override
+        {
+            if(checkAccess(address, size))
+            {
+                return -EINVAL;
+            }
+
+            uint8_t buf[WORD_SIZE];
+            copyOut(address, buf, size);
+
+            value = 0;
+            for(int b = 0 ; b < size ; b++)
+            {
+                value = (value << 8) | buf[b];
+            }
+
+            return 0;
+        }
+
+        int setMemValue(uint32_t address, uint32_t value, MemEntrySize size) override
+        {
+            if(checkAccess(address, size))
+            {
+                return -EINVAL;
+            }
+
+            uint8_t buf[WORD_SIZE];
+            for(int b = size - 1 ; b >= 0 ; b--)
+            {
+                buf[b] = value;
+                value >>= 8;
+            }
+
+            copyIn(address, buf, size);
+            return 0;
+        }
+
+        int readBlock(uint32_t address, uint8_t *dst, uint32_t size) override
+        {
+            if(!inRange(address, size))
+            {
+                std::cerr << "Address range 0x" << std::hex << address << "+0x" << size
+                          << " is out of range" << std::endl;
+                return -EINVAL;
+            }
+
+            copyOut(address, dst, size);
+            return 0;
+        }
+
+        int writeBlock(uint32_t address, const uint8_t *src, uint32_t size) override
+        {
+            if(!inRange(address, size))
+            {
+                std::cerr << "Address range 0x" << std::hex << address << "+0x" << size
+                          << " is out of range" << std::endl;
+                return -EINVAL;
+            }
+
+            copyIn(address, src, size);
+            return 0;
+        }
+
+        //Same layout as the store made by createMemoryStore: the words in
+        //[startAddress, endAddress), five to a line.
+        int printMemory(uint32_t startAddress, uint32_t endAddress) override
+        {
+            if(startAddress > endAddress)
+            {
+                std::cout << "Address range 0x" << std::hex << startAddress << "-0x" << endAddress
+                          << " is out of range" << std::endl;
+                return -EINVAL;
+            }
+
+            std::ios::fmtflags flags = std::cout.flags();
+            char fill = std::cout.fill();
+            std::cout << std::hex << std::setfill('0');
+
+            int column = 0;
+            for(uint64_t addr = startAddress ; addr < endAddress ; addr += WORD_SIZE)
+            {
+                uint32_t value = 0;
+                getMemValue(addr, value, WORD_SIZE);
+
+                if(column == 0)
+                {
+                    std::cout << "0x" << std::setw(8) << addr << ": ";
+                }
+
+                std::cout << "0x" << std::setw(8) << value << " ";
+
+                if(++column == 5)
+                {
+                    std::cout << std::endl;
+                    column = 0;
+                }
+            }
+
+            if(column)
+            {
+                std::cout << std::endl;
+            }
+
+            std::cout.flags(flags);
+            std::cout.fill(fill);
+            return 0;
+        }
+
+        //Returns a copy of the low MEMORY_SIZE bytes in a store created by
+        //createMemoryStore.
+        MemoryStore *copyToMemoryStore() const
+        {
+            MemoryStore *copy = createMemoryStore();
+            uint8_t buf[WORD_SIZE];
+            uint32_t addr = 0;
+
+            for( ; inMemoryRange(addr, WORD_SIZE) ; addr += WORD_SIZE)
+            {
+                //Pages that were never written are zero in the copy already.
+                if(!findPage(addr))
+                {
+                    continue;
+                }
+
+                copyOut(addr, buf, WORD_SIZE);
+                copy->setMemValue(addr, (buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3], WORD_SIZE);
+            }
+
+            for( ; inMemoryRange(addr, BYTE_SIZE) ; addr++)
+            {
+                copyOut(addr, buf, BYTE_SIZE);
+                copy->setMemValue(addr, buf[0], BYTE_SIZE);
+            }
+
+            return copy;
+        }
+
+    private:
+        struct Page
+        {
+            //Stores sharing the page. Only a page's sole owner may write to it.
+            std::atomic<uint32_t> refs;
+            uint8_t data[MEM_PAGE_SIZE];
+        };
+
+        struct PageTable
+        {
+            Page *pages[MEM_TABLE_SIZE];
+        };
+
+        PageTable *dir[MEM_DIR_SIZE];
+        uint32_t pageCount;
+
+        //Copies go through fork(), which keeps the page counts right.
+        PagedMemoryStore(const PagedMemoryStore &) = delete;
+        PagedMemoryStore & operator=(const PagedMemoryStore &) = delete;
+
+        static void release(Page *page)
+        {
+            if(page->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                delete page;
+            }
+        }
+
+        static int checkAccess(uint32_t address, MemEntrySize size)
+        {
+            if(size != BYTE_SIZE && size != HALF_SIZE && size != WORD_SIZE)
+            {
+                std::cerr << "Invalid size passed, cannot read/write memory" << std::endl;
+                return -EINVAL;
+            }
+
+            if(!inRange(address, size))
+            {
+                std::cerr << "Address 0x" << std::hex << address << " is out of range" << std::endl;
+                return -EINVAL;
+            }
+
+            return 0;
+        }
+
+        //The page holding address, or NULL if it was never written.
+        const Page *findPage(uint32_t address) const
+        {
+            const PageTable *table = dir[address >> (MEM_TABLE_BITS + MEM_PAGE_BITS)];
+            return table ? table->pages[(address >> MEM_PAGE_BITS) & (MEM_TABLE_SIZE - 1)] : NULL;
+        }
+
+        //The page holding address, allocated or unshared as needed.
+        Page *writablePage(uint32_t address)
+        {
+            PageTable *& table = dir[address >> (MEM_TABLE_BITS + MEM_PAGE_BITS)];
+            if(!table)
+            {
+                table = new PageTable();
+            }
+
+            Page *& page = table->pages[(address >> MEM_PAGE_BITS) & (MEM_TABLE_SIZE - 1)];
+            if(!page)
+            {
+                page = new Page();
+                page->refs.store(1, std::memory_order_relaxed);
+                pageCount++;
+            }
+            else if(page->refs.load(std::memory_order_acquire) > 1)
+            {
+                Page *copy = new Page();
+                copy->refs.store(1, std::memory_order_relaxed);
+                memcpy(copy->data, page->data, MEM_PAGE_SIZE);
+                release(page);
+                page = copy;
+            }
+
+            return page;
+        }
+
+        //Callers have checked the range. Both split the copy at page boundaries.
+        void copyOut(uint32_t address, uint8_t *dst, uint32_t size) const
+        {
+            while(size)
+            {
+                uint32_t offset = address & (MEM_PAGE_SIZE - 1);
+                uint32_t chunk = size < MEM_PAGE_SIZE - offset ? size : MEM_PAGE_SIZE - offset;
+
+                const Page *page = findPage(address);
+                if(page)
+                {
+                    memcpy(dst, page->data + offset, chunk);
+                }
+                else
+                {
+                    memset(dst, 0, chunk);
+                }
+
+                address += chunk;
+                dst += chunk;
+                size -= chunk;
+            }
+        }
+
+        void copyIn(uint32_t address, const uint8_t *src, uint32_t size)
+        {
+            while(size)
+            {
+                uint32_t offset = address & (MEM_PAGE_SIZE - 1);
+                uint32_t chunk = size < MEM_PAGE_SIZE - offset ? size : MEM_PAGE_SIZE - offset;
+
+                memcpy(writablePage(address)->data + offset, src, chunk);
+
+                address += chunk;
+                src += chunk;
+                size -= chunk;
+            }
+        }
+};
+
+//dumpMemoryState only understands the stores made by createMemoryStore, so dump a
+//paged store through a copy of its low memory.
+inline void dumpMemoryState(PagedMemoryStore *mem)
+{
+    MemoryStore *copy = mem->copyToMemoryStore();
+    dumpMemoryState(copy);
+    delete copy;
+}
+
+#endif
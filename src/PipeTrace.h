@@ -0,0 +1,526 @@
+#ifndef PIPE_TRACE_H
+#define PIPE_TRACE_H
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <errno.h>
+#include "DriverFunctions.h"
+
+//Pipeline traces: the PipeState of every cycle of a run, plus what held the stages
+//up, recorded cheaply enough to leave on. The cycle simulator only copies raw
+//records into a PipeTraceBuffer; encoding and writing them happens on a background
+//thread, and disassembly is left to the offline pipe_trace tool.
+//
+//File layout: the magic number and version as little-endian 32-bit words, followed
+//by one record per run of identical cycles. A record starts with a little-endian
+//16-bit header:
+//  bits 0-9    two bits per stage, IF first: where its word comes from (PipeTraceWord)
+//  bits 10-13  PipeTraceFlags
+//  bit 14      PIPE_TRACE_NEXT - the run starts right where the previous one ended
+//  bit 15      PIPE_TRACE_SINGLE - the run is a single cycle
+//If PIPE_TRACE_NEXT is clear, a varint count of skipped cycles follows, and if
+//PIPE_TRACE_SINGLE is clear, a varint of the run length minus one. Then come the
+//literal words, IF first, as little-endian 32-bit words. Most cycles only move the
+//pipeline along by one stage, so they take six bytes.
+
+#define PIPE_TRACE_MAGIC 0x45505450
+#define PIPE_TRACE_VERSION 1
+
+#define PIPE_TRACE_STAGES 5
+#define PIPE_TRACE_FLAGS_SHIFT 10
+#define PIPE_TRACE_FLAGS_MASK 0x3c00
+#define PIPE_TRACE_NEXT 0x4000
+#define PIPE_TRACE_SINGLE 0x8000
+//Header, two varints and five literals.
+#define PIPE_TRACE_MAX_RECORD (2 + 2 * 10 + PIPE_TRACE_STAGES * 4)
+
+//Where the word of a stage comes from, relative to the previous record.
+enum PipeTraceWord
+{
+    //The same as in the same stage.
+    PIPE_WORD_SAME = 0,
+    //The word of the stage before it, i.e. the pipeline moved along.
+    PIPE_WORD_MOVED = 1,
+    //A bubble or nop.
+    PIPE_WORD_ZERO = 2,
+    PIPE_WORD_LITERAL = 3
+};
+
+enum PipeTraceFlags
+{
+    //IF waiting for an I-cache miss.
+    PIPE_IF_STALL = 0x1,
+    //ID held by a hazard, everything before it with it.
+    PIPE_ID_STALL = 0x2,
+    //MEM waiting for the D-cache, everything before it with it.
+    PIPE_MEM_STALL = 0x4,
+    //An exception dropped the instructions in ID and IF.
+    PIPE_FLUSH = 0x8
+};
+
+//A run of identical cycles. state.cycle is the first of them.
+struct PipeTraceRecord
+{
+    PipeState state;
+    uint32_t cycles;
+    uint32_t flags;
+
+    uint32_t stage(int s) const
+    {
+        const uint32_t *words = &state.ifInstr;
+        return words[s];
+    }
+
+    uint32_t & stage(int s)
+    {
+        uint32_t *words = &state.ifInstr;
+        return words[s];
+    }
+
+    //Did stage s keep its instruction for the next cycle?
+    bool held(int s) const
+    {
+        switch(s)
+        {
+            case 0:
+                return (flags & (PIPE_IF_STALL | PIPE_ID_STALL | PIPE_MEM_STALL)) && !(flags & PIPE_FLUSH);
+            case 1:
+                return (flags & (PIPE_ID_STALL | PIPE_MEM_STALL)) && !(flags & PIPE_FLUSH);
+            case 2:
+            case 3:
+                return flags & PIPE_MEM_STALL;
+            default:
+                return false;
+        }
+    }
+};
+
+//State shared by the encoder and the decoder: the previous record.
+struct PipeTraceStreamState
+{
+    PipeTraceRecord last;
+
+    void reset()
+    {
+        last = PipeTraceRecord();
+    }
+
+    uint64_t lastEnd() const
+    {
+        return static_cast<uint64_t>(last.state.cycle) + last.cycles;
+    }
+};
+
+class PipeTraceEncoder
+{
+    public:
+        PipeTraceEncoder()
+        {
+            state.reset();
+        }
+
+        void reset()
+        {
+            state.reset();
+        }
+
+        //Writes rec to out, which needs room for PIPE_TRACE_MAX_RECORD bytes, and
+        //returns the end of what was written.
+        uint8_t *encode(const PipeTraceRecord & rec, uint8_t *out)
+        {
+            uint8_t *headerPos = out;
+            uint16_t header = rec.flags << PIPE_TRACE_FLAGS_SHIFT;
+            out += 2;
+
+            uint64_t gap = rec.state.cycle - state.lastEnd();
+            if(gap == 0)
+            {
+                header |= PIPE_TRACE_NEXT;
+            }
+            else
+            {
+                out = putVarint(gap, out);
+            }
+
+            if(rec.cycles == 1)
+            {
+                header |= PIPE_TRACE_SINGLE;
+            }
+            else
+            {
+                out = putVarint(rec.cycles - 1, out);
+            }
+
+            for(int s = 0 ; s < PIPE_TRACE_STAGES ; s++)
+            {
+                uint32_t word = rec.stage(s);
+                uint16_t code = PIPE_WORD_LITERAL;
+
+                if(word == state.last.stage(s))
+                {
+                    code = PIPE_WORD_SAME;
+                }
+                else if(s > 0 && word == state.last.stage(s - 1))
+                {
+                    code = PIPE_WORD_MOVED;
+                }
+                else if(word == 0)
+                {
+                    code = PIPE_WORD_ZERO;
+                }
+                else
+                {
+                    out = putWord(word, out);
+                }
+
+                header |= code << (2 * s);
+            }
+
+            headerPos[0] = header & 0xff;
+            headerPos[1] = header >> 8;
+            state.last = rec;
+            return out;
+        }
+
+        static uint8_t *putWord(uint32_t value, uint8_t *out)
+        {
+            out[0] = value & 0xff;
+            out[1] = (value >> 8) & 0xff;
+            out[2] = (value >> 16) & 0xff;
+            out[3] = value >> 24;
+            return out + 4;
+        }
+
+    private:
+        PipeTraceStreamState state;
+
+        static uint8_t *putVarint(uint64_t value, uint8_t *out)
+        {
+            while(value >= 0x80)
+            {
+                *out++ = (value & 0x7f) | 0x80;
+                value >>= 7;
+            }
+            *out++ = value;
+            return out;
+        }
+};
+
+//Keeps the last records of a run in memory. On its own it is a flight recorder:
+//save() writes out whatever the last capacity records were. startStreaming() has a
+//background thread write every record to a file as well. Either way record() only
+//copies the record; it never waits for the writer and drops records instead if the
+//writer falls a whole buffer behind.
+//
+//record() must always be called from the same thread, and so must save() and the
+//streaming calls.
+class PipeTraceBuffer
+{
+    public:
+        //capacity is rounded up to a power of two.
+        explicit PipeTraceBuffer(size_t capacity): head(0), tail(0), tailSeen(0), streaming(false), stopping(false), dropped(0)
+        {
+            size_t size = 1;
+            while(size < capacity)
+            {
+                size <<= 1;
+            }
+
+            records.resize(size);
+            mask = size - 1;
+        }
+
+        ~PipeTraceBuffer()
+        {
+            stopStreaming();
+        }
+
+        void record(const PipeState & state, uint32_t cycles, uint32_t flags)
+        {
+            uint64_t pos = head.load(std::memory_order_relaxed);
+
+            if(streaming && pos - tailSeen > mask)
+            {
+                tailSeen = tail.load(std::memory_order_acquire);
+                if(pos - tailSeen > mask)
+                {
+                    dropped++;
+                    return;
+                }
+            }
+
+            PipeTraceRecord & rec = records[pos & mask];
+            rec.state = state;
+            rec.cycles = cycles;
+            rec.flags = flags;
+            head.store(pos + 1, std::memory_order_release);
+        }
+
+        //Writes the records still in the buffer, oldest first, to a trace file.
+        int save(const char *fileName)
+        {
+            if(streaming)
+            {
+                return -EBUSY;
+            }
+
+            std::ofstream file;
+            if(openFile(file, fileName))
+            {
+                return -EBADF;
+            }
+
+            uint64_t end = head.load(std::memory_order_relaxed);
+            uint64_t pos = end > records.size() ? end - records.size() : 0;
+
+            PipeTraceEncoder encoder;
+            size_t size;
+            while(pos < end)
+            {
+                pos = encodeRecords(encoder, pos, end, size);
+                file.write((const char *)bytes.data(), size);
+            }
+
+            return file ? 0 : -EIO;
+        }
+
+        //Writes every record from now on to a trace file, until stopStreaming.
+        int startStreaming(const char *fileName)
+        {
+            stopStreaming();
+
+            if(openFile(out, fileName))
+            {
+                return -EBADF;
+            }
+
+            tailSeen = head.load(std::memory_order_relaxed);
+            tail.store(tailSeen, std::memory_order_relaxed);
+            stopping.store(false, std::memory_order_relaxed);
+            streaming = true;
+            writer = std::thread(&PipeTraceBuffer::writeLoop, this);
+            return 0;
+        }
+
+        //Writes out the records not written yet and closes the file.
+        void stopStreaming()
+        {
+            if(!streaming)
+            {
+                return;
+            }
+
+            stopping.store(true, std::memory_order_release);
+            writer.join();
+            out.close();
+            streaming = false;
+        }
+
+        //Records lost because the writer fell behind.
+        uint64_t getDropped() const
+        {
+            return dropped;
+        }
+
+    private:
+        //Records written by the writer thread at once.
+        static const size_t WRITE_BATCH = 4096;
+
+        std::vector<PipeTraceRecord> records;
+        size_t mask;
+        //Records ever recorded, and records handed to the writer so far. Only the
+        //records in between belong to the writer. Each has a cache line of its own.
+        alignas(64) std::atomic<uint64_t> head;
+        alignas(64) std::atomic<uint64_t> tail;
+        //What the producer last saw of tail, so it only reads tail when it looks full.
+        alignas(64) uint64_t tailSeen;
+        bool streaming;
+        std::atomic<bool> stopping;
+        uint64_t dropped;
+        std::ofstream out;
+        std::thread writer;
+        std::vector<uint8_t> bytes;
+
+        static int openFile(std::ofstream & file, const char *fileName)
+        {
+            file.open(fileName, std::ios::binary | std::ios::out | std::ios::trunc);
+            if(!file)
+            {
+                std::cout << "Could not open pipeline trace file " << fileName << std::endl;
+                return -EBADF;
+            }
+
+            uint8_t header[8];
+            PipeTraceEncoder::putWord(PIPE_TRACE_VERSION, PipeTraceEncoder::putWord(PIPE_TRACE_MAGIC, header));
+            file.write((const char *)header, sizeof(header));
+            return 0;
+        }
+
+        //Encodes at most WRITE_BATCH records from pos on into bytes, setting size to
+        //the bytes used. Returns where it stopped.
+        uint64_t encodeRecords(PipeTraceEncoder & encoder, uint64_t pos, uint64_t end, size_t & size)
+        {
+            end = end - pos > WRITE_BATCH ? pos + WRITE_BATCH : end;
+            bytes.resize(WRITE_BATCH * PIPE_TRACE_MAX_RECORD);
+
+            uint8_t *next = bytes.data();
+            for( ; pos < end ; pos++)
+            {
+                next = encoder.encode(records[pos & mask], next);
+            }
+
+            size = next - bytes.data();
+            return end;
+        }
+
+        void writeLoop()
+        {
+            PipeTraceEncoder encoder;
+
+            while(true)
+            {
+                //Anything recorded before stopping was set is seen here.
+                bool last = stopping.load(std::memory_order_acquire);
+                uint64_t end = head.load(std::memory_order_acquire);
+                uint64_t pos = tail.load(std::memory_order_relaxed);
+
+                if(pos == end)
+                {
+                    if(last)
+                    {
+                        break;
+                    }
+
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    continue;
+                }
+
+                //The records are copied out, so the producer can have them back.
+                size_t size;
+                tail.store(encodeRecords(encoder, pos, end, size), std::memory_order_release);
+                out.write((const char *)bytes.data(), size);
+            }
+        }
+};
+
+//Reads a whole pipeline trace into memory and decodes it one record at a time.
+class PipeTraceReader
+{
+    public:
+        PipeTraceReader(): pos(0)
+        {
+            state.reset();
+        }
+
+        int open(const char *fileName)
+        {
+            std::ifstream in(fileName, std::ios::binary | std::ios::in);
+            if(!in)
+            {
+                std::cout << "Could not open pipeline trace file " << fileName << std::endl;
+                return -EBADF;
+            }
+
+            in.seekg(0, std::ios::end);
+            data.resize(in.tellg());
+            in.seekg(0, std::ios::beg);
+            in.read((char *)data.data(), data.size());
+
+            if(data.size() < 8 || getWord(0) != PIPE_TRACE_MAGIC)
+            {
+                std::cout << fileName << " is not a pipeline trace file" << std::endl;
+                return -EINVAL;
+            }
+
+            if(getWord(4) != PIPE_TRACE_VERSION)
+            {
+                std::cout << "Unsupported pipeline trace version " << getWord(4) << std::endl;
+                return -EINVAL;
+            }
+
+            pos = 8;
+            state.reset();
+            return 0;
+        }
+
+        //Decodes the next record. Returns false at the end of the trace.
+        bool next(PipeTraceRecord & rec)
+        {
+            if(pos + 2 > data.size())
+            {
+                return false;
+            }
+
+            uint16_t header = data[pos] | (data[pos + 1] << 8);
+            pos += 2;
+
+            uint64_t start = state.lastEnd();
+            if(!(header & PIPE_TRACE_NEXT))
+            {
+                start += getVarint();
+            }
+
+            rec.state.cycle = start;
+            rec.cycles = (header & PIPE_TRACE_SINGLE) ? 1 : getVarint() + 1;
+            rec.flags = (header & PIPE_TRACE_FLAGS_MASK) >> PIPE_TRACE_FLAGS_SHIFT;
+
+            for(int s = 0 ; s < PIPE_TRACE_STAGES ; s++)
+            {
+                switch((header >> (2 * s)) & 0x3)
+                {
+                    case PIPE_WORD_SAME:
+                        rec.stage(s) = state.last.stage(s);
+                        break;
+                    case PIPE_WORD_MOVED:
+                        rec.stage(s) = state.last.stage(s - 1);
+                        break;
+                    case PIPE_WORD_ZERO:
+                        rec.stage(s) = 0;
+                        break;
+                    default:
+                        rec.stage(s) = pos + 4 <= data.size() ? getWord(pos) : 0;
+                        pos += 4;
+                        break;
+                }
+            }
+
+            state.last = rec;
+            return pos <= data.size();
+        }
+
+    private:
+        std::vector<uint8_t> data;
+        size_t pos;
+        PipeTraceStreamState state;
+
+        uint32_t getWord(size_t at) const
+        {
+            return data[at] | (data[at + 1] << 8) | (data[at + 2] << 16) |
+                   (static_cast<uint32_t>(data[at + 3]) << 24);
+        }
+
+        uint64_t getVarint()
+        {
+            uint64_t value = 0;
+            int shift = 0;
+
+            while(pos < data.size())
+            {
+                uint8_t byte = data[pos++];
+                value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                if(!(byte & 0x80))
+                {
+                    break;
+                }
+                shift += 7;
+            }
+
+            return value;
+        }
+};
+
+#endif
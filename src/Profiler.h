@@ -0,0 +1,390 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <unordered_map>
+#include <stdio.h>
+#include <errno.h>
+#include "MipsDefs.h"
+#include "MemoryStore.h"
+#include "Disassembler.h"
+
+//Guest profiler: attributes executed instructions and the events below to the PC
+//they happened at and to the call stack at the time. Counters live in flat arrays
+//indexed by PC (one slot per word of memory, plus one for everything outside it)
+//and by call stack node, so counting an event is two increments.
+//
+//Call stacks are rebuilt from the instructions retired: jal calls, jr $ra returns.
+//Both take effect once their delay slot has retired, and a return pops back to the
+//frame whose return address it lands on, so frames skipped by hand-written control
+//flow don't pile up. Frames are named by the address of the function.
+
+enum ProfileEvent
+{
+    PROF_INSTRUCTIONS,
+    PROF_IC_MISSES,
+    PROF_DC_MISSES,
+    //Cycles an instruction held up the pipeline, counted against the oldest
+    //instruction being held.
+    PROF_STALL_CYCLES,
+    //Pipeline flushes caused: exceptions taken and mispredicted branches.
+    PROF_FLUSHES,
+    NUM_PROF_EVENTS
+};
+
+#define PROF_MASK(event) (1u << (event))
+#define NUM_PROFILE_SLOTS (MEMORY_SIZE / WORD_SIZE + 1)
+//Deeper calls are counted in the deepest frame.
+#define MAX_PROFILE_DEPTH 256
+
+struct ProfileCounters
+{
+    uint64_t counts[NUM_PROF_EVENTS];
+
+    uint64_t sum(uint32_t events) const
+    {
+        uint64_t total = 0;
+        for(int e = 0 ; e < NUM_PROF_EVENTS ; e++)
+        {
+            total += ((events >> e) & 1) ? counts[e] : 0;
+        }
+        return total;
+    }
+};
+
+class Profiler
+{
+    public:
+        Profiler(): slots(NUM_PROFILE_SLOTS), words(NUM_PROFILE_SLOTS, 0), current(0), pending(PENDING_NONE),
+                    pendingTarget(0), pendingReturn(0), lastPC(0), lastWord(0),
+                    retiredCount(0), settledCount(0)
+        {
+            reset();
+        }
+
+        void reset()
+        {
+            std::fill(slots.begin(), slots.end(), ProfileCounters());
+            nodes.assign(1, StackNode());
+            nodeCounters.assign(1, ProfileCounters());
+            children.clear();
+            frames.clear();
+            current = 0;
+            pending = PENDING_NONE;
+            lastPC = 0;
+            lastWord = 0;
+            retiredCount = 0;
+            settledCount = 0;
+        }
+
+        void count(ProfileEvent event, uint32_t pc, uint64_t n = 1)
+        {
+            slots[getSlot(pc)].counts[event] += n;
+            nodeCounters[current].counts[event] += n;
+        }
+
+        //The instruction word at pc flushed the pipeline (it may never retire).
+        void flush(uint32_t pc, uint32_t word)
+        {
+            count(PROF_FLUSHES, pc);
+            words[getSlot(pc)] = word;
+        }
+
+        //The instruction word at pc has completed. Instructions must be retired in
+        //program order.
+        void retire(uint32_t pc, uint32_t word)
+        {
+            if(pending == PENDING_RETURN)
+            {
+                popTo(pc);
+            }
+
+            //The call stack gets its instructions when it changes (see settle).
+            uint32_t slot = getSlot(pc);
+            slots[slot].counts[PROF_INSTRUCTIONS]++;
+            words[slot] = word;
+            retiredCount++;
+            lastPC = pc;
+            lastWord = word;
+
+            if(pending != PENDING_NONE || getOpcode(word) == OP_JAL || (word & JR_MASK) == JR_RA)
+            {
+                trackCall(pc, word);
+            }
+        }
+
+        //Writes one line per PC with any events, sorted by the sum of the events
+        //in sortBy (a mask of PROF_MASK bits). maxRows 0 prints them all.
+        void printTable(std::ostream & out, uint32_t sortBy, size_t maxRows = 0) const
+        {
+            std::vector<uint32_t> order;
+            ProfileCounters total = ProfileCounters();
+
+            for(uint32_t s = 0 ; s < NUM_PROFILE_SLOTS ; s++)
+            {
+                if(slots[s].sum(~0u))
+                {
+                    order.push_back(s);
+                    for(int e = 0 ; e < NUM_PROF_EVENTS ; e++)
+                    {
+                        total.counts[e] += slots[s].counts[e];
+                    }
+                }
+            }
+
+            std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+            {
+                return slots[a].sum(sortBy) > slots[b].sum(sortBy);
+            });
+
+            if(maxRows && order.size() > maxRows)
+            {
+                order.resize(maxRows);
+            }
+
+            std::ios::fmtflags flags = out.flags();
+            out << std::left << std::setw(12) << "PC" << std::right;
+            for(int e = 0 ; e < NUM_PROF_EVENTS ; e++)
+            {
+                out << std::setw(14) << getEventName(static_cast<ProfileEvent>(e));
+            }
+            out << "  Instruction" << std::endl;
+
+            for(size_t i = 0 ; i < order.size() ; i++)
+            {
+                uint32_t s = order[i];
+                if(s == NUM_PROFILE_SLOTS - 1)
+                {
+                    out << std::left << std::setw(12) << "other" << std::right;
+                }
+                else
+                {
+                    out << "0x" << std::hex << std::setfill('0') << std::setw(8) << s * WORD_SIZE
+                        << std::dec << std::setfill(' ') << "  ";
+                }
+
+                for(int e = 0 ; e < NUM_PROF_EVENTS ; e++)
+                {
+                    out << std::setw(14) << slots[s].counts[e];
+                }
+                out << "  " << (s == NUM_PROFILE_SLOTS - 1 ? "" : disassemble(words[s])) << std::endl;
+            }
+
+            out << std::left << std::setw(12) << "total" << std::right;
+            for(int e = 0 ; e < NUM_PROF_EVENTS ; e++)
+            {
+                out << std::setw(14) << total.counts[e];
+            }
+            out << std::endl;
+            out.flags(flags);
+        }
+
+        //Writes the folded stacks ("frame;frame;frame count") flame graph tools take,
+        //weighted by the sum of the events in the mask.
+        void writeFolded(std::ostream & out, uint32_t events) const
+        {
+            std::vector<std::string> names(nodes.size());
+
+            for(size_t n = 0 ; n < nodes.size() ; n++)
+            {
+                //Parents are always created before their children.
+                char frame[16];
+                snprintf(frame, sizeof(frame), "0x%08x", nodes[n].func);
+                names[n] = n ? names[nodes[n].parent] + ";" + frame : frame;
+
+                uint64_t weight = nodeCounters[n].sum(events);
+                if(n == current && (events & PROF_MASK(PROF_INSTRUCTIONS)))
+                {
+                    weight += retiredCount - settledCount;
+                }
+                if(weight)
+                {
+                    out << names[n] << " " << weight << "\n";
+                }
+            }
+
+            out.flush();
+        }
+
+        //Writes the table to fileName and the folded stacks to fileName.folded.
+        int save(const char *fileName, uint32_t sortBy, uint32_t foldedEvents) const
+        {
+            std::ofstream table(fileName);
+            std::ofstream folded(std::string(fileName) + ".folded");
+            if(!table || !folded)
+            {
+                std::cout << "Could not open profile file " << fileName << std::endl;
+                return -EBADF;
+            }
+
+            printTable(table, sortBy);
+            writeFolded(folded, foldedEvents);
+            return table && folded ? 0 : -EIO;
+        }
+
+        //The last instruction retired.
+        uint32_t getLastPC() const
+        {
+            return lastPC;
+        }
+
+        uint32_t getLastWord() const
+        {
+            return lastWord;
+        }
+
+        static const char *getEventName(ProfileEvent event)
+        {
+            static const char *const names[NUM_PROF_EVENTS] =
+            {
+                "Instructions", "I-misses", "D-misses", "Stalls", "Flushes"
+            };
+            return names[event];
+        }
+
+    private:
+        enum PendingControl
+        {
+            PENDING_NONE,
+            //A jal retired, its delay slot is next.
+            PENDING_CALL,
+            //A jr $ra retired, its delay slot is next.
+            PENDING_RETURN_SLOT,
+            //The next instruction is where the return went.
+            PENDING_RETURN
+        };
+
+        struct StackNode
+        {
+            uint32_t parent;
+            uint32_t func;
+        };
+
+        struct Frame
+        {
+            uint32_t node;
+            uint32_t returnAddr;
+        };
+
+        std::vector<ProfileCounters> slots;
+        //The last word seen in each slot, for the table.
+        std::vector<uint32_t> words;
+        //Call stack trie. Node 0 is the program itself, started at address 0.
+        std::vector<StackNode> nodes;
+        std::vector<ProfileCounters> nodeCounters;
+        //(parent, function) -> node.
+        std::unordered_map<uint64_t, uint32_t> children;
+        std::vector<Frame> frames;
+        uint32_t current;
+        PendingControl pending;
+        uint32_t pendingTarget;
+        uint32_t pendingReturn;
+        uint32_t lastPC;
+        uint32_t lastWord;
+        //Instructions retired, and how many of them have been added to the call
+        //stack they retired in.
+        uint64_t retiredCount;
+        uint64_t settledCount;
+
+        //jr $ra, ignoring the fields jr doesn't use.
+        static const uint32_t JR_MASK = 0xffe0003f;
+        static const uint32_t JR_RA = (REG_RA << 21) | FUN_JR;
+
+        //Follows calls and returns, for an instruction that is one or is in the
+        //delay slot of one.
+        void trackCall(uint32_t pc, uint32_t word)
+        {
+            if(pending == PENDING_CALL)
+            {
+                push(pendingTarget, pendingReturn);
+            }
+            pending = pending == PENDING_RETURN_SLOT ? PENDING_RETURN : PENDING_NONE;
+
+            if(getOpcode(word) == OP_JAL)
+            {
+                pending = PENDING_CALL;
+                pendingTarget = ((pc + 4) & 0xf0000000) | ((word & 0x3ffffff) << 2);
+                pendingReturn = pc + 8;
+            }
+            else if((word & JR_MASK) == JR_RA)
+            {
+                pending = PENDING_RETURN_SLOT;
+            }
+        }
+
+        static uint32_t getSlot(uint32_t pc)
+        {
+            return pc < MEMORY_SIZE ? pc / WORD_SIZE : NUM_PROFILE_SLOTS - 1;
+        }
+
+        //Adds the instructions retired since the call stack last changed to it.
+        //Incrementing a single counter on every instruction would cost more than
+        //everything else the profiler does.
+        void settle()
+        {
+            nodeCounters[current].counts[PROF_INSTRUCTIONS] += retiredCount - settledCount;
+            settledCount = retiredCount;
+        }
+
+        void push(uint32_t func, uint32_t returnAddr)
+        {
+            settle();
+            uint32_t node = current;
+
+            if(frames.size() < MAX_PROFILE_DEPTH)
+            {
+                uint64_t key = (static_cast<uint64_t>(current) << 32) | func;
+                auto found = children.find(key);
+                if(found != children.end())
+                {
+                    node = found->second;
+                }
+                else
+                {
+                    node = nodes.size();
+                    StackNode child;
+                    child.parent = current;
+                    child.func = func;
+                    nodes.push_back(child);
+                    nodeCounters.push_back(ProfileCounters());
+                    children[key] = node;
+                }
+            }
+
+            Frame frame;
+            frame.node = node;
+            frame.returnAddr = returnAddr;
+            frames.push_back(frame);
+            current = node;
+        }
+
+        //Returns to the frame that called the function returning to pc, or just
+        //out of the innermost one if no frame returns there.
+        void popTo(uint32_t pc)
+        {
+            settle();
+            size_t depth = frames.size();
+            while(depth && frames[depth - 1].returnAddr != pc)
+            {
+                depth--;
+            }
+
+            if(depth)
+            {
+                frames.resize(depth - 1);
+            }
+            else if(!frames.empty())
+            {
+                frames.pop_back();
+            }
+
+            current = frames.empty() ? 0 : frames.back().node;
+        }
+};
+
+#endif
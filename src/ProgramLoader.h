@@ -0,0 +1,175 @@
+#ifndef PROGRAM_LOADER_H
+#define PROGRAM_LOADER_H
+
+#include <iostream>
+#include <vector>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "MemoryStore.h"
+#include "FlatMemoryStore.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//Loads program images: a file of big-endian instruction and data words that is copied
+//to memory starting at address 0. A FlatMemoryStore already holds memory in the
+//file's byte order, so the file is read straight into it. Other stores that take
+//blocks get the image in one writeBlock. Any other store gets the image read into a
+//buffer, byte-swapped to host order in bulk and then written one word at a time.
+//Like the ifstream loops this replaces, a trailing partial word is ignored.
+//
+//Images are at most MEMORY_SIZE bytes, which is too small for mapping the file to pay
+//off: mmap, the page faults and munmap cost more than a single read.
+
+//The last word of memory can't be written (see FlatMemoryStore::inRange), so this is
+//the largest image that fits.
+#define MAX_PROGRAM_SIZE (MEMORY_SIZE - WORD_SIZE)
+
+//Converts count big-endian words at src to host order at dst. src and dst may be the
+//same buffer.
+inline void loadBigEndianWords(const uint8_t *src, uint32_t *dst, size_t count)
+{
+    size_t i = 0;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    memcpy(dst, src, count * sizeof(uint32_t));
+    i = count;
+#elif defined(__SSE2__)
+    //Four words at a time: swap the bytes of every half word, then the half words.
+    for( ; i + 4 <= count ; i += 4)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * sizeof(uint32_t)));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), v);
+    }
+#endif
+
+    for( ; i < count ; i++)
+    {
+        uint32_t value;
+        memcpy(&value, src + i * sizeof(uint32_t), sizeof(value));
+        dst[i] = HostToBigEndianWord(value);
+    }
+}
+
+//Reads exactly size bytes, or fails.
+inline int readFully(int fd, void *dst, size_t size)
+{
+    uint8_t *pos = static_cast<uint8_t *>(dst);
+
+    while(size)
+    {
+        ssize_t got = read(fd, pos, size);
+        if(got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(got <= 0)
+        {
+            return -EIO;
+        }
+
+        pos += got;
+        size -= got;
+    }
+
+    return 0;
+}
+
+inline int loadProgram(const char *fileName, MemoryStore *mem)
+{
+    if(!mem)
+    {
+        std::cout << "Invalid memory store passed, could not load the program" << std::endl;
+        return -EINVAL;
+    }
+
+    int fd = open(fileName, O_RDONLY);
+    if(fd < 0)
+    {
+        std::cout << "Could not open program file " << fileName << std::endl;
+        return -EBADF;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st))
+    {
+        std::cout << "Could not read program file " << fileName << std::endl;
+        close(fd);
+        return -EBADF;
+    }
+
+    size_t words = st.st_size / WORD_SIZE;
+    if(words * WORD_SIZE > MAX_PROGRAM_SIZE)
+    {
+        std::cout << "Program " << fileName << " is " << st.st_size << " bytes, but only "
+                  << MAX_PROGRAM_SIZE << " bytes of memory can be loaded" << std::endl;
+        close(fd);
+        return -EINVAL;
+    }
+
+    if(!words)
+    {
+        close(fd);
+        return 0;
+    }
+
+    int ret = 0;
+    size_t size = words * WORD_SIZE;
+
+    FlatMemoryStore *flat = dynamic_cast<FlatMemoryStore *>(mem);
+    BlockMemory *block = dynamic_cast<BlockMemory *>(mem);
+    if(flat)
+    {
+        ret = readFully(fd, flat->bytes(), size);
+        close(fd);
+    }
+    else if(block)
+    {
+        std::vector<uint8_t> image(size);
+        ret = readFully(fd, image.data(), size);
+        close(fd);
+
+        if(!ret && (ret = block->writeBlock(0, image.data(), size)))
+        {
+            std::cout << "Could not set memory value!" << std::endl;
+            return ret;
+        }
+    }
+    else
+    {
+        std::vector<uint32_t> values(words);
+        ret = readFully(fd, values.data(), size);
+        close(fd);
+
+        if(!ret)
+        {
+            loadBigEndianWords(reinterpret_cast<const uint8_t *>(values.data()), values.data(), words);
+
+            for(size_t i = 0 ; i < words && !ret ; i++)
+            {
+                ret = mem->setMemValue(i * WORD_SIZE, values[i], WORD_SIZE);
+            }
+
+            if(ret)
+            {
+                std::cout << "Could not set memory value!" << std::endl;
+                return ret;
+            }
+        }
+    }
+
+    if(ret)
+    {
+        std::cout << "Could not read program file " << fileName << std::endl;
+    }
+
+    return ret;
+}
+
+#endif
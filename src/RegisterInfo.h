@@ -1,3 +1,8 @@
+#ifndef REGISTER_INFO_H
+#define REGISTER_INFO_H
+
+#include <inttypes.h>
+
 #define V_REG_SIZE 2
 #define A_REG_SIZE 4
 #define T_REG_SIZE 10
@@ -30,3 +35,5 @@ struct RegisterInfo
 };
 
 extern void dumpRegisterState(RegisterInfo & reg);
+
+#endif
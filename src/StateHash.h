@@ -0,0 +1,163 @@
+#ifndef STATE_HASH_H
+#define STATE_HASH_H
+
+#include <vector>
+#include <algorithm>
+#include <inttypes.h>
+#include <errno.h>
+#include "MipsDefs.h"
+#include "MemoryStore.h"
+
+//A hash of the architectural state of a run - the registers and every word of
+//memory - kept up to date as instructions retire, for comparing two simulators in
+//lockstep (see sampled_sim.cpp). The hash is a sum over all slots of a mix of the
+//slot number and its value, so a write only has to take the old value's term out
+//and put the new one in. Shadow copies of the registers and memory provide the old
+//values, and tell where two runs differ once their hashes do.
+//
+//Each simulator reports the instructions it retires in program order, with the
+//register they write (see getDestReg) and their stores. Instructions dropped by an
+//exception are not reported.
+
+//The register an instruction writes, 0 if none.
+inline uint8_t getDestReg(uint32_t word)
+{
+    switch(getOpcode(word))
+    {
+        case OP_ZERO:
+            return (word & 0x3f) == FUN_JR ? 0 : (word >> 11) & 0x1f;
+        case OP_JAL:
+            return REG_RA;
+        case OP_BEQ:
+        case OP_BNE:
+        case OP_J:
+        case OP_SB:
+        case OP_SH:
+        case OP_SW:
+            return 0;
+        default:
+            //Immediate ALU instructions, loads and SC.
+            return (word >> 16) & 0x1f;
+    }
+}
+
+#define NUM_HASH_WORDS (MEMORY_SIZE / WORD_SIZE)
+
+class StateHash
+{
+    public:
+        StateHash(): hash(0), retired(0), lastPC(0)
+        {
+        }
+
+        //Starts from all-zero registers and the current contents of mem. The last
+        //byte of memory can't be accessed (see inMemoryRange) and is taken as zero.
+        int init(MemoryStore *mem)
+        {
+            std::vector<uint8_t> bytes(MEMORY_SIZE, 0);
+            if(mem->readBlock(0, &bytes[0], MEMORY_SIZE - 1))
+            {
+                return -EBADF;
+            }
+
+            words.assign(NUM_HASH_WORDS, 0);
+            std::fill(regs, regs + NUM_REGS, 0);
+            hash = 0;
+            retired = 0;
+            lastPC = 0;
+
+            for(uint32_t i = 0 ; i < NUM_HASH_WORDS ; i++)
+            {
+                const uint8_t *b = &bytes[i * WORD_SIZE];
+                words[i] = (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+                hash += mix(NUM_REGS + i, words[i]);
+            }
+
+            for(uint32_t r = 0 ; r < NUM_REGS ; r++)
+            {
+                hash += mix(r, 0);
+            }
+
+            return 0;
+        }
+
+        //An instruction at pc retired, having written value to register reg.
+        void retire(uint32_t pc, uint8_t reg, uint32_t value)
+        {
+            retired++;
+            lastPC = pc;
+
+            if(reg && regs[reg] != value)
+            {
+                hash += mix(reg, value) - mix(reg, regs[reg]);
+                regs[reg] = value;
+            }
+        }
+
+        //A store, reported along with the instruction making it. Stores outside
+        //memory fail in both simulators and are ignored.
+        void store(uint32_t addr, uint32_t value, MemEntrySize size)
+        {
+            uint32_t slot = addr / WORD_SIZE;
+            if(slot >= NUM_HASH_WORDS)
+            {
+                return;
+            }
+
+            //Memory is big-endian: the lowest address holds the top byte.
+            uint32_t shift = 8 * (WORD_SIZE - size - (addr % WORD_SIZE));
+            uint32_t mask = (size == WORD_SIZE) ? 0xffffffff : ((1u << (8 * size)) - 1) << shift;
+            uint32_t word = (words[slot] & ~mask) | ((value << shift) & mask);
+
+            if(word != words[slot])
+            {
+                hash += mix(NUM_REGS + slot, word) - mix(NUM_REGS + slot, words[slot]);
+                words[slot] = word;
+            }
+        }
+
+        uint64_t get() const
+        {
+            return hash;
+        }
+
+        uint64_t getRetired() const
+        {
+            return retired;
+        }
+
+        //The PC of the last instruction retired.
+        uint32_t getLastPC() const
+        {
+            return lastPC;
+        }
+
+        uint32_t getReg(uint32_t reg) const
+        {
+            return regs[reg];
+        }
+
+        uint32_t getWord(uint32_t addr) const
+        {
+            return words[addr / WORD_SIZE];
+        }
+
+    private:
+        uint64_t hash;
+        uint64_t retired;
+        uint32_t lastPC;
+        uint32_t regs[NUM_REGS];
+        std::vector<uint32_t> words;
+
+        //The splitmix64 finaliser, which spreads every slot and value over all 64 bits.
+        static uint64_t mix(uint32_t slot, uint32_t value)
+        {
+            uint64_t x = (static_cast<uint64_t>(slot) << 32) | value;
+            x += 0x9e3779b97f4a7c15ull;
+            x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+            x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+            return x ^ (x >> 31);
+        }
+};
+
+#endif
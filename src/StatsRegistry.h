@@ -0,0 +1,216 @@
+#ifndef STATS_REGISTRY_H
+#define STATS_REGISTRY_H
+
+#include <iostream>
+#include <iomanip>
+#include <deque>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <inttypes.h>
+
+//Named statistics. Simulator components register counters and histograms with a
+//StatsRegistry when they are given one, keep the pointers, and update them through
+//the STAT_ macros; without a registry the pointers stay NULL and each update is a
+//single test. Building with NO_SIM_STATS compiles the updates out altogether.
+//
+//Counters named "cpi.<component>" split the cycles up between components - every
+//cycle goes to exactly one of them - and printCpiStack reports them against the
+//"pipeline.instructions" counter.
+
+#ifdef NO_SIM_STATS
+#define SIM_STATS_ENABLED 0
+#else
+#define SIM_STATS_ENABLED 1
+#endif
+
+#define STAT_ADD(counter, n) do { if(SIM_STATS_ENABLED && (counter)) (counter)->value += (n); } while(0)
+#define STAT_INC(counter) STAT_ADD(counter, 1)
+#define STAT_SAMPLE(histogram, v) do { if(SIM_STATS_ENABLED && (histogram)) (histogram)->sample(v); } while(0)
+
+struct StatCounter
+{
+    std::string name;
+    std::string desc;
+    uint64_t value;
+};
+
+//Power-of-two buckets: 0, 1, 2-3, 4-7, ...
+#define STAT_HISTOGRAM_BUCKETS 33
+
+struct StatHistogram
+{
+    std::string name;
+    std::string desc;
+    uint64_t samples;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[STAT_HISTOGRAM_BUCKETS];
+
+    void sample(uint32_t value)
+    {
+        int bucket = 0;
+        while(bucket < STAT_HISTOGRAM_BUCKETS - 1 && (value >> bucket))
+        {
+            bucket++;
+        }
+
+        buckets[bucket]++;
+        samples++;
+        sum += value;
+        max = value > max ? value : max;
+    }
+};
+
+class StatsRegistry
+{
+    public:
+        //Returns the counter with the given name, registering it first if needed.
+        //The pointer stays valid as long as the registry.
+        StatCounter *counter(const std::string & name, const std::string & desc)
+        {
+            std::map<std::string, StatCounter *>::iterator found = counterNames.find(name);
+            if(found != counterNames.end())
+            {
+                return found->second;
+            }
+
+            StatCounter stat;
+            stat.name = name;
+            stat.desc = desc;
+            stat.value = 0;
+            counters.push_back(stat);
+            counterNames[name] = &counters.back();
+            return &counters.back();
+        }
+
+        StatHistogram *histogram(const std::string & name, const std::string & desc)
+        {
+            std::map<std::string, StatHistogram *>::iterator found = histogramNames.find(name);
+            if(found != histogramNames.end())
+            {
+                return found->second;
+            }
+
+            StatHistogram stat = StatHistogram();
+            stat.name = name;
+            stat.desc = desc;
+            histograms.push_back(stat);
+            histogramNames[name] = &histograms.back();
+            return &histograms.back();
+        }
+
+        //The value of a counter, 0 if it was never registered.
+        uint64_t get(const std::string & name) const
+        {
+            std::map<std::string, StatCounter *>::const_iterator found = counterNames.find(name);
+            return found != counterNames.end() ? found->second->value : 0;
+        }
+
+        //Zeroes everything, keeping the registrations.
+        void reset()
+        {
+            for(size_t i = 0 ; i < counters.size() ; i++)
+            {
+                counters[i].value = 0;
+            }
+
+            for(size_t i = 0 ; i < histograms.size() ; i++)
+            {
+                StatHistogram & stat = histograms[i];
+                stat.samples = stat.sum = stat.max = 0;
+                std::fill(stat.buckets, stat.buckets + STAT_HISTOGRAM_BUCKETS, 0);
+            }
+        }
+
+        //Counters in the order they were registered, then the histograms with their
+        //non-empty buckets.
+        void print(std::ostream & out) const
+        {
+            std::ios::fmtflags flags = out.flags();
+
+            for(size_t i = 0 ; i < counters.size() ; i++)
+            {
+                const StatCounter & stat = counters[i];
+                out << std::left << std::setw(36) << stat.name << std::right << std::setw(16) << stat.value
+                    << "  # " << stat.desc << std::endl;
+            }
+
+            for(size_t i = 0 ; i < histograms.size() ; i++)
+            {
+                const StatHistogram & stat = histograms[i];
+                double mean = stat.samples ? static_cast<double>(stat.sum) / stat.samples : 0;
+
+                out << std::left << std::setw(36) << stat.name << std::right << std::setw(16) << stat.samples
+                    << "  # " << stat.desc << ", mean " << std::fixed << std::setprecision(2) << mean
+                    << ", max " << stat.max << std::endl;
+                out.unsetf(std::ios::floatfield);
+
+                for(int b = 0 ; b < STAT_HISTOGRAM_BUCKETS ; b++)
+                {
+                    if(!stat.buckets[b])
+                    {
+                        continue;
+                    }
+
+                    uint64_t low = b ? 1ull << (b - 1) : 0;
+                    uint64_t high = b ? (1ull << b) - 1 : 0;
+                    std::string range = "[" + std::to_string(low) +
+                                        (high > low ? "-" + std::to_string(high) : "") + "]";
+                    out << "  " << std::left << std::setw(34) << range << std::right << std::setw(16)
+                        << stat.buckets[b] << std::endl;
+                }
+            }
+
+            out.flags(flags);
+        }
+
+        //Prints the cycles of every "cpi." counter as a share of the total and of
+        //the CPI.
+        void printCpiStack(std::ostream & out) const
+        {
+            uint64_t instructions = get("pipeline.instructions");
+            uint64_t total = 0;
+
+            for(size_t i = 0 ; i < counters.size() ; i++)
+            {
+                total += isCpiComponent(counters[i]) ? counters[i].value : 0;
+            }
+
+            std::ios::fmtflags flags = out.flags();
+            out << std::fixed << std::setprecision(4);
+            out << "CPI stack: " << total << " cycles, " << instructions << " instructions, CPI "
+                << (instructions ? static_cast<double>(total) / instructions : 0) << std::endl;
+
+            for(size_t i = 0 ; i < counters.size() ; i++)
+            {
+                const StatCounter & stat = counters[i];
+                if(!isCpiComponent(stat))
+                {
+                    continue;
+                }
+
+                out << "  " << std::left << std::setw(10) << stat.name.substr(4) << std::right
+                    << std::setw(14) << stat.value << "  CPI "
+                    << (instructions ? static_cast<double>(stat.value) / instructions : 0)
+                    << std::setprecision(1) << std::setw(8) << (total ? 100.0 * stat.value / total : 0) << "%"
+                    << std::setprecision(4) << std::endl;
+            }
+
+            out.flags(flags);
+        }
+
+    private:
+        //Deques, so the pointers handed out stay put.
+        std::deque<StatCounter> counters;
+        std::deque<StatHistogram> histograms;
+        std::map<std::string, StatCounter *> counterNames;
+        std::map<std::string, StatHistogram *> histogramNames;
+
+        static bool isCpiComponent(const StatCounter & stat)
+        {
+            return stat.name.compare(0, 4, "cpi.") == 0;
+        }
+};
+
+#endif
@@ -0,0 +1,324 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <errno.h>
+#include "MemoryStore.h"
+
+//Memory access traces. A trace holds every instruction fetch and data access of a
+//run in program order, so cache configurations can be evaluated by replaying it
+//instead of re-executing the program.
+//
+//File layout: the magic number and version as little-endian 32-bit words, followed
+//by one variable-length record per access. A record starts with a header byte:
+//  bits 0-1  access type (TraceAccessType)
+//  bits 2-3  log2 of the access size
+//  bit 4     TRACE_SEQ_ADDR - the address directly follows the previous access of
+//            the same stream (fetches and data accesses are separate streams)
+//  bit 5     TRACE_SAME_CYCLE - same cycle as the previous record
+//  bit 6     TRACE_NEXT_CYCLE - one cycle after the previous record
+//If TRACE_SEQ_ADDR is clear, a zigzag varint address delta against the previous
+//address of the same stream follows. If neither cycle bit is set, a varint cycle
+//delta follows. Straight-line fetches and most data accesses take one byte.
+
+#define TRACE_MAGIC 0x4352544d
+#define TRACE_VERSION 1
+
+#define TRACE_TYPE_MASK 0x03
+#define TRACE_SIZE_SHIFT 2
+#define TRACE_SIZE_MASK 0x0c
+#define TRACE_SEQ_ADDR 0x10
+#define TRACE_SAME_CYCLE 0x20
+#define TRACE_NEXT_CYCLE 0x40
+
+enum TraceAccessType
+{
+    TRACE_IFETCH = 0,
+    TRACE_READ = 1,
+    TRACE_WRITE = 2
+};
+
+struct TraceRecord
+{
+    uint64_t cycle;
+    uint32_t addr;
+    TraceAccessType type;
+    MemEntrySize size;
+};
+
+//State shared by the encoder and the decoder.
+struct TraceStreamState
+{
+    //Where the next sequential access of each stream (fetch, data) would start.
+    uint32_t nextAddr[2];
+    uint64_t lastCycle;
+
+    void reset()
+    {
+        nextAddr[0] = nextAddr[1] = 0;
+        lastCycle = 0;
+    }
+
+    static int stream(TraceAccessType type)
+    {
+        return type == TRACE_IFETCH ? 0 : 1;
+    }
+};
+
+class TraceWriter
+{
+    public:
+        TraceWriter()
+        {
+            state.reset();
+        }
+
+        ~TraceWriter()
+        {
+            close();
+        }
+
+        int open(const char *fileName)
+        {
+            out.open(fileName, std::ios::binary | std::ios::out | std::ios::trunc);
+            if(!out)
+            {
+                std::cout << "Could not open trace file " << fileName << std::endl;
+                return -EBADF;
+            }
+
+            state.reset();
+            buffer.clear();
+            putWord(TRACE_MAGIC);
+            putWord(TRACE_VERSION);
+            return 0;
+        }
+
+        void record(TraceAccessType type, uint32_t addr, MemEntrySize size, uint64_t cycle)
+        {
+            int stream = TraceStreamState::stream(type);
+            uint8_t header = type | (sizeCode(size) << TRACE_SIZE_SHIFT);
+            size_t headerPos = buffer.size();
+
+            buffer.push_back(0);
+
+            if(addr == state.nextAddr[stream])
+            {
+                header |= TRACE_SEQ_ADDR;
+            }
+            else
+            {
+                int32_t delta = static_cast<int32_t>(addr - state.nextAddr[stream]);
+                putVarint((static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31));
+            }
+
+            if(cycle == state.lastCycle)
+            {
+                header |= TRACE_SAME_CYCLE;
+            }
+            else if(cycle == state.lastCycle + 1)
+            {
+                header |= TRACE_NEXT_CYCLE;
+            }
+            else
+            {
+                putVarint(cycle - state.lastCycle);
+            }
+
+            buffer[headerPos] = header;
+            state.nextAddr[stream] = addr + size;
+            state.lastCycle = cycle;
+
+            if(buffer.size() >= FLUSH_SIZE)
+            {
+                flush();
+            }
+        }
+
+        void close()
+        {
+            if(out.is_open())
+            {
+                flush();
+                out.close();
+            }
+        }
+
+    private:
+        static const size_t FLUSH_SIZE = 1 << 16;
+
+        std::ofstream out;
+        std::vector<uint8_t> buffer;
+        TraceStreamState state;
+
+        static uint8_t sizeCode(MemEntrySize size)
+        {
+            return size == WORD_SIZE ? 2 : (size == HALF_SIZE ? 1 : 0);
+        }
+
+        void putWord(uint32_t value)
+        {
+            for(int i = 0 ; i < 4 ; i++)
+            {
+                buffer.push_back((value >> (8 * i)) & 0xff);
+            }
+        }
+
+        void putVarint(uint64_t value)
+        {
+            while(value >= 0x80)
+            {
+                buffer.push_back((value & 0x7f) | 0x80);
+                value >>= 7;
+            }
+            buffer.push_back(value);
+        }
+
+        void flush()
+        {
+            out.write((const char *)buffer.data(), buffer.size());
+            buffer.clear();
+        }
+};
+
+//Reads a whole trace into memory and decodes it one record at a time. Several
+//readers can decode the same loaded trace independently (see attach).
+class TraceReader
+{
+    public:
+        TraceReader(): bytes(NULL), length(0), pos(0)
+        {
+            state.reset();
+        }
+
+        int open(const char *fileName)
+        {
+            std::ifstream in(fileName, std::ios::binary | std::ios::in);
+            if(!in)
+            {
+                std::cout << "Could not open trace file " << fileName << std::endl;
+                return -EBADF;
+            }
+
+            in.seekg(0, std::ios::end);
+            data.resize(in.tellg());
+            in.seekg(0, std::ios::beg);
+            in.read((char *)data.data(), data.size());
+            bytes = data.data();
+            length = data.size();
+
+            if(length < 8 || getWord(0) != TRACE_MAGIC)
+            {
+                std::cout << fileName << " is not a trace file" << std::endl;
+                return -EINVAL;
+            }
+
+            if(getWord(4) != TRACE_VERSION)
+            {
+                std::cout << "Unsupported trace version " << getWord(4) << std::endl;
+                return -EINVAL;
+            }
+
+            rewind();
+            return 0;
+        }
+
+        //Decodes the trace loaded by source, which must outlive this reader, from
+        //the beginning. The trace itself is shared, not copied.
+        void attach(const TraceReader & source)
+        {
+            bytes = source.bytes;
+            length = source.length;
+            rewind();
+        }
+
+        //Starts decoding from the first record again.
+        void rewind()
+        {
+            pos = 8;
+            state.reset();
+        }
+
+        //Decodes the next record. Returns false at the end of the trace.
+        bool next(TraceRecord & rec)
+        {
+            if(pos >= length)
+            {
+                return false;
+            }
+
+            uint8_t header = bytes[pos++];
+            rec.type = static_cast<TraceAccessType>(header & TRACE_TYPE_MASK);
+            rec.size = static_cast<MemEntrySize>(1 << ((header & TRACE_SIZE_MASK) >> TRACE_SIZE_SHIFT));
+
+            int stream = TraceStreamState::stream(rec.type);
+            rec.addr = state.nextAddr[stream];
+            if(!(header & TRACE_SEQ_ADDR))
+            {
+                uint32_t zigzag = getVarint();
+                rec.addr += (zigzag >> 1) ^ (0 - (zigzag & 1));
+            }
+
+            rec.cycle = state.lastCycle;
+            if(header & TRACE_NEXT_CYCLE)
+            {
+                rec.cycle++;
+            }
+            else if(!(header & TRACE_SAME_CYCLE))
+            {
+                rec.cycle += getVarint();
+            }
+
+            state.nextAddr[stream] = rec.addr + rec.size;
+            state.lastCycle = rec.cycle;
+            return true;
+        }
+
+        //Size of the encoded trace in bytes.
+        size_t size() const
+        {
+            return length;
+        }
+
+        //Offset of the next record in the encoded trace.
+        size_t position() const
+        {
+            return pos;
+        }
+
+    private:
+        std::vector<uint8_t> data;
+        const uint8_t *bytes;
+        size_t length;
+        size_t pos;
+        TraceStreamState state;
+
+        uint32_t getWord(size_t at) const
+        {
+            return bytes[at] | (bytes[at + 1] << 8) | (bytes[at + 2] << 16) |
+                   (static_cast<uint32_t>(bytes[at + 3]) << 24);
+        }
+
+        uint64_t getVarint()
+        {
+            uint64_t value = 0;
+            int shift = 0;
+
+            while(pos < length)
+            {
+                uint8_t byte = bytes[pos++];
+                value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                if(!(byte & 0x80))
+                {
+                    break;
+                }
+                shift += 7;
+            }
+
+            return value;
+        }
+};
+
+#endif
@@ -0,0 +1,424 @@
+#ifndef X86_EMITTER_H
+#define X86_EMITTER_H
+
+#include <string.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+
+//A buffer of executable memory and just enough of an x86-64 assembler to fill it, for
+//the functional simulator's JIT (see FunctionalSim::runProgramJit). Operations on
+//general registers are 32-bit unless their name says otherwise. Memory operands are
+//[base + disp] or [base + index * scale + disp].
+
+enum X86Reg
+{
+    X86_RAX, X86_RCX, X86_RDX, X86_RBX, X86_RSP, X86_RBP, X86_RSI, X86_RDI,
+    X86_R8, X86_R9, X86_R10, X86_R11, X86_R12, X86_R13, X86_R14, X86_R15,
+    //No index register.
+    X86_NONE = -1
+};
+
+//The /digit of the group 1 instructions.
+enum X86Alu
+{
+    X86_ADD = 0,
+    X86_OR = 1,
+    X86_AND = 4,
+    X86_SUB = 5,
+    X86_XOR = 6,
+    X86_CMP = 7
+};
+
+enum X86Cond
+{
+    X86_CC_O = 0x0,
+    X86_CC_B = 0x2,
+    X86_CC_AE = 0x3,
+    X86_CC_E = 0x4,
+    X86_CC_NE = 0x5,
+    X86_CC_BE = 0x6,
+    X86_CC_A = 0x7,
+    X86_CC_L = 0xc
+};
+
+class X86Emitter
+{
+    public:
+        X86Emitter(): code(NULL), capacity(0), used(0)
+        {
+        }
+
+        ~X86Emitter()
+        {
+            if(code)
+            {
+                munmap(code, capacity);
+            }
+        }
+
+        //Maps size bytes of writable, executable memory. Fails on systems that
+        //don't allow it.
+        bool init(size_t size)
+        {
+            void *mapped = mmap(NULL, size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(mapped == MAP_FAILED)
+            {
+                return false;
+            }
+
+            code = static_cast<uint8_t *>(mapped);
+            capacity = size;
+            used = 0;
+            return true;
+        }
+
+        uint8_t *cur()
+        {
+            return code + used;
+        }
+
+        size_t left() const
+        {
+            return capacity - used;
+        }
+
+        //Throws away everything emitted from at on.
+        void rewind(uint8_t *at)
+        {
+            used = at - code;
+        }
+
+        void byte(uint8_t value)
+        {
+            code[used++] = value;
+        }
+
+        void dword(uint32_t value)
+        {
+            memcpy(code + used, &value, sizeof(value));
+            used += sizeof(value);
+        }
+
+        void qword(uint64_t value)
+        {
+            memcpy(code + used, &value, sizeof(value));
+            used += sizeof(value);
+        }
+
+        //Points the rel32 field at site (as returned by jmp and jcc) to target.
+        static void patch(uint8_t *site, const uint8_t *target)
+        {
+            int32_t rel = static_cast<int32_t>(target - (site + 4));
+            memcpy(site, &rel, sizeof(rel));
+        }
+
+        //mov reg, [mem]
+        void load(int reg, int base, int32_t disp, int index = X86_NONE, int scale = 1)
+        {
+            rex(false, reg, index, base);
+            byte(0x8b);
+            modrmMem(reg, base, index, scale, disp);
+        }
+
+        //mov reg64, [mem]
+        void load64(int reg, int base, int32_t disp, int index = X86_NONE, int scale = 1)
+        {
+            rex(true, reg, index, base);
+            byte(0x8b);
+            modrmMem(reg, base, index, scale, disp);
+        }
+
+        //movzx reg, byte/word [mem]
+        void loadZx(int reg, int size, int base, int32_t disp, int index = X86_NONE)
+        {
+            rex(false, reg, index, base);
+            byte(0x0f);
+            byte(size == 1 ? 0xb6 : 0xb7);
+            modrmMem(reg, base, index, 1, disp);
+        }
+
+        //mov [mem], reg with an operand size of 1, 2 or 4 bytes. reg must not be
+        //one of rsp, rbp, rsi or rdi for bytes.
+        void store(int size, int base, int32_t disp, int reg, int index = X86_NONE)
+        {
+            if(size == 2)
+            {
+                byte(0x66);
+            }
+            rex(false, reg, index, base);
+            byte(size == 1 ? 0x88 : 0x89);
+            modrmMem(reg, base, index, 1, disp);
+        }
+
+        //mov reg64 to [mem]
+        void store64(int base, int32_t disp, int reg)
+        {
+            rex(true, reg, X86_NONE, base);
+            byte(0x89);
+            modrmMem(reg, base, X86_NONE, 1, disp);
+        }
+
+        //mov dword [mem], imm
+        void storeImm(int base, int32_t disp, uint32_t imm)
+        {
+            rex(false, 0, X86_NONE, base);
+            byte(0xc7);
+            modrmMem(0, base, X86_NONE, 1, disp);
+            dword(imm);
+        }
+
+        //cmp byte [mem], imm
+        void cmpByteImm(int base, int32_t disp, uint8_t imm, int index = X86_NONE)
+        {
+            rex(false, 0, index, base);
+            byte(0x80);
+            modrmMem(X86_CMP, base, index, 1, disp);
+            byte(imm);
+        }
+
+        void movImm(int reg, uint32_t imm)
+        {
+            rex(false, 0, X86_NONE, reg);
+            byte(0xb8 + (reg & 7));
+            dword(imm);
+        }
+
+        void movImm64(int reg, uint64_t imm)
+        {
+            rex(true, 0, X86_NONE, reg);
+            byte(0xb8 + (reg & 7));
+            qword(imm);
+        }
+
+        void mov(int dst, int src)
+        {
+            rex(false, src, X86_NONE, dst);
+            byte(0x89);
+            modrmReg(src, dst);
+        }
+
+        void mov64(int dst, int src)
+        {
+            rex(true, src, X86_NONE, dst);
+            byte(0x89);
+            modrmReg(src, dst);
+        }
+
+        //op reg, [mem]
+        void aluLoad(X86Alu op, int reg, int base, int32_t disp)
+        {
+            rex(false, reg, X86_NONE, base);
+            byte((op << 3) | 3);
+            modrmMem(reg, base, X86_NONE, 1, disp);
+        }
+
+        //op dst, src
+        void alu(X86Alu op, int dst, int src)
+        {
+            rex(false, src, X86_NONE, dst);
+            byte((op << 3) | 1);
+            modrmReg(src, dst);
+        }
+
+        //op reg, imm
+        void aluImm(X86Alu op, int reg, uint32_t imm)
+        {
+            int32_t value = static_cast<int32_t>(imm);
+            rex(false, 0, X86_NONE, reg);
+            if(value >= -128 && value <= 127)
+            {
+                byte(0x83);
+                modrmReg(op, reg);
+                byte(static_cast<uint8_t>(value));
+            }
+            else
+            {
+                byte(0x81);
+                modrmReg(op, reg);
+                dword(imm);
+            }
+        }
+
+        //op reg64, imm (sign extended from 32 bits)
+        void aluImm64(X86Alu op, int reg, int32_t imm)
+        {
+            rex(true, 0, X86_NONE, reg);
+            byte(0x81);
+            modrmReg(op, reg);
+            dword(static_cast<uint32_t>(imm));
+        }
+
+        void notReg(int reg)
+        {
+            rex(false, 0, X86_NONE, reg);
+            byte(0xf7);
+            modrmReg(2, reg);
+        }
+
+        void shl(int reg, uint8_t count)
+        {
+            shift(4, reg, count);
+        }
+
+        void shr(int reg, uint8_t count)
+        {
+            shift(5, reg, count);
+        }
+
+        void bswap(int reg)
+        {
+            rex(false, 0, X86_NONE, reg);
+            byte(0x0f);
+            byte(0xc8 + (reg & 7));
+        }
+
+        //Swaps the bytes of the low half of reg (rol reg16, 8).
+        void bswap16(int reg)
+        {
+            byte(0x66);
+            rex(false, 0, X86_NONE, reg);
+            byte(0xc1);
+            modrmReg(0, reg);
+            byte(8);
+        }
+
+        //test reg, imm
+        void testImm(int reg, uint32_t imm)
+        {
+            rex(false, 0, X86_NONE, reg);
+            byte(0xf7);
+            modrmReg(0, reg);
+            dword(imm);
+        }
+
+        //Sets reg to 1 if cond holds and 0 otherwise. reg must be one of rax to rbx.
+        void setcc(X86Cond cond, int reg)
+        {
+            byte(0x0f);
+            byte(0x90 + cond);
+            modrmReg(0, reg);
+            //movzx reg, reg8
+            byte(0x0f);
+            byte(0xb6);
+            modrmReg(reg, reg);
+        }
+
+        void cmov(X86Cond cond, int dst, int src)
+        {
+            rex(false, dst, X86_NONE, src);
+            byte(0x0f);
+            byte(0x40 + cond);
+            modrmReg(dst, src);
+        }
+
+        //Jumps return the address of their rel32 field, for patch.
+        uint8_t *jmp()
+        {
+            byte(0xe9);
+            dword(0);
+            return cur() - 4;
+        }
+
+        uint8_t *jcc(X86Cond cond)
+        {
+            byte(0x0f);
+            byte(0x80 + cond);
+            dword(0);
+            return cur() - 4;
+        }
+
+        void jmpTo(const uint8_t *target)
+        {
+            patch(jmp(), target);
+        }
+
+        void jmpReg(int reg)
+        {
+            rex(false, 0, X86_NONE, reg);
+            byte(0xff);
+            modrmReg(4, reg);
+        }
+
+        void callReg(int reg)
+        {
+            rex(false, 0, X86_NONE, reg);
+            byte(0xff);
+            modrmReg(2, reg);
+        }
+
+        void push(int reg)
+        {
+            rex(false, 0, X86_NONE, reg);
+            byte(0x50 + (reg & 7));
+        }
+
+        void pop(int reg)
+        {
+            rex(false, 0, X86_NONE, reg);
+            byte(0x58 + (reg & 7));
+        }
+
+        void ret()
+        {
+            byte(0xc3);
+        }
+
+    private:
+        uint8_t *code;
+        size_t capacity;
+        size_t used;
+
+        //Emits a REX prefix if one is needed for a 64-bit operand or any of r8-r15.
+        void rex(bool wide, int reg, int index, int base)
+        {
+            uint8_t prefix = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) |
+                             (index != X86_NONE && (index & 8) ? 2 : 0) | ((base & 8) ? 1 : 0);
+            if(prefix != 0x40)
+            {
+                byte(prefix);
+            }
+        }
+
+        void modrmReg(int reg, int rm)
+        {
+            byte(0xc0 | ((reg & 7) << 3) | (rm & 7));
+        }
+
+        void modrmMem(int reg, int base, int index, int scale, int32_t disp)
+        {
+            //rbp and r13 can't be a base without a displacement.
+            uint8_t mod = (disp == 0 && (base & 7) != X86_RBP) ? 0 : (disp >= -128 && disp <= 127 ? 1 : 2);
+
+            if(index == X86_NONE && (base & 7) != X86_RSP)
+            {
+                byte((mod << 6) | ((reg & 7) << 3) | (base & 7));
+            }
+            else
+            {
+                //A SIB byte: rsp and r12 always need one.
+                uint8_t ss = scale == 8 ? 3 : (scale == 4 ? 2 : (scale == 2 ? 1 : 0));
+                uint8_t idx = index == X86_NONE ? X86_RSP : (index & 7);
+                byte((mod << 6) | ((reg & 7) << 3) | X86_RSP);
+                byte((ss << 6) | (idx << 3) | (base & 7));
+            }
+
+            if(mod == 1)
+            {
+                byte(static_cast<uint8_t>(disp));
+            }
+            else if(mod == 2)
+            {
+                dword(static_cast<uint32_t>(disp));
+            }
+        }
+
+        void shift(int digit, int reg, uint8_t count)
+        {
+            rex(false, 0, X86_NONE, reg);
+            byte(0xc1);
+            modrmReg(digit, reg);
+            byte(count);
+        }
+};
+
+#endif
@@ -1,144 +1,566 @@
+#ifndef CACHE_H
+#define CACHE_H
+
 #include "CacheConfig.h"
 #include "MemoryStore.h"
+#include "FlatMemoryStore.h"
 #include <math.h>
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
 #include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-using byte_t = uint32_t;
-
-struct Block {
-	uint32_t tag;
-	uint32_t lastUsed;
-	bool valid;
-	bool dirty;
-	std::vector<byte_t> data;	
-};
-
-
-class Cache {
+// A cache is a memory store itself, so caches can be stacked: a cache built on
+// another one fills from it and writes back to it, and the one below then treats it
+// as a level above it for its inclusion policy (see CacheConfig.h). A fill counts as
+// a hit or miss in every level it reaches; write-backs are not counted.
+class Cache : public MemoryStore, public BlockMemory {
 private:
-	CacheConfig cfg;	
+	CacheConfig cfg;
 	MemoryStore* mem;
-	uint32_t n, entries, tag_bits, index_bits, offset_bits, use_counter, hits, miss;
-	std::vector<std::vector<Block>> cache;
-		
+	FlatMemoryStore* flat;	// mem, when it is a flat store - lets fills and write-backs skip the virtual calls
+	Cache* next;	// mem, when it is another cache
+	std::vector<Cache*> uppers;	// the caches built on this one
+	uint32_t n, entries, tag_bits, index_bits, offset_bits, use_counter, hits, miss, rng;
+	uint32_t latency;	// cycles the last access spent on misses, see getLatency
+	uint32_t maskWords;	// 64-bit words of dirty bits per line
+	// Line metadata in parallel arrays. Way w of set s is line s * n + w.
+	std::vector<uint32_t> tags;
+	std::vector<uint32_t> replState;	// LRU: last use stamp, SRRIP: re-reference prediction value
+	std::vector<uint8_t> valid;
+	// One dirty bit per byte, so write-backs only move what was actually written.
+	std::vector<uint64_t> dirty;
+	// Tree PLRU: n bytes per set, node i of the tree (1 <= i < n) at plru[set * n + i].
+	// Each node points at the half of its subtree to evict from next.
+	std::vector<uint8_t> plru;
+	// Line data, blockSize bytes per line in the same order as the metadata.
+	// Everything is sized once in the constructor, so misses never allocate.
+	std::vector<uint8_t> data;
+
 	uint32_t getTag(uint32_t addr) {
 		return addr >> (32 - tag_bits);
 	}
 
 	uint32_t getIndex(uint32_t addr) {
-		return (addr << (tag_bits)) >> (32 - index_bits);
+		return (addr >> offset_bits) & (entries - 1);
 	}
 
 	uint32_t getOffset(uint32_t addr) {
-		return (addr << (32 - offset_bits)) >> (32 - offset_bits);
+		return addr & (cfg.blockSize - 1);
+	}
+
+	// first address of the block held by line in set index
+	uint32_t getBlockAddr(uint32_t line, uint32_t index) {
+		return (tags[line] << (32 - tag_bits)) | (index << offset_bits);
+	}
+
+	uint8_t* lineData(uint32_t line) {
+		return &data[line * cfg.blockSize];
+	}
+
+	// One transfer either way; the flat store's in-range case is inlined.
+	void readFromMemory(uint32_t addr, uint8_t* dst, uint32_t size) {
+		if (flat && FlatMemoryStore::inRange(addr, size)) {
+			memcpy(dst, flat->bytes() + addr, size);
+		} else {
+			mem->readBlock(addr, dst, size);
+		}
+	}
+
+	void writeToMemory(uint32_t addr, const uint8_t* src, uint32_t size) {
+		if (next) {
+			next->writeBlock(addr, src, size);
+		} else if (flat && FlatMemoryStore::inRange(addr, size)) {
+			memcpy(flat->bytes() + addr, src, size);
+		} else {
+			mem->writeBlock(addr, src, size);
+		}
+	}
+
+	// reads from the level below; returns the cycles that took, missLatency plus whatever
+	// the level below spent on its own misses
+	uint32_t readFromBelow(uint32_t addr, uint8_t* dst, uint32_t size) {
+		if (!next) {
+			readFromMemory(addr, dst, size);
+			return cfg.missLatency;
+		}
+		next->readBlock(addr, dst, size);
+		return cfg.missLatency + next->latency;
+	}
+
+	bool isDirty(uint32_t line) {
+		const uint64_t* mask = &dirty[line * maskWords];
+		for (uint32_t w = 0; w < maskWords; ++w) {
+			if (mask[w]) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void markDirty(uint32_t line, uint32_t off) {
+		dirty[line * maskWords + off / 64] |= 1ull << (off % 64);
+	}
+
+	// writes the dirty runs of line back, one block transfer per run, and cleans it
+	void writeBack(uint32_t line, uint32_t blockAddr) {
+		uint64_t* mask = &dirty[line * maskWords];
+		const uint8_t* src = lineData(line);
+		uint32_t runStart = 0, runEnd = 0;	// pending run [runStart, runEnd)
+
+		for (uint32_t w = 0; w < maskWords; ++w) {
+			uint64_t bits = mask[w];
+			while (bits) {
+				uint32_t start = __builtin_ctzll(bits);
+				uint64_t rest = ~(bits >> start);
+				uint32_t len = rest ? __builtin_ctzll(rest) : 64 - start;
+				uint32_t first = w * 64 + start;
+				if (first != runEnd) {	// not a continuation of the pending run
+					if (runEnd > runStart) {
+						writeToMemory(blockAddr + runStart, src + runStart, runEnd - runStart);
+					}
+					runStart = first;
+				}
+				runEnd = first + len;
+				bits = start + len < 64 ? bits & ~(((1ull << len) - 1) << start) : 0;
+			}
+			mask[w] = 0;
+		}
+		if (runEnd > runStart) {
+			writeToMemory(blockAddr + runStart, src + runStart, runEnd - runStart);
+		}
+	}
+
+	// returns the way of the set starting at line first that holds tag, or n if none does
+	uint32_t findWay(uint32_t first, uint32_t tag) {
+		const uint32_t* t = &tags[first];
+		uint32_t way = 0;
+#if defined(__SSE2__)
+		// compare four tags at a time, then check the valid bits of the matches only
+		const __m128i key = _mm_set1_epi32(tag);
+		for (; way + 4 <= n; way += 4) {
+			__m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(t + way)), key);
+			int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+			for (; mask; mask &= mask - 1) {
+				uint32_t match = way + __builtin_ctz(mask);
+				if (valid[first + match]) {
+					return match;
+				}
+			}
+		}
+#endif
+		for (; way < n; ++way) {
+			if (t[way] == tag && valid[first + way]) {
+				return way;
+			}
+		}
+		return n;
+	}
+
+	// replacement policy hooks - a line was just hit or filled
+	void touch(uint32_t first, uint32_t way, bool fill) {
+		switch (cfg.replacement) {
+		case REPLACE_LRU:
+			replState[first + way] = ++use_counter;
+			break;
+		case REPLACE_TREE_PLRU: {
+			// point every node on the path away from this way
+			uint8_t* tree = &plru[first];
+			for (uint32_t node = 1, half = n / 2; half; half /= 2) {
+				bool right = way & half;
+				tree[node] = !right;
+				node = 2 * node + right;
+			}
+			break;
+		}
+		case REPLACE_RANDOM:
+			break;
+		case REPLACE_SRRIP:
+			// new blocks are predicted to be re-referenced in the distant future, hits in the near future
+			replState[first + way] = fill ? 2 : 0;
+			break;
+		}
+	}
+
+	// picks the way to evict from a full set
+	uint32_t victim(uint32_t first) {
+		switch (cfg.replacement) {
+		case REPLACE_TREE_PLRU: {
+			const uint8_t* tree = &plru[first];
+			uint32_t way = 0;
+			for (uint32_t node = 1, half = n / 2; half; half /= 2) {
+				bool right = tree[node];
+				way |= right ? half : 0;
+				node = 2 * node + right;
+			}
+			return way;
+		}
+		case REPLACE_RANDOM:
+			// xorshift32
+			rng ^= rng << 13;
+			rng ^= rng >> 17;
+			rng ^= rng << 5;
+			return rng & (n - 1);
+		case REPLACE_SRRIP:
+			while (true) {
+				for (uint32_t way = 0; way < n; ++way) {
+					if (replState[first + way] >= 3) {
+						return way;
+					}
+				}
+				for (uint32_t way = 0; way < n; ++way) {
+					++replState[first + way];
+				}
+			}
+		case REPLACE_LRU:
+		default: {
+			uint32_t ret = 0, last = UINT32_MAX;
+			for (uint32_t way = 0; way < n; ++way) {
+				if (replState[first + way] < last) {
+					ret = way;
+					last = replState[first + way];
+				}
+			}
+			return ret;
+		}
+		}
+	}
+
+	// An inclusive cache below is evicting the block [addr, addr + size) from line of
+	// lower. Drops every part of it held here, merging the dirty bytes into that line.
+	void backInvalidate(uint32_t addr, uint32_t size, Cache* lower, uint32_t line) {
+		for (uint32_t block = addr; block < addr + size; block += cfg.blockSize) {
+			auto first = getIndex(block) * n, way = findWay(first, getTag(block));
+			if (way == n) {
+				continue;
+			}
+			uint64_t* mask = &dirty[(first + way) * maskWords];
+			const uint8_t* src = lineData(first + way);
+			for (uint32_t w = 0; w < maskWords; ++w) {
+				for (uint64_t bits = mask[w]; bits; bits &= bits - 1) {
+					uint32_t off = w * 64 + __builtin_ctzll(bits);
+					lower->lineData(line)[block - addr + off] = src[off];
+					lower->markDirty(line, block - addr + off);
+				}
+				mask[w] = 0;
+			}
+			valid[first + way] = false;
+		}
+	}
+
+	// An exclusive cache takes the block at blockAddr evicted from a level above, clean
+	// or dirty. Block sizes must match.
+	void insertVictim(uint32_t blockAddr, const uint8_t* src, const uint64_t* srcDirty) {
+		auto first = getIndex(blockAddr) * n, way = findWay(first, getTag(blockAddr));
+		if (way < n) {
+			// Another cache above already put it here, maybe with newer data: only
+			// the bytes this copy wrote are taken.
+			uint8_t* dst = lineData(first + way);
+			for (uint32_t w = 0; w < maskWords; ++w) {
+				for (uint64_t bits = srcDirty[w]; bits; bits &= bits - 1) {
+					uint32_t off = w * 64 + __builtin_ctzll(bits);
+					dst[off] = src[off];
+				}
+				dirty[(first + way) * maskWords + w] |= srcDirty[w];
+			}
+			return;
+		}
+		uint32_t line = evict(blockAddr);
+		memcpy(lineData(line), src, cfg.blockSize);
+		memcpy(&dirty[line * maskWords], srcDirty, maskWords * sizeof(uint64_t));
+		tags[line] = getTag(blockAddr);
+		valid[line] = true;
+		touch(first, line - first, true);
 	}
-	// evicts a block from the cache, returns the index of the evicted block - cache[i][return_value]
+
+	// evicts a block from the set addr maps to, returns the line it occupied
 	uint32_t evict(uint32_t addr) {
-		auto index = getIndex(addr), off = getOffset(addr);
-		uint32_t ret = 0, last = UINT32_MAX;
+		auto index = getIndex(addr), first = index * n;
+		uint32_t ret = first + n;
 
-		for (uint32_t i = 0; i < n; ++i) {
-			if (!cache[index][i].valid) {	// cache[index] has invalid block -> evict it
-				ret = i;
+		for (uint32_t line = first; line < first + n; ++line) {
+			if (!valid[line]) {	// set has an invalid line -> use it
+				ret = line;
 				break;
-			} 
-			if (cache[index][i].lastUsed < last) {
-				ret = i;
-				last = cache[index][i].lastUsed;
 			}
 		}
-		// write-back for the evicted block	
-		if (cache[index][ret].dirty) {
-			for (uint32_t i = 0; i < cfg.blockSize; ++i) {
-				mem->setMemValue(addr - off + i, cache[index][ret].data[i], BYTE_SIZE);
+		if (ret == first + n) {
+			ret = first + victim(first);
+		}
+		if (!valid[ret]) {
+			return ret;
+		}
+		uint32_t blockAddr = getBlockAddr(ret, index);
+		if (cfg.inclusion == INCLUSIVE) {
+			for (Cache* upper : uppers) {
+				upper->backInvalidate(blockAddr, cfg.blockSize, this, ret);
 			}
 		}
+		if (next && next->cfg.inclusion == EXCLUSIVE) {
+			// the block moves down whether it is dirty or not
+			next->insertVictim(blockAddr, lineData(ret), &dirty[ret * maskWords]);
+			memset(&dirty[ret * maskWords], 0, maskWords * sizeof(uint64_t));
+		} else if (isDirty(ret)) {
+			writeBack(ret, blockAddr);
+		}
+		valid[ret] = false;
 		return ret;
 	}
 
-	// brings block from memory and put it in the cache. Return the index of the evicted block - cache[i][return_value]
-	uint32_t bringFromMemory(uint32_t addr) {
-		auto index = getIndex(addr), off = getOffset(addr), where = evict(addr);
-		Block newBlock {getTag(addr), ++use_counter, true, false, std::vector<byte_t>(cfg.blockSize)};
-		for (uint32_t i = 0; i < cfg.blockSize; ++i) {
-			mem -> getMemValue(addr - off + i, newBlock.data[i], BYTE_SIZE);
-		}
-		cache[index][where] = newBlock;
-		return where;
+	// brings block from the level below and puts it in the cache. Returns the line it
+	// was put in and the cycles it took in fill
+	uint32_t bringFromMemory(uint32_t addr, uint32_t& fill) {
+		auto line = evict(addr), first = getIndex(addr) * n;
+		fill = readFromBelow(addr - getOffset(addr), lineData(line), cfg.blockSize);
+		tags[line] = getTag(addr);
+		valid[line] = true;
+		touch(first, line - first, true);
+		return line;
 	}
 
+	// calls f(pointer, bytes) for every piece of state that changes while the cache runs
+	template <typename F>
+	void visitState(F f) {
+		f(&use_counter, sizeof(use_counter));
+		f(&hits, sizeof(hits));
+		f(&miss, sizeof(miss));
+		f(&rng, sizeof(rng));
+		f(tags.data(), tags.size() * sizeof(uint32_t));
+		f(replState.data(), replState.size() * sizeof(uint32_t));
+		f(valid.data(), valid.size());
+		f(dirty.data(), dirty.size() * sizeof(uint64_t));
+		if (!plru.empty()) {
+			f(plru.data(), plru.size());
+		}
+		f(data.data(), data.size());
+	}
 
-	byte_t getByte(uint32_t addr) {
-		auto tag = getTag(addr), index = getIndex(addr), off = getOffset(addr);
-		// check blocks at the given index
-		for (uint32_t i = 0; i < n; ++i) {
-			if (cache[index][i].tag == tag && cache[index][i].valid) { 
-				++hits;
-				cache[index][i].lastUsed = ++use_counter; // hit
-				return cache[index][i].data[off];
-			} 
+	// finds (or brings in) the line holding addr and counts the hit or miss
+	uint32_t access(uint32_t addr) {
+		auto first = getIndex(addr) * n, way = findWay(first, getTag(addr));
+		if (way < n) {	// hit
+			++hits;
+			touch(first, way, false);
+			return first + way;
 		}
 		// miss
 		++miss;
-		auto where = bringFromMemory(addr);
-		return cache[index][where].data[off];
-	}
-
-	void setByte(uint32_t addr, byte_t value) {
-		auto tag = getTag(addr), index = getIndex(addr), off = getOffset(addr);
-		// check blocks at the given index
-		for (uint32_t i = 0; i < n; ++i) {
-			if (cache[index][i].tag == tag && cache[index][i].valid) { 
-					hits++;	
-					cache[index][i].lastUsed = ++use_counter; // hit
-					cache[index][i].data[off] = value;
-					cache[index][i].dirty = true;
-					return;
-			} 
-		}
-		// miss
-		miss++;
-		auto where = bringFromMemory(addr);
-		cache[index][where].data[off] = value;
-		cache[index][where].dirty = true;
+		uint32_t fill;
+		auto line = bringFromMemory(addr, fill);
+		// the blocks of an access spanning two are fetched side by side
+		latency = fill > latency ? fill : latency;
+		return line;
 	}
 public:
-	Cache(const CacheConfig& cfg, MemoryStore* mem): cfg(cfg),  mem(mem) {
-		n = (cfg.type == DIRECT_MAPPED) ? 1 : 2;
+	Cache(const CacheConfig& cfg, MemoryStore* mem): cfg(cfg),  mem(mem), flat(dynamic_cast<FlatMemoryStore*>(mem)),
+		next(dynamic_cast<Cache*>(mem)) {
+		n = getCacheWays(cfg);
 		entries = cfg.cacheSize / (cfg.blockSize * n);
-		cache.resize(entries);
 		offset_bits = log2(cfg.blockSize);
 		index_bits = log2(entries);
 		tag_bits = 32 - offset_bits - index_bits;
-		use_counter = hits = miss = 0;
-		for (uint32_t i = 0; i < entries; ++i) {
-			for (uint32_t j = 0; j < n; ++j) {
-				cache[i].push_back(Block{0, 0, false, false, std::vector<byte_t>(cfg.blockSize)});
-			}
+		maskWords = (cfg.blockSize + 63) / 64;
+		use_counter = hits = miss = latency = 0;
+		rng = 0x2545f491;
+		tags.assign(entries * n, 0);
+		replState.assign(entries * n, 0);
+		valid.assign(entries * n, false);
+		dirty.assign(entries * n * maskWords, 0);
+		plru.assign(cfg.replacement == REPLACE_TREE_PLRU ? entries * n : 0, 0);
+		data.assign(entries * n * cfg.blockSize, 0);
+		if (next) {
+			next->uppers.push_back(this);
 		}
 	}
 
+	~Cache() {
+		if (next) {
+			next->uppers.erase(std::find(next->uppers.begin(), next->uppers.end(), this));
+		}
+	}
+
+	// Values are big-endian, like the memory. An access counts as one hit or miss
+	// per block it touches.
 	uint32_t getCacheValue(uint32_t addr, uint32_t& value, MemEntrySize size) {
 		value = 0;
+		latency = 0;
+		auto line = lineData(access(addr));
 		for (int i = 0; i < size; ++i) {
-			value <<= 8;
-			value += getByte(addr + i);
+			auto off = getOffset(addr + i);
+			if (i && !off) {	// crossed into the next block
+				line = lineData(access(addr + i));
+			}
+			value = (value << 8) | line[off];
 		}
 		return value;
 	}
 
 	void setCacheValue(uint32_t addr, uint32_t value, MemEntrySize size) {
+		latency = 0;
+		auto where = access(addr);
 		for (int i = 0; i < size; ++i) {
-			setByte(addr + i, (value << (8 * i)) >> (8 * size));
+			auto off = getOffset(addr + i);
+			if (i && !off) {	// crossed into the next block
+				where = access(addr + i);
+			}
+			lineData(where)[off] = value >> (8 * (size - 1 - i));
+			markDirty(where, off);
 		}
 	}
 
+	// writes every dirty line back to memory; lines stay valid and become clean
+	void writeBackAll() {
+		for (uint32_t line = 0; line < entries * n; ++line) {
+			if (valid[line] && isDirty(line)) {
+				writeBack(line, getBlockAddr(line, line / n));
+			}
+		}
+	}
+
+	// Functional warming: updates the tags and replacement state (and counts the hit
+	// or miss) like a real access, but moves no data. Memory is assumed to be ahead of
+	// the cache, so every line must be clean - call writeBackAll first, and
+	// reloadAll before the data is read again.
+	void warm(uint32_t addr, MemEntrySize size) {
+		latency = 0;
+		access(addr);
+		uint32_t last = addr + size - 1;
+		if (getOffset(last) < getOffset(addr)) {	// crosses into the next block
+			access(last);
+		}
+	}
+
+	// re-reads every valid line from memory, after memory was changed behind the cache's
+	// back. This goes straight to memory, past any caches below, which have to be
+	// reloaded as well.
+	void reloadAll() {
+		Cache* last = this;
+		while (last->next) {
+			last = last->next;
+		}
+		for (uint32_t line = 0; line < entries * n; ++line) {
+			if (valid[line]) {
+				last->readFromMemory(getBlockAddr(line, line / n), lineData(line), cfg.blockSize);
+				memset(&dirty[line * maskWords], 0, maskWords * sizeof(uint64_t));
+			}
+		}
+	}
+
+	// Checkpointing. The state is a flat blob whose size only depends on the
+	// configuration, so it can only be loaded into a cache built with the same one.
+	size_t getStateSize() {
+		size_t size = 0;
+		visitState([&](void*, size_t bytes) { size += bytes; });
+		return size;
+	}
+
+	void saveState(uint8_t* dst) {
+		visitState([&](void* ptr, size_t bytes) {
+			memcpy(dst, ptr, bytes);
+			dst += bytes;
+		});
+	}
+
+	void loadState(const uint8_t* src) {
+		visitState([&](void* ptr, size_t bytes) {
+			memcpy(ptr, src, bytes);
+			src += bytes;
+		});
+	}
+
 	uint32_t getHits() {
 		return hits;
 	}
 	uint32_t getMisses() {
 		return miss;
 	}
-};
 
+	// Cycles the last access spent on misses, 0 for a hit: missLatency, plus what the
+	// levels below spent on theirs.
+	uint32_t getLatency() {
+		return latency;
+	}
+
+	const CacheConfig& getConfig() {
+		return cfg;
+	}
+
+	// The memory store interface, for the levels above. Reads count as hits and misses
+	// like any access. An exclusive cache hands a block it holds up and drops it, and
+	// reads past itself what it doesn't hold.
+	int readBlock(uint32_t address, uint8_t* dst, uint32_t size) override {
+		latency = 0;
+		for (uint32_t done = 0, len; done < size; done += len) {
+			uint32_t addr = address + done, off = getOffset(addr);
+			len = std::min(cfg.blockSize - off, size - done);
+			if (cfg.inclusion != EXCLUSIVE) {
+				memcpy(dst + done, lineData(access(addr)) + off, len);
+				continue;
+			}
+			auto first = getIndex(addr) * n, way = findWay(first, getTag(addr));
+			if (way == n) {
+				++miss;
+				uint32_t fill = readFromBelow(addr, dst + done, len);
+				latency = fill > latency ? fill : latency;
+				continue;
+			}
+			++hits;
+			memcpy(dst + done, lineData(first + way) + off, len);
+			if (isDirty(first + way)) {
+				writeBack(first + way, addr - off);
+			}
+			valid[first + way] = false;
+		}
+		return 0;
+	}
+
+	// Write-backs from the levels above. Write-allocate, except in an exclusive cache:
+	// a block it doesn't hold is still held above, so the write goes past it.
+	int writeBlock(uint32_t address, const uint8_t* src, uint32_t size) override {
+		for (uint32_t done = 0, len; done < size; done += len) {
+			uint32_t addr = address + done, off = getOffset(addr), fill;
+			len = std::min(cfg.blockSize - off, size - done);
+			auto first = getIndex(addr) * n, way = findWay(first, getTag(addr));
+			if (way == n && cfg.inclusion == EXCLUSIVE) {
+				writeToMemory(addr, src + done, len);
+				continue;
+			}
+			uint32_t line = way < n ? first + way : bringFromMemory(addr, fill);
+			if (way < n) {
+				touch(first, way, false);
+			}
+			memcpy(lineData(line) + off, src + done, len);
+			for (uint32_t i = 0; i < len; ++i) {
+				markDirty(line, off + i);
+			}
+		}
+		return 0;
+	}
+
+	int getMemValue(uint32_t address, uint32_t& value, MemEntrySize size) override {
+		if (!inMemoryRange(address, size)) {
+			return -EINVAL;
+		}
+		getCacheValue(address, value, size);
+		return 0;
+	}
+
+	int setMemValue(uint32_t address, uint32_t value, MemEntrySize size) override {
+		if (!inMemoryRange(address, size)) {
+			return -EINVAL;
+		}
+		setCacheValue(address, value, size);
+		return 0;
+	}
+
+	// prints the store below, once everything dirty is written back to it
+	int printMemory(uint32_t startAddress, uint32_t endAddress) override {
+		writeBackAll();
+		return mem->printMemory(startAddress, endAddress);
+	}
+};
 
+#endif
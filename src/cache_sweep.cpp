@@ -0,0 +1,597 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "MemoryStore.h"
+#include "FlatMemoryStore.h"
+#include "DriverFunctions.h"
+#include "cache.h"
+#include "Trace.h"
+
+//Sweeps the cross product of I-cache and D-cache configurations over one recorded
+//memory access trace (see ./sim --trace), using every core of the host. The trace is
+//loaded once and shared read-only by all workers; each configuration keeps its own
+//caches and position in the trace, so it can be advanced in steps.
+//
+//With --rounds > 1 the sweep does successive halving: every surviving configuration
+//is run over a growing prefix of the trace (1/2^(rounds-1) of it first, doubling each
+//round), ranked by estimated cycles, and only the best 1/eta go on to the next round.
+//
+//Cycle counts are estimates: one cycle per fetched instruction plus the pipeline fill
+//plus missLatency per miss. Hazard stalls don't depend on the caches, so they are left
+//out; the estimate is meant for ranking configurations against each other.
+
+using namespace std;
+
+//Cycles to fill the five-stage pipeline before the first instruction retires.
+#define PIPELINE_FILL 4
+
+struct SweepPoint
+{
+    CacheConfig icConfig;
+    CacheConfig dcConfig;
+    FlatMemoryStore *mem;
+    Cache *icache;
+    Cache *dcache;
+    TraceReader cursor;
+    uint64_t fetches;
+    //Round in which the point was pruned, or -1 if it ran over the whole trace.
+    int prunedRound;
+
+    uint64_t estimatedCycles() const
+    {
+        return fetches + PIPELINE_FILL +
+               static_cast<uint64_t>(icache->getMisses()) * icConfig.missLatency +
+               static_cast<uint64_t>(dcache->getMisses()) * dcConfig.missLatency;
+    }
+
+    //Feeds the trace to the caches up to (at least) the given offset.
+    void advance(size_t limit)
+    {
+        TraceRecord rec;
+        uint32_t value = 0;
+
+        while(cursor.position() < limit && cursor.next(rec))
+        {
+            switch(rec.type)
+            {
+                case TRACE_IFETCH:
+                    fetches++;
+                    icache->getCacheValue(rec.addr, value, rec.size);
+                    break;
+                case TRACE_READ:
+                    dcache->getCacheValue(rec.addr, value, rec.size);
+                    break;
+                case TRACE_WRITE:
+                    dcache->setCacheValue(rec.addr, 0, rec.size);
+                    break;
+            }
+        }
+    }
+
+    SimulationStats getStats() const
+    {
+        SimulationStats stats;
+        stats.totalCycles = estimatedCycles();
+        stats.icHits = icache->getHits();
+        stats.icMisses = icache->getMisses();
+        stats.dcHits = dcache->getHits();
+        stats.dcMisses = dcache->getMisses();
+        return stats;
+    }
+};
+
+//Runs task(item) for every item on numThreads threads. Items are dealt out to
+//per-thread queues up front; a thread that runs out of work steals from the front
+//of another thread's queue, so uneven item costs balance out.
+void runWorkStealing(const vector<size_t> & items, unsigned numThreads, function<void(size_t)> task)
+{
+    struct WorkQueue
+    {
+        mutex lock;
+        deque<size_t> items;
+    };
+
+    numThreads = max(1u, min<unsigned>(numThreads, items.size()));
+    vector<WorkQueue> queues(numThreads);
+
+    for(size_t i = 0 ; i < items.size() ; i++)
+    {
+        queues[i % numThreads].items.push_back(items[i]);
+    }
+
+    vector<thread> workers;
+    for(unsigned self = 0 ; self < numThreads ; self++)
+    {
+        workers.push_back(thread([&queues, &task, self, numThreads]()
+        {
+            while(true)
+            {
+                bool found = false;
+                size_t item = 0;
+
+                //Own queue first (from the back), then steal from the others (from the front).
+                for(unsigned k = 0 ; k < numThreads && !found ; k++)
+                {
+                    WorkQueue & queue = queues[(self + k) % numThreads];
+                    lock_guard<mutex> guard(queue.lock);
+
+                    if(!queue.items.empty())
+                    {
+                        if(k == 0)
+                        {
+                            item = queue.items.back();
+                            queue.items.pop_back();
+                        }
+                        else
+                        {
+                            item = queue.items.front();
+                            queue.items.pop_front();
+                        }
+                        found = true;
+                    }
+                }
+
+                //No work is added while a batch runs, so empty queues mean we're done.
+                if(!found)
+                {
+                    return;
+                }
+
+                task(item);
+            }
+        }));
+    }
+
+    for(size_t i = 0 ; i < workers.size() ; i++)
+    {
+        workers[i].join();
+    }
+}
+
+//Parses a comma-separated list of values, where lo-hi stands for every power of two
+//from lo to hi. "full" (for associativity) is returned as 0.
+int parseList(const char *arg, vector<uint32_t> & values)
+{
+    string list(arg);
+    size_t start = 0;
+
+    values.clear();
+    while(start <= list.size())
+    {
+        size_t end = list.find(',', start);
+        if(end == string::npos)
+        {
+            end = list.size();
+        }
+
+        string item = list.substr(start, end - start);
+        size_t dash = item.find('-');
+
+        if(item == "full")
+        {
+            values.push_back(0);
+        }
+        else if(dash != string::npos)
+        {
+            uint32_t lo = strtoul(item.substr(0, dash).c_str(), NULL, 0);
+            uint32_t hi = strtoul(item.substr(dash + 1).c_str(), NULL, 0);
+            if(!lo || lo > hi)
+            {
+                return -EINVAL;
+            }
+            for(uint64_t v = lo ; v <= hi ; v *= 2)
+            {
+                values.push_back(v);
+            }
+        }
+        else if(!item.empty())
+        {
+            values.push_back(strtoul(item.c_str(), NULL, 0));
+        }
+        else
+        {
+            return -EINVAL;
+        }
+
+        start = end + 1;
+    }
+
+    return 0;
+}
+
+int parsePolicies(const char *arg, vector<ReplacementPolicy> & policies)
+{
+    string list(arg);
+    size_t start = 0;
+
+    policies.clear();
+    while(start <= list.size())
+    {
+        size_t end = list.find(',', start);
+        if(end == string::npos)
+        {
+            end = list.size();
+        }
+
+        string item = list.substr(start, end - start);
+        if(item == "lru")
+        {
+            policies.push_back(REPLACE_LRU);
+        }
+        else if(item == "plru")
+        {
+            policies.push_back(REPLACE_TREE_PLRU);
+        }
+        else if(item == "random")
+        {
+            policies.push_back(REPLACE_RANDOM);
+        }
+        else if(item == "srrip")
+        {
+            policies.push_back(REPLACE_SRRIP);
+        }
+        else
+        {
+            return -EINVAL;
+        }
+
+        start = end + 1;
+    }
+
+    return 0;
+}
+
+const char *policyName(ReplacementPolicy policy)
+{
+    switch(policy)
+    {
+        case REPLACE_LRU:
+            return "lru";
+        case REPLACE_TREE_PLRU:
+            return "plru";
+        case REPLACE_RANDOM:
+            return "random";
+        case REPLACE_SRRIP:
+            return "srrip";
+    }
+
+    return "?";
+}
+
+bool isPowerOfTwo(uint32_t value)
+{
+    return value && !(value & (value - 1));
+}
+
+//Builds every valid configuration for one cache from the parameter lists.
+void buildConfigs(const vector<uint32_t> & sizes, const vector<uint32_t> & blocks,
+                  const vector<uint32_t> & ways, const vector<uint32_t> & latencies,
+                  ReplacementPolicy policy, vector<CacheConfig> & configs)
+{
+    configs.clear();
+
+    for(size_t s = 0 ; s < sizes.size() ; s++)
+    for(size_t b = 0 ; b < blocks.size() ; b++)
+    for(size_t w = 0 ; w < ways.size() ; w++)
+    for(size_t l = 0 ; l < latencies.size() ; l++)
+    {
+        CacheConfig cfg;
+        cfg.cacheSize = sizes[s];
+        cfg.blockSize = blocks[b];
+        cfg.type = ways[w] ? N_WAY_SET_ASSOC : FULLY_ASSOC;
+        cfg.associativity = ways[w];
+        cfg.missLatency = latencies[l];
+        cfg.replacement = policy;
+
+        uint32_t numWays = getCacheWays(cfg);
+        if(!isPowerOfTwo(cfg.cacheSize) || !isPowerOfTwo(cfg.blockSize) ||
+           !isPowerOfTwo(numWays) || cfg.cacheSize < cfg.blockSize * numWays)
+        {
+            continue;
+        }
+
+        configs.push_back(cfg);
+    }
+}
+
+void writeConfigCsv(ostream & out, const CacheConfig & cfg)
+{
+    out << cfg.cacheSize << "," << cfg.blockSize << ",";
+    if(cfg.type == FULLY_ASSOC)
+    {
+        out << "full";
+    }
+    else
+    {
+        out << cfg.associativity;
+    }
+    out << "," << cfg.missLatency << ",";
+}
+
+void writeConfigJson(ostream & out, const char *name, const CacheConfig & cfg)
+{
+    out << "\"" << name << "\": {\"cacheSize\": " << cfg.cacheSize
+        << ", \"blockSize\": " << cfg.blockSize << ", \"ways\": ";
+    if(cfg.type == FULLY_ASSOC)
+    {
+        out << "\"full\"";
+    }
+    else
+    {
+        out << cfg.associativity;
+    }
+    out << ", \"missLatency\": " << cfg.missLatency
+        << ", \"replacement\": \"" << policyName(cfg.replacement) << "\"}, ";
+}
+
+void writeResults(ostream & out, const vector<SweepPoint *> & points, bool json)
+{
+    if(!json)
+    {
+        out << "ic_size,ic_block,ic_ways,ic_latency,dc_size,dc_block,dc_ways,dc_latency,"
+            << "replacement,totalCycles,icHits,icMisses,dcHits,dcMisses,pruned_round" << endl;
+    }
+    else
+    {
+        out << "[" << endl;
+    }
+
+    for(size_t i = 0 ; i < points.size() ; i++)
+    {
+        const SweepPoint & point = *points[i];
+        SimulationStats stats = point.getStats();
+
+        if(!json)
+        {
+            writeConfigCsv(out, point.icConfig);
+            writeConfigCsv(out, point.dcConfig);
+            out << policyName(point.icConfig.replacement) << ","
+                << stats.totalCycles << "," << stats.icHits << "," << stats.icMisses << ","
+                << stats.dcHits << "," << stats.dcMisses << ",";
+            if(point.prunedRound >= 0)
+            {
+                out << point.prunedRound;
+            }
+            out << endl;
+        }
+        else
+        {
+            out << "  {";
+            writeConfigJson(out, "icache", point.icConfig);
+            writeConfigJson(out, "dcache", point.dcConfig);
+            out << "\"totalCycles\": " << stats.totalCycles
+                << ", \"icHits\": " << stats.icHits << ", \"icMisses\": " << stats.icMisses
+                << ", \"dcHits\": " << stats.dcHits << ", \"dcMisses\": " << stats.dcMisses
+                << ", \"prunedRound\": ";
+            if(point.prunedRound >= 0)
+            {
+                out << point.prunedRound;
+            }
+            else
+            {
+                out << "null";
+            }
+            out << "}" << (i + 1 < points.size() ? "," : "") << endl;
+        }
+    }
+
+    if(json)
+    {
+        out << "]" << endl;
+    }
+}
+
+void printUsage()
+{
+    cout << "Usage: ./cache_sweep <trace file> [options]" << endl
+         << "  --ic-size, --ic-block, --ic-ways, --ic-latency <list>   I-cache parameters" << endl
+         << "  --dc-size, --dc-block, --dc-ways, --dc-latency <list>   D-cache parameters" << endl
+         << "  --policy <list>      replacement policies: lru, plru, random, srrip" << endl
+         << "  --threads <n>        worker threads (default: all cores)" << endl
+         << "  --rounds <n>         successive-halving rounds (default: 1, no pruning)" << endl
+         << "  --eta <n>            keep the best 1/eta of the configurations per round (default: 2)" << endl
+         << "  --format csv|json    output format (default: csv)" << endl
+         << "  --out <file>         write results to a file instead of stdout" << endl
+         << "A list is comma-separated values; lo-hi means every power of two from lo to hi" << endl
+         << "and ways may be \"full\". Defaults: 1024 byte, 64 byte blocks, 1 way, 5 cycles." << endl;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 2)
+    {
+        printUsage();
+        return -EINVAL;
+    }
+
+    //Defaults match test/example_driver.cpp.
+    vector<uint32_t> params[8];
+    for(int c = 0 ; c < 2 ; c++)
+    {
+        params[4 * c + 0].assign(1, 1024);
+        params[4 * c + 1].assign(1, 64);
+        params[4 * c + 2].assign(1, 1);
+        params[4 * c + 3].assign(1, 5);
+    }
+    const char *paramNames[8] =
+    {
+        "--ic-size", "--ic-block", "--ic-ways", "--ic-latency",
+        "--dc-size", "--dc-block", "--dc-ways", "--dc-latency"
+    };
+    vector<ReplacementPolicy> policies(1, REPLACE_LRU);
+    unsigned numThreads = max(1u, thread::hardware_concurrency());
+    unsigned rounds = 1;
+    unsigned eta = 2;
+    bool json = false;
+    const char *outFile = NULL;
+
+    for(int i = 2 ; i < argc ; i++)
+    {
+        if(i + 1 >= argc)
+        {
+            printUsage();
+            return -EINVAL;
+        }
+
+        const char *opt = argv[i];
+        const char *arg = argv[++i];
+        int ret = 0;
+        bool known = false;
+
+        for(int p = 0 ; p < 8 ; p++)
+        {
+            if(strcmp(opt, paramNames[p]) == 0)
+            {
+                ret = parseList(arg, params[p]);
+                known = true;
+            }
+        }
+
+        if(known)
+        {
+        }
+        else if(strcmp(opt, "--policy") == 0)
+        {
+            ret = parsePolicies(arg, policies);
+        }
+        else if(strcmp(opt, "--threads") == 0)
+        {
+            numThreads = max(1ul, strtoul(arg, NULL, 0));
+        }
+        else if(strcmp(opt, "--rounds") == 0)
+        {
+            rounds = max(1ul, strtoul(arg, NULL, 0));
+        }
+        else if(strcmp(opt, "--eta") == 0)
+        {
+            eta = max(2ul, strtoul(arg, NULL, 0));
+        }
+        else if(strcmp(opt, "--format") == 0)
+        {
+            json = (strcmp(arg, "json") == 0);
+            ret = (json || strcmp(arg, "csv") == 0) ? 0 : -EINVAL;
+        }
+        else if(strcmp(opt, "--out") == 0)
+        {
+            outFile = arg;
+        }
+        else
+        {
+            ret = -EINVAL;
+        }
+
+        if(ret)
+        {
+            cout << "Invalid argument " << opt << " " << arg << endl;
+            return -EINVAL;
+        }
+    }
+
+    TraceReader trace;
+    if(trace.open(argv[1]))
+    {
+        return -EBADF;
+    }
+
+    vector<SweepPoint *> points;
+    for(size_t p = 0 ; p < policies.size() ; p++)
+    {
+        vector<CacheConfig> icConfigs, dcConfigs;
+        buildConfigs(params[0], params[1], params[2], params[3], policies[p], icConfigs);
+        buildConfigs(params[4], params[5], params[6], params[7], policies[p], dcConfigs);
+
+        for(size_t i = 0 ; i < icConfigs.size() ; i++)
+        for(size_t d = 0 ; d < dcConfigs.size() ; d++)
+        {
+            SweepPoint *point = new SweepPoint();
+            point->icConfig = icConfigs[i];
+            point->dcConfig = dcConfigs[d];
+            point->mem = new FlatMemoryStore();
+            point->icache = new Cache(point->icConfig, point->mem);
+            point->dcache = new Cache(point->dcConfig, point->mem);
+            point->cursor.attach(trace);
+            point->fetches = 0;
+            point->prunedRound = -1;
+            points.push_back(point);
+        }
+    }
+
+    if(points.empty())
+    {
+        cout << "No valid cache configurations to sweep" << endl;
+        return -EINVAL;
+    }
+
+    vector<size_t> survivors;
+    for(size_t i = 0 ; i < points.size() ; i++)
+    {
+        survivors.push_back(i);
+    }
+
+    for(unsigned round = 0 ; round < rounds ; round++)
+    {
+        //The prefix doubles every round; the last round covers the whole trace.
+        size_t limit = trace.size();
+        if(round + 1 < rounds)
+        {
+            limit = trace.size() >> (rounds - 1 - round);
+        }
+
+        runWorkStealing(survivors, numThreads, [&points, limit](size_t i)
+        {
+            points[i]->advance(limit);
+        });
+
+        if(round + 1 == rounds)
+        {
+            break;
+        }
+
+        //Keep the best 1/eta (by estimated cycles so far) for the next round.
+        stable_sort(survivors.begin(), survivors.end(), [&points](size_t a, size_t b)
+        {
+            return points[a]->estimatedCycles() < points[b]->estimatedCycles();
+        });
+
+        size_t keep = max<size_t>(1, (survivors.size() + eta - 1) / eta);
+        for(size_t i = keep ; i < survivors.size() ; i++)
+        {
+            points[survivors[i]]->prunedRound = round;
+        }
+        survivors.resize(keep);
+    }
+
+    if(outFile)
+    {
+        ofstream out(outFile);
+        if(!out)
+        {
+            cout << "Could not open " << outFile << endl;
+            return -EBADF;
+        }
+        writeResults(out, points, json);
+    }
+    else
+    {
+        writeResults(cout, points, json);
+    }
+
+    for(size_t i = 0 ; i < points.size() ; i++)
+    {
+        delete points[i]->icache;
+        delete points[i]->dcache;
+        delete points[i]->mem;
+        delete points[i];
+    }
+
+    return 0;
+}
@@ -0,0 +1,1672 @@
+#include <iostream>
+#include <iomanip>
+#include <string.h>
+#include <errno.h>
+#include "CycleSim.h"
+#include "FlatMemoryStore.h"
+
+using namespace std;
+
+//The bit of reg in a register mask. The zero register never has one, as it never
+//holds anything up.
+static uint32_t regMask(uint8_t reg)
+{
+    return (1u << reg) & ~1u;
+}
+
+static MemEntrySize getAccessSize(uint8_t opcode)
+{
+    switch(opcode)
+    {
+        case OP_LBU:
+        case OP_SB:
+            return BYTE_SIZE;
+        case OP_LHU:
+        case OP_SH:
+            return HALF_SIZE;
+        default:
+            return WORD_SIZE;
+    }
+}
+
+//Words in a block, at least one.
+static uint32_t getBlockWords(const CacheConfig & cfg)
+{
+    return cfg.blockSize > WORD_SIZE ? cfg.blockSize / WORD_SIZE : 1;
+}
+
+CycleSim::CycleSim(): mem(NULL), icache(NULL), dcache(NULL), l2cache(NULL), dumps(true),
+                      pipeTrace(NULL), profiler(NULL), statsRegistry(NULL), stateHash(NULL), numMshrs(1)
+{
+    memset(&stats, 0, sizeof(stats));
+    reset();
+}
+
+CycleSim::~CycleSim()
+{
+    delete icache;
+    delete dcache;
+    delete l2cache;
+}
+
+void CycleSim::reset()
+{
+    for(int i = 0 ; i < NUM_REGS ; i++)
+    {
+        //This'll initialise the zero register appropriately too...
+        regs[i] = 0;
+    }
+
+    ll_sc_flag = false;
+    ll_sc_addr = 0;
+
+    cycle = 0;
+    retired = 0;
+    halted = false;
+    memset(&pipeState, 0, sizeof(PipeState));
+    flushed = false;
+    mispredicted = false;
+    predictor.init(PredictorConfig());
+
+    ifValid = false;
+    ifPC = 0;
+    ifWord = 0;
+    ifStall = 0;
+    fetchPC = 0;
+    branchPending = false;
+    branchTarget = 0;
+    fetchHalted = false;
+    draining = false;
+    delaySlotDue = false;
+    speculating = false;
+
+    memset(&id, 0, sizeof(PipeInst));
+    memset(&ex, 0, sizeof(PipeInst));
+    memset(&memStage, 0, sizeof(PipeInst));
+    memset(&wb, 0, sizeof(PipeInst));
+    memStall = 0;
+
+    memset(mshrs, 0, sizeof(mshrs));
+    pendingRegs = 0;
+    memset(pendingCycle, 0, sizeof(pendingCycle));
+    memset(pendingValue, 0, sizeof(pendingValue));
+    dcMerged = 0;
+    mshrStalls = 0;
+    speculatedBranches = 0;
+    mispredictCycles = 0;
+    idStallCause = BUBBLE_BASE;
+}
+
+void CycleSim::setStats(StatsRegistry *stats)
+{
+    statsRegistry = stats;
+    memset(&this->stats, 0, sizeof(this->stats));
+
+    if(!stats)
+    {
+        return;
+    }
+
+    CycleStats & s = this->stats;
+    s.cycles = stats->counter("pipeline.cycles", "cycles run");
+    s.instructions = stats->counter("pipeline.instructions", "instructions retired");
+    s.loadUse = stats->counter("stall.load_use", "cycles ID waited for a load in EX");
+    s.branchHazard = stats->counter("stall.branch_hazard", "cycles a branch in ID waited for its operands");
+    s.fillWait = stats->counter("stall.fill_wait", "cycles ID waited for a register being filled");
+    s.icacheStall = stats->counter("stall.icache", "cycles IF waited for the I-cache");
+    s.dcacheStall = stats->counter("stall.dcache", "cycles MEM waited for the D-cache");
+    s.flushes = stats->counter("flush.count", "pipeline flushes (exceptions)");
+    s.branches = stats->counter("bpred.branches", "conditional branches resolved");
+    s.mispredicts = stats->counter("bpred.mispredicts", "conditional branches the predictor got wrong");
+    s.speculated = stats->counter("bpred.speculated", "branches that left ID on a prediction");
+    s.wrongPath = stats->counter("bpred.flush_cycles", "cycles lost to fetching down the wrong path");
+    s.btbHits = stats->counter("btb.hits", "jr resolved with their target in the BTB");
+    s.btbMisses = stats->counter("btb.misses", "jr resolved with their target missing from the BTB");
+
+    //Every cycle goes to exactly one component: base if an instruction retires,
+    //else whatever put the bubble in WB there.
+    StatCounter *base = stats->counter("cpi.base", "cycles retiring instructions or filling the pipeline");
+    StatCounter *data = stats->counter("cpi.data", "cycles lost to data hazards");
+    StatCounter *control = stats->counter("cpi.control", "cycles lost to flushes and mispredicted branches");
+    StatCounter *memory = stats->counter("cpi.memory", "cycles lost to cache misses and fills");
+
+    s.cpi[BUBBLE_BASE] = base;
+    s.cpi[BUBBLE_LOAD_USE] = data;
+    s.cpi[BUBBLE_BRANCH_HAZARD] = data;
+    s.cpi[BUBBLE_FILL_WAIT] = memory;
+    s.cpi[BUBBLE_ICACHE] = memory;
+    s.cpi[BUBBLE_DCACHE] = memory;
+    s.cpi[BUBBLE_FLUSH] = control;
+    s.cpi[BUBBLE_MISPREDICT] = control;
+
+    s.dcacheMissLatency = stats->histogram("dcache.miss_latency",
+                                           "cycles from a D-cache miss to its word arriving");
+}
+
+int CycleSim::init(CacheConfig & icConfig, CacheConfig & dcConfig, MemoryStore *mainMem)
+{
+    if(!mainMem)
+    {
+        cout << "Invalid memory store passed, could not initialise the simulator" << endl;
+        return -EINVAL;
+    }
+
+    if(dcConfig.mshrs > MAX_MSHRS)
+    {
+        cout << "The D-cache can have at most " << MAX_MSHRS << " MSHRs" << endl;
+        return -EINVAL;
+    }
+
+    delete icache;
+    delete dcache;
+    delete l2cache;
+
+    mem = mainMem;
+    this->icConfig = icConfig;
+    this->dcConfig = dcConfig;
+    l2Config = CacheConfig();
+    icache = new Cache(icConfig, mem);
+    dcache = new Cache(dcConfig, mem);
+    l2cache = NULL;
+    numMshrs = dcConfig.mshrs ? dcConfig.mshrs : 1;
+
+    reset();
+    return 0;
+}
+
+int CycleSim::setBranchPredictor(const PredictorConfig & config)
+{
+    if(predictor.init(config))
+    {
+        cout << "Invalid branch predictor configuration" << endl;
+        predictor.init(PredictorConfig());
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+int CycleSim::setL2Cache(const CacheConfig & config)
+{
+    if(!mem)
+    {
+        return -EINVAL;
+    }
+
+    uint32_t blockSize = config.blockSize;
+    if(config.cacheSize && (blockSize < icConfig.blockSize || blockSize < dcConfig.blockSize ||
+                            (config.inclusion == EXCLUSIVE &&
+                             (blockSize != icConfig.blockSize || blockSize != dcConfig.blockSize))))
+    {
+        cout << "L2 blocks must be no smaller than the L1 blocks, and the same size for an exclusive L2" << endl;
+        return -EINVAL;
+    }
+
+    //The L1 caches go first, they unregister from the L2.
+    delete icache;
+    delete dcache;
+    delete l2cache;
+
+    l2Config = config;
+    l2cache = config.cacheSize ? new Cache(config, mem) : NULL;
+
+    MemoryStore *below = l2cache ? static_cast<MemoryStore *>(l2cache) : mem;
+    icache = new Cache(icConfig, below);
+    dcache = new Cache(dcConfig, below);
+    return 0;
+}
+
+void CycleSim::writeBackCaches()
+{
+    dcache->writeBackAll();
+    if(l2cache)
+    {
+        l2cache->writeBackAll();
+    }
+}
+
+void CycleSim::reloadCaches()
+{
+    if(l2cache)
+    {
+        l2cache->reloadAll();
+    }
+    icache->reloadAll();
+    dcache->reloadAll();
+}
+
+void CycleSim::decode(uint32_t word, uint32_t pc, PipeInst & inst)
+{
+    memset(&inst, 0, sizeof(PipeInst));
+    inst.valid = true;
+    inst.word = word;
+    inst.pc = pc;
+
+    if(word == MAGIC_DEMARC)
+    {
+        inst.isHalt = true;
+        return;
+    }
+
+    uint16_t imm = word & 0xffff;
+    //Sign extend the immediate...
+    uint32_t seImm = static_cast<uint32_t>(static_cast<int32_t>(static_cast<int16_t>(imm)));
+    uint32_t zeImm = imm;
+    uint8_t rd = (word >> 11) & 0x1f;
+
+    inst.opcode = getOpcode(word);
+    inst.funct = word & 0x3f;
+    inst.rs = (word >> 21) & 0x1f;
+    inst.rt = (word >> 16) & 0x1f;
+    inst.shamt = (word >> 6) & 0x1f;
+    inst.imm = seImm;
+
+    bool readsRs = false;
+    bool readsRt = false;
+
+    switch(inst.opcode)
+    {
+        case OP_ZERO:
+            switch(inst.funct)
+            {
+                case FUN_ADD:
+                case FUN_ADDU:
+                case FUN_AND:
+                case FUN_NOR:
+                case FUN_OR:
+                case FUN_SLT:
+                case FUN_SLTU:
+                case FUN_SUB:
+                case FUN_SUBU:
+                    readsRs = true;
+                    readsRt = true;
+                    inst.dest = rd;
+                    break;
+                case FUN_SLL:
+                case FUN_SRL:
+                    readsRt = true;
+                    inst.dest = rd;
+                    break;
+                case FUN_JR:
+                    readsRs = true;
+                    inst.isControl = true;
+                    break;
+                default:
+                    inst.isIllegal = true;
+                    break;
+            }
+            break;
+        case OP_ADDI:
+        case OP_ADDIU:
+        case OP_SLTI:
+        case OP_SLTIU:
+            readsRs = true;
+            inst.dest = inst.rt;
+            break;
+        case OP_ANDI:
+        case OP_ORI:
+            readsRs = true;
+            inst.dest = inst.rt;
+            inst.imm = zeImm;
+            break;
+        case OP_LUI:
+            inst.dest = inst.rt;
+            inst.imm = zeImm << 16;
+            break;
+        case OP_BEQ:
+        case OP_BNE:
+            //MIPS multiplies immediates by 4 for branches...
+            readsRs = true;
+            readsRt = true;
+            inst.isControl = true;
+            inst.imm = 4 + (seImm << 2);
+            break;
+        case OP_LBU:
+        case OP_LHU:
+        case OP_LL:
+        case OP_LW:
+            readsRs = true;
+            inst.dest = inst.rt;
+            inst.isLoad = true;
+            break;
+        case OP_SB:
+        case OP_SH:
+        case OP_SW:
+            readsRs = true;
+            readsRt = true;
+            inst.isStore = true;
+            break;
+        case OP_SC:
+            //Writes the success flag to rt, which is only known in MEM.
+            readsRs = true;
+            readsRt = true;
+            inst.dest = inst.rt;
+            inst.isLoad = true;
+            inst.isStore = true;
+            break;
+        case OP_JAL:
+            inst.dest = REG_RA;
+            inst.result = pc + 8;
+            //Fall through...
+        case OP_J:
+            inst.isControl = true;
+            inst.imm = (word & 0x3ffffff) << 2;
+            break;
+        default:
+            inst.isIllegal = true;
+            break;
+    }
+
+    inst.srcMask = (readsRs ? regMask(inst.rs) : 0) | (readsRt ? regMask(inst.rt) : 0);
+    inst.destMask = regMask(inst.dest);
+    inst.lateMask = inst.isLoad ? inst.destMask : 0;
+}
+
+//The value of reg as seen by an instruction reading it this cycle. Whatever is in WB
+//has been written to the register file already, so only a result in MEM needs
+//forwarding. Loads in MEM never get here, the hazard checks stall for them.
+uint32_t CycleSim::forward(uint8_t reg) const
+{
+    if((memStage.destMask & ~memStage.lateMask) & regMask(reg))
+    {
+        return memStage.result;
+    }
+
+    return regs[reg];
+}
+
+//Drops inst (in EX or ID) and everything behind it and restarts fetching at the
+//exception handler.
+void CycleSim::raiseException(PipeInst & inst)
+{
+    if(profiler)
+    {
+        profiler->flush(inst.pc, inst.word);
+    }
+
+    memset(&inst, 0, sizeof(PipeInst));
+    memset(&id, 0, sizeof(PipeInst));
+    inst.bubble = BUBBLE_FLUSH;
+    id.bubble = BUBBLE_FLUSH;
+    STAT_INC(stats.flushes);
+
+    ifValid = false;
+    ifStall = 0;
+    branchPending = false;
+    fetchHalted = false;
+    delaySlotDue = false;
+    speculating = false;
+    fetchPC = EXCEPTION_ADDR;
+    ll_sc_flag = false;
+    flushed = true;
+}
+
+int CycleSim::startFetch()
+{
+    if(!FlatMemoryStore::inRange(fetchPC, WORD_SIZE))
+    {
+        //A wrong path can lead anywhere. Wait for the branch to resolve.
+        if(speculating)
+        {
+            return 0;
+        }
+
+        cerr << "Could not fetch instruction at address " << "0x" << hex << setfill('0')
+             << setw(8) << fetchPC << endl;
+        return -EBADF;
+    }
+
+    uint32_t misses = icache->getMisses();
+    icache->getCacheValue(fetchPC, ifWord, WORD_SIZE);
+
+    ifPC = fetchPC;
+    ifValid = true;
+    ifStall = icache->getLatency();
+    if(profiler && icache->getMisses() != misses)
+    {
+        profiler->count(PROF_IC_MISSES, fetchPC);
+    }
+    delaySlotDue = isControlWord(ifWord);
+
+    //Nothing after the end of the program is fetched.
+    if(ifWord == MAGIC_DEMARC)
+    {
+        fetchHalted = true;
+    }
+
+    return 0;
+}
+
+//Does inst have to wait in ID for a register still being filled by the D-cache? A
+//filled value is written at the end of its fill cycle, which is in time for EX in the
+//next cycle but not for a branch comparing in ID.
+bool CycleSim::waitsForFill(const PipeInst & inst) const
+{
+    for(uint32_t waiting = inst.srcMask & pendingRegs ; waiting ; waiting &= waiting - 1)
+    {
+        uint32_t r = __builtin_ctz(waiting);
+        if(pendingCycle[r] > cycle || (inst.isControl && pendingCycle[r] == cycle))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool CycleSim::doDecode(PipeInst & inst)
+{
+    if(!inst.word || inst.done)
+    {
+        return false;
+    }
+
+    //The end of the program waits for the last loads to get their data. With MSHRs
+    //a load in EX may still leave a register to be filled once it gets to MEM.
+    if(inst.isHalt)
+    {
+        idStallCause = BUBBLE_FILL_WAIT;
+        return pendingRegs != 0 || (dcConfig.mshrs && ex.isLoad);
+    }
+
+    if(inst.isIllegal)
+    {
+        cerr << "Illegal instruction at address " << "0x" << hex
+             << setfill('0') << setw(8) << inst.pc << endl;
+        raiseException(inst);
+        return false;
+    }
+
+    //Load-use: a loaded value can't be forwarded before the load has left MEM.
+    if(inst.srcMask & ex.lateMask)
+    {
+        idStallCause = BUBBLE_LOAD_USE;
+        return true;
+    }
+
+    if((inst.srcMask & pendingRegs) && waitsForFill(inst))
+    {
+        idStallCause = BUBBLE_FILL_WAIT;
+        return true;
+    }
+
+    if(inst.isControl)
+    {
+        //Branches compare in ID, so they also wait for a result still being computed
+        //in EX and for a load in MEM, unless they can go on on a prediction.
+        if(inst.srcMask & (ex.destMask | memStage.lateMask))
+        {
+            idStallCause = BUBBLE_BRANCH_HAZARD;
+            return !(predictor.isEnabled() && speculate(inst));
+        }
+
+        bool taken = true;
+        uint32_t target = resolveBranch(inst, forward(inst.rs), forward(inst.rt), taken);
+        if(predictor.isEnabled())
+        {
+            trainPredictor(inst, taken, target);
+        }
+
+        if(taken)
+        {
+            branchPending = true;
+            branchTarget = target;
+        }
+    }
+
+    inst.done = true;
+    return false;
+}
+
+//Whether a branch or jump is taken, and where to.
+uint32_t CycleSim::resolveBranch(const PipeInst & inst, uint32_t rsVal, uint32_t rtVal, bool & taken)
+{
+    taken = true;
+
+    switch(inst.opcode)
+    {
+        case OP_BEQ:
+            taken = rsVal == rtVal;
+            return inst.pc + inst.imm;
+        case OP_BNE:
+            taken = rsVal != rtVal;
+            return inst.pc + inst.imm;
+        case OP_J:
+        case OP_JAL:
+            return ((inst.pc + 4) & 0xf0000000) | inst.imm;
+        default:
+            //jr...
+            return rsVal;
+    }
+}
+
+void CycleSim::trainPredictor(const PipeInst & inst, bool taken, uint32_t target)
+{
+    if(inst.opcode == OP_BEQ || inst.opcode == OP_BNE)
+    {
+        bool predicted = predictor.update(inst.pc, taken);
+        STAT_INC(stats.branches);
+        STAT_ADD(stats.mispredicts, predicted != taken);
+    }
+    else if(inst.opcode == OP_ZERO)
+    {
+        bool hit = predictor.updateTarget(inst.pc, target);
+        STAT_ADD(stats.btbHits, hit);
+        STAT_ADD(stats.btbMisses, !hit);
+    }
+}
+
+//Lets a branch waiting in ID for its operands go on to EX, where it resolves (see
+//checkPrediction), with fetching redirected to the predicted PC once the delay slot
+//has left IF. Returns false if there's nothing to predict from: a jr missing in the
+//BTB (or j and jal, which never wait) stays in ID.
+bool CycleSim::speculate(PipeInst & inst)
+{
+    uint32_t next = inst.pc + 8;
+
+    if(inst.opcode == OP_BEQ || inst.opcode == OP_BNE)
+    {
+        next = predictor.predict(inst.pc) ? inst.pc + inst.imm : next;
+    }
+    else if(inst.opcode != OP_ZERO)
+    {
+        return false;
+    }
+    else if(!predictor.lookupTarget(inst.pc, next))
+    {
+        return false;
+    }
+
+    inst.speculated = true;
+    inst.predictedPC = next;
+    inst.done = true;
+    branchPending = true;
+    branchTarget = next;
+    speculating = true;
+    speculatedBranches++;
+    STAT_INC(stats.speculated);
+    return true;
+}
+
+//A branch that left ID on a prediction resolves in EX, with its operands forwarded
+//like any other instruction's. If its delay slot hasn't left IF yet, only the
+//redirect needs correcting. Otherwise the instruction fetched since is on the wrong
+//path if the prediction was wrong, and is dropped from IF, which costs a cycle.
+void CycleSim::checkPrediction(const PipeInst & inst)
+{
+    bool taken = true;
+    uint32_t target = resolveBranch(inst, inst.rsVal, inst.rtVal, taken);
+    uint32_t next = taken ? target : inst.pc + 8;
+
+    trainPredictor(inst, taken, target);
+    speculating = false;
+
+    if(branchPending)
+    {
+        branchTarget = next;
+        return;
+    }
+
+    if(next == inst.predictedPC)
+    {
+        return;
+    }
+
+    if(profiler)
+    {
+        profiler->flush(inst.pc, inst.word);
+    }
+
+    ifValid = false;
+    ifStall = 0;
+    fetchHalted = false;
+    delaySlotDue = false;
+    fetchPC = next;
+
+    //Nothing is fetched while draining, so nothing is lost.
+    if(!draining)
+    {
+        mispredicted = true;
+        mispredictCycles++;
+        STAT_INC(stats.wrongPath);
+    }
+}
+
+void CycleSim::doExecute(PipeInst & inst)
+{
+    if(!inst.word || inst.done || inst.isHalt)
+    {
+        return;
+    }
+
+    inst.done = true;
+    inst.rsVal = forward(inst.rs);
+    inst.rtVal = forward(inst.rt);
+
+    uint32_t s1 = inst.rsVal;
+    uint32_t s2 = inst.rtVal;
+    bool overflow = false;
+
+    switch(inst.opcode)
+    {
+        case OP_ZERO:
+            switch(inst.funct)
+            {
+                case FUN_ADD:
+                    inst.result = s1 + s2;
+                    overflow = getSign(s1) == getSign(s2) && getSign(s2) != getSign(inst.result);
+                    break;
+                case FUN_ADDU:
+                    inst.result = s1 + s2;
+                    break;
+                case FUN_AND:
+                    inst.result = s1 & s2;
+                    break;
+                case FUN_NOR:
+                    inst.result = ~(s1 | s2);
+                    break;
+                case FUN_OR:
+                    inst.result = s1 | s2;
+                    break;
+                case FUN_SLT:
+                    inst.result = (static_cast<int32_t>(s1) < static_cast<int32_t>(s2)) ? 1 : 0;
+                    break;
+                case FUN_SLTU:
+                    inst.result = (s1 < s2) ? 1 : 0;
+                    break;
+                case FUN_SLL:
+                    inst.result = s2 << inst.shamt;
+                    break;
+                case FUN_SRL:
+                    inst.result = s2 >> inst.shamt;
+                    break;
+                case FUN_SUB:
+                    inst.result = s1 - s2;
+                    overflow = getSign(s1) != getSign(s2) && getSign(s2) == getSign(inst.result);
+                    break;
+                case FUN_SUBU:
+                    inst.result = s1 - s2;
+                    break;
+            }
+            break;
+        case OP_ADDI:
+            inst.result = s1 + inst.imm;
+            overflow = getSign(s1) == getSign(inst.imm) && getSign(inst.imm) != getSign(inst.result);
+            break;
+        case OP_ADDIU:
+            inst.result = s1 + inst.imm;
+            break;
+        case OP_ANDI:
+            inst.result = s1 & inst.imm;
+            break;
+        case OP_ORI:
+            inst.result = s1 | inst.imm;
+            break;
+        case OP_SLTI:
+            inst.result = (static_cast<int32_t>(s1) < static_cast<int32_t>(inst.imm)) ? 1 : 0;
+            break;
+        case OP_SLTIU:
+            inst.result = (s1 < inst.imm) ? 1 : 0;
+            break;
+        case OP_LUI:
+            inst.result = inst.imm;
+            break;
+        default:
+            //Loads and stores compute their address, control instructions are done.
+            inst.addr = s1 + inst.imm;
+            break;
+    }
+
+    if(overflow)
+    {
+        raiseException(inst);
+    }
+    else if(inst.speculated)
+    {
+        checkPrediction(inst);
+    }
+}
+
+int CycleSim::doMemAccess(PipeInst & inst)
+{
+    if(!inst.word || inst.done || !(inst.isLoad || inst.isStore))
+    {
+        return 0;
+    }
+
+    inst.done = true;
+
+    MemEntrySize size = getAccessSize(inst.opcode);
+    if(!FlatMemoryStore::inRange(inst.addr, size))
+    {
+        cerr << "Error executing instruction " << "0x" << hex << setfill('0')
+             << setw(8) << inst.word << " at address " << "0x" << inst.pc << endl;
+        return -EINVAL;
+    }
+
+    uint32_t misses = dcache->getMisses();
+    uint32_t value = 0;
+
+    switch(inst.opcode)
+    {
+        case OP_LL:
+            //Set the ll_sc_flag. It'll be cleared on any exception or when the SC succeeds,
+            //or if there's an intervening store that overlaps with the ll word in any way.
+            ll_sc_flag = true;
+            ll_sc_addr = inst.addr;
+            //Fall through...
+        case OP_LBU:
+        case OP_LHU:
+        case OP_LW:
+            dcache->getCacheValue(inst.addr, value, size);
+            inst.result = value;
+            break;
+        case OP_SC:
+            inst.result = 0;
+            if(inst.addr == ll_sc_addr && ll_sc_flag)
+            {
+                //We are atomic. Store the value.
+                dcache->setCacheValue(inst.addr, inst.rtVal, WORD_SIZE);
+                inst.result = 1;
+            }
+            ll_sc_flag = false;
+            break;
+        default:
+        {
+            uint32_t mask = (size == WORD_SIZE) ? 0xffffffff : (1u << (8 * size)) - 1;
+            dcache->setCacheValue(inst.addr, inst.rtVal & mask, size);
+
+            //Any store overlapping the ll word breaks atomicity.
+            uint32_t storeEnd = inst.addr + static_cast<uint32_t>(size);
+            uint32_t llEnd = ll_sc_addr + static_cast<uint32_t>(WORD_SIZE);
+            if((inst.addr >= ll_sc_addr && inst.addr < llEnd) ||
+               (storeEnd > ll_sc_addr && storeEnd <= llEnd))
+            {
+                ll_sc_flag = false;
+            }
+            break;
+        }
+    }
+
+    if(profiler && dcache->getMisses() != misses)
+    {
+        profiler->count(PROF_DC_MISSES, inst.pc);
+    }
+
+    finishMemAccess(inst, dcache->getMisses() != misses, dcache->getLatency());
+    return 0;
+}
+
+//The fill in flight for the block holding addr, if any.
+Mshr *CycleSim::findFill(uint32_t addr)
+{
+    uint32_t blockAddr = addr & ~(dcConfig.blockSize - 1);
+
+    for(uint32_t i = 0 ; i < numMshrs ; i++)
+    {
+        if(mshrs[i].doneCycle > cycle && mshrs[i].blockAddr == blockAddr)
+        {
+            return &mshrs[i];
+        }
+    }
+
+    return NULL;
+}
+
+//Starts filling the block holding addr in a free MSHR, or in the one that frees up
+//first if they are all busy. The last word arrives latency cycles after the fill
+//starts, in cycle start.
+Mshr *CycleSim::startFill(uint32_t addr, uint32_t latency, uint32_t & start)
+{
+    Mshr *fill = &mshrs[0];
+
+    for(uint32_t i = 1 ; i < numMshrs ; i++)
+    {
+        if(mshrs[i].doneCycle < fill->doneCycle)
+        {
+            fill = &mshrs[i];
+        }
+    }
+
+    start = fill->doneCycle > cycle ? fill->doneCycle : cycle;
+
+    uint32_t transfer = (getBlockWords(dcConfig) - 1) * dcConfig.wordCycles;
+    fill->blockAddr = addr & ~(dcConfig.blockSize - 1);
+    fill->firstWord = (addr % dcConfig.blockSize) / WORD_SIZE;
+    fill->firstCycle = start + (latency > transfer ? latency - transfer : 0);
+    fill->doneCycle = fill->firstCycle + transfer;
+    return fill;
+}
+
+//The cycle at the end of which the word holding addr arrives.
+uint32_t CycleSim::wordReady(const Mshr & fill, uint32_t addr) const
+{
+    uint32_t words = getBlockWords(dcConfig);
+    uint32_t word = (addr % dcConfig.blockSize) / WORD_SIZE;
+    return fill.firstCycle + ((word + words - fill.firstWord) % words) * dcConfig.wordCycles;
+}
+
+//Works out how long the access of inst holds MEM. A blocking D-cache holds it until
+//the data is there. A non-blocking one only holds it while there is no free MSHR,
+//and a load leaves its register to be written when the data arrives.
+void CycleSim::finishMemAccess(PipeInst & inst, bool missed, uint32_t latency)
+{
+    uint32_t start = cycle;
+    Mshr *fill = findFill(inst.addr);
+
+    if(fill)
+    {
+        //A secondary miss, which waits for the fill already on its way.
+        dcMerged++;
+    }
+    else if(missed)
+    {
+        fill = startFill(inst.addr, latency, start);
+        mshrStalls += start - cycle;
+    }
+
+    uint32_t ready = fill ? wordReady(*fill, inst.addr) : cycle;
+    uint32_t leave = start;
+
+    //A secondary miss may find its word already there.
+    if(fill && ready > cycle)
+    {
+        STAT_SAMPLE(stats.dcacheMissLatency, ready - cycle);
+    }
+
+    if(!dcConfig.mshrs)
+    {
+        leave = ready > cycle ? ready : cycle;
+    }
+    else if(inst.isLoad && inst.opcode != OP_SC && inst.dest && ready > start)
+    {
+        pendingRegs |= 1u << inst.dest;
+        pendingCycle[inst.dest] = ready;
+        pendingValue[inst.dest] = inst.result;
+        inst.dest = 0;
+        inst.destMask = 0;
+        inst.lateMask = 0;
+    }
+
+    memStall = leave - cycle;
+}
+
+//Writes the registers of loads whose data has arrived.
+void CycleSim::writeFilledRegs()
+{
+    for(uint32_t waiting = pendingRegs ; waiting ; waiting &= waiting - 1)
+    {
+        uint32_t r = __builtin_ctz(waiting);
+        if(pendingCycle[r] < cycle)
+        {
+            regs[r] = pendingValue[r];
+            pendingRegs &= ~(1u << r);
+        }
+    }
+}
+
+//Runs one cycle. The stages are worked through from WB back to IF, so every stage
+//sees the results of the older instructions from this same cycle (WB writes the
+//register file before anything reads it), and then everything moves along unless
+//it is stalled.
+int CycleSim::step()
+{
+    int ret = 0;
+
+    if(!ifValid && !fetchHalted && (!draining || delaySlotDue))
+    {
+        ret = startFetch();
+        if(ret)
+        {
+            return ret;
+        }
+    }
+
+    pipeState.cycle = cycle;
+    pipeState.ifInstr = ifValid ? ifWord : 0;
+    pipeState.idInstr = id.word;
+    pipeState.exInstr = ex.word;
+    pipeState.memInstr = memStage.word;
+    pipeState.wbInstr = wb.word;
+    flushed = false;
+    mispredicted = false;
+
+    if(pendingRegs)
+    {
+        writeFilledRegs();
+    }
+
+    //WB... A register still waiting for a fill is now the later instruction's.
+    regs[wb.dest] = wb.result;
+    regs[REG_ZERO] = 0;
+    pendingRegs &= ~wb.destMask;
+
+    if(wb.isHalt)
+    {
+        STAT_INC(stats.cycles);
+        STAT_INC(stats.cpi[BUBBLE_BASE]);
+        halted = true;
+        if(pipeTrace)
+        {
+            pipeTrace->record(pipeState, 1, 0);
+        }
+        cycle++;
+        return 0;
+    }
+
+    if(wb.valid)
+    {
+        retired++;
+        if(profiler)
+        {
+            profiler->retire(wb.pc, wb.word);
+        }
+        if(stateHash)
+        {
+            hashRetired(wb);
+        }
+    }
+
+    //MEM...
+    ret = doMemAccess(memStage);
+    if(ret)
+    {
+        return ret;
+    }
+
+    bool memBusy = memStall > 0;
+    if(memBusy)
+    {
+        memStall--;
+    }
+
+    //EX and ID...
+    doExecute(ex);
+    bool idStall = doDecode(id);
+
+    if(pipeTrace)
+    {
+        uint32_t flags = (ifValid && ifStall ? PIPE_IF_STALL : 0) | (idStall ? PIPE_ID_STALL : 0) |
+                         (memBusy ? PIPE_MEM_STALL : 0) | (flushed || mispredicted ? PIPE_FLUSH : 0);
+        pipeTrace->record(pipeState, 1, flags);
+    }
+
+    //A stall cycle counts against the oldest instruction held.
+    if(profiler && (memBusy || idStall || (ifValid && ifStall)))
+    {
+        profiler->count(PROF_STALL_CYCLES, memBusy ? memStage.pc : (idStall ? id.pc : ifPC));
+    }
+
+    if(SIM_STATS_ENABLED && statsRegistry)
+    {
+        STAT_INC(stats.cycles);
+        STAT_INC(stats.cpi[wb.valid ? static_cast<uint8_t>(BUBBLE_BASE) : wb.bubble]);
+        STAT_ADD(stats.icacheStall, ifValid && ifStall);
+        STAT_ADD(stats.dcacheStall, memBusy);
+        STAT_ADD(stats.loadUse, idStall && idStallCause == BUBBLE_LOAD_USE);
+        STAT_ADD(stats.branchHazard, idStall && idStallCause == BUBBLE_BRANCH_HAZARD);
+        STAT_ADD(stats.fillWait, idStall && idStallCause == BUBBLE_FILL_WAIT);
+
+        if(wb.valid)
+        {
+            countRetired(wb);
+        }
+    }
+
+    //Move everything along. A D-cache miss holds MEM and everything before it.
+    if(memBusy)
+    {
+        memset(&wb, 0, sizeof(PipeInst));
+        wb.bubble = BUBBLE_DCACHE;
+    }
+    else
+    {
+        wb = memStage;
+        memStage = ex;
+        memStage.done = false;
+
+        if(idStall)
+        {
+            memset(&ex, 0, sizeof(PipeInst));
+            ex.bubble = idStallCause;
+        }
+        else
+        {
+            ex = id;
+            ex.done = false;
+
+            if(ifValid && !ifStall)
+            {
+                decode(ifWord, ifPC, id);
+                ifValid = false;
+                //Once the delay slot has left IF, a taken branch redirects fetching.
+                fetchPC = branchPending ? branchTarget : ifPC + 4;
+                branchPending = false;
+            }
+            else
+            {
+                memset(&id, 0, sizeof(PipeInst));
+                id.bubble = ifValid ? BUBBLE_ICACHE :
+                            (flushed ? BUBBLE_FLUSH : (mispredicted ? BUBBLE_MISPREDICT : BUBBLE_BASE));
+            }
+        }
+    }
+
+    if(ifValid && ifStall)
+    {
+        ifStall--;
+    }
+
+    cycle++;
+    return 0;
+}
+
+//How many cycles from now on are certain to change nothing but the cycle count and
+//the stall counters: MEM waiting for the D-cache with the rest of the pipeline held
+//behind it, or an otherwise empty pipeline waiting for the I-cache or for the last
+//fills before the end of the program. 0 if the next cycle has work to do.
+uint32_t CycleSim::idleCycles() const
+{
+    bool fetching = !ifValid && !fetchHalted && (!draining || delaySlotDue);
+    if(fetching || wb.valid)
+    {
+        return 0;
+    }
+
+    uint32_t idle = 0;
+
+    if(memStall)
+    {
+        //EX and ID have already done their work in the first cycle of the stall.
+        if((ex.word && !ex.done && !ex.isHalt) || (id.word && !id.done && !id.isHalt))
+        {
+            return 0;
+        }
+
+        idle = memStall;
+    }
+    else if(!memStage.valid && !ex.valid && (!id.valid || (id.isHalt && pendingRegs)))
+    {
+        if(ifValid && ifStall)
+        {
+            idle = ifStall;
+        }
+        else if(!ifValid && pendingRegs)
+        {
+            idle = UINT32_MAX;
+        }
+    }
+
+    //Stop short of the next register being filled.
+    for(uint32_t waiting = idle ? pendingRegs : 0 ; waiting ; waiting &= waiting - 1)
+    {
+        uint32_t r = __builtin_ctz(waiting);
+        uint32_t left = pendingCycle[r] >= cycle ? pendingCycle[r] - cycle + 1 : 0;
+        idle = left < idle ? left : idle;
+    }
+
+    return idle;
+}
+
+//Runs count idle cycles at once (see idleCycles).
+void CycleSim::skipCycles(uint32_t count)
+{
+    //Every skipped cycle would have recorded the same stages.
+    pipeState.cycle = cycle + count - 1;
+    pipeState.ifInstr = ifValid ? ifWord : 0;
+    pipeState.idInstr = id.word;
+    pipeState.exInstr = ex.word;
+    pipeState.memInstr = memStage.word;
+    pipeState.wbInstr = wb.word;
+
+    if(pipeTrace)
+    {
+        traceSkipped(count);
+    }
+
+    if(profiler)
+    {
+        profileSkipped(count);
+    }
+
+    skipBubbles(count);
+
+    memStall -= memStall < count ? memStall : count;
+    if(ifValid)
+    {
+        ifStall -= ifStall < count ? ifStall : count;
+    }
+
+    cycle += count;
+}
+
+//Records count skipped cycles in the pipeline trace: one run while IF is still
+//waiting for the I-cache and one for the rest.
+void CycleSim::traceSkipped(uint32_t count)
+{
+    PipeState state = pipeState;
+    state.cycle = cycle;
+
+    uint32_t flags = (memStall ? PIPE_MEM_STALL : 0) | (id.isHalt && pendingRegs ? PIPE_ID_STALL : 0);
+    uint32_t fetching = ifValid ? (ifStall < count ? ifStall : count) : 0;
+
+    if(fetching)
+    {
+        pipeTrace->record(state, fetching, flags | PIPE_IF_STALL);
+        state.cycle += fetching;
+    }
+
+    if(count > fetching)
+    {
+        pipeTrace->record(state, count - fetching, flags);
+    }
+}
+
+//Counts count skipped cycles as stall cycles, like step would have.
+void CycleSim::profileSkipped(uint32_t count)
+{
+    if(memStall)
+    {
+        profiler->count(PROF_STALL_CYCLES, memStage.pc, count);
+    }
+    else if(id.isHalt && pendingRegs)
+    {
+        profiler->count(PROF_STALL_CYCLES, id.pc, count);
+    }
+    else if(ifValid)
+    {
+        profiler->count(PROF_STALL_CYCLES, ifPC, ifStall < count ? ifStall : count);
+    }
+}
+
+//Moves the bubbles along as count skipped cycles would have, and counts the cycles
+//and stalls. The bubble reaching WB is the same every cycle after the first four.
+void CycleSim::skipBubbles(uint32_t count)
+{
+    if(SIM_STATS_ENABLED && statsRegistry)
+    {
+        STAT_ADD(stats.cycles, count);
+        STAT_ADD(stats.icacheStall, ifValid ? (ifStall < count ? ifStall : count) : 0);
+        STAT_ADD(stats.dcacheStall, memStall ? count : 0);
+        STAT_ADD(stats.fillWait, id.isHalt && pendingRegs ? count : 0);
+    }
+
+    uint32_t shifts = count < 4 ? count : 4;
+
+    for(uint32_t i = 0 ; i < shifts ; i++)
+    {
+        STAT_INC(stats.cpi[wb.bubble]);
+
+        if(memStall)
+        {
+            wb.bubble = BUBBLE_DCACHE;
+        }
+        else
+        {
+            //Everything from MEM to WB is a bubble, ID is a bubble or the end of
+            //the program waiting for its fills.
+            wb.bubble = memStage.bubble;
+            memStage.bubble = ex.bubble;
+
+            if(id.isHalt)
+            {
+                ex.bubble = BUBBLE_FILL_WAIT;
+            }
+            else
+            {
+                ex.bubble = id.bubble;
+                id.bubble = ifValid ? BUBBLE_ICACHE : BUBBLE_BASE;
+            }
+        }
+    }
+
+    STAT_ADD(stats.cpi[wb.bubble], count - shifts);
+}
+
+//Counts an instruction leaving WB under its mnemonic.
+void CycleSim::countRetired(const PipeInst & inst)
+{
+    STAT_INC(stats.instructions);
+
+    uint32_t key = !inst.word ? NUM_OPCODE_STATS - 1 : (inst.opcode ? inst.opcode : 64 + inst.funct);
+    StatCounter *& counter = stats.opcodes[key];
+
+    if(!counter)
+    {
+        std::string text = disassemble(inst.word);
+        std::string name = text.substr(0, text.find(' '));
+        counter = statsRegistry->counter("opcode." + name, "instructions retired");
+    }
+
+    counter->value++;
+}
+
+//Stores reach the D-cache in MEM, but are only reported to the hash here, in WB, along
+//with the instruction, so that the hash never runs ahead of the instructions retired.
+void CycleSim::hashRetired(const PipeInst & inst)
+{
+    if(inst.isStore && (inst.opcode != OP_SC || inst.result))
+    {
+        MemEntrySize size = inst.opcode == OP_SB ? BYTE_SIZE : (inst.opcode == OP_SH ? HALF_SIZE : WORD_SIZE);
+        stateHash->store(inst.addr, inst.rtVal, size);
+    }
+
+    //Loads that missed in a non-blocking D-cache have dest cleared, but still carry
+    //their value.
+    uint8_t dest = getDestReg(inst.word);
+    stateHash->retire(inst.pc, dest, inst.result);
+}
+
+//Runs the next cycle, or as many idle cycles as possible up to maxCycles. ran is
+//set to the number of cycles run.
+int CycleSim::advance(uint32_t maxCycles, uint32_t & ran)
+{
+    uint32_t idle = idleCycles();
+    if(idle)
+    {
+        ran = idle < maxCycles ? idle : maxCycles;
+        skipCycles(ran);
+        return 0;
+    }
+
+    ran = 1;
+    return step();
+}
+
+void CycleSim::dumpPipe()
+{
+    if(dumps)
+    {
+        dumpPipeState(pipeState);
+    }
+}
+
+int CycleSim::runCycles(uint32_t cycles)
+{
+    if(!mem)
+    {
+        return -EINVAL;
+    }
+
+    int ret = 0;
+    uint32_t ran = 0;
+
+    for(uint32_t i = 0 ; i < cycles && !halted ; i += ran)
+    {
+        ret = advance(cycles - i, ran);
+        if(ret)
+        {
+            //Nothing sensible can run after an error.
+            halted = true;
+            break;
+        }
+    }
+
+    dumpPipe();
+    return ret;
+}
+
+int CycleSim::runTillHalt()
+{
+    if(!mem)
+    {
+        return -EINVAL;
+    }
+
+    int ret = 0;
+    uint32_t ran = 0;
+
+    while(!halted)
+    {
+        ret = advance(UINT32_MAX, ran);
+        if(ret)
+        {
+            halted = true;
+            break;
+        }
+    }
+
+    dumpPipe();
+    return ret;
+}
+
+int CycleSim::runInstructions(uint64_t count)
+{
+    if(!mem)
+    {
+        return -EINVAL;
+    }
+
+    int ret = 0;
+    uint64_t target = retired + count;
+    uint32_t ran = 0;
+
+    while(!halted && retired < target)
+    {
+        ret = advance(UINT32_MAX, ran);
+        if(ret)
+        {
+            halted = true;
+            break;
+        }
+    }
+
+    return ret;
+}
+
+bool CycleSim::isEmpty() const
+{
+    return !ifValid && !id.valid && !ex.valid && !memStage.valid && !wb.valid && !pendingRegs;
+}
+
+int CycleSim::drain()
+{
+    if(!mem)
+    {
+        return -EINVAL;
+    }
+
+    int ret = 0;
+    uint32_t ran = 0;
+    draining = true;
+
+    while(!halted && !isEmpty())
+    {
+        ret = advance(UINT32_MAX, ran);
+        if(ret)
+        {
+            halted = true;
+            break;
+        }
+    }
+
+    draining = false;
+    return ret;
+}
+
+void CycleSim::getArchState(ArchState & state) const
+{
+    state.pc = fetchPC;
+    memcpy(state.regs, regs, sizeof(regs));
+    state.ll_sc_flag = ll_sc_flag;
+    state.ll_sc_addr = ll_sc_addr;
+}
+
+void CycleSim::setArchState(const ArchState & state)
+{
+    memcpy(regs, state.regs, sizeof(regs));
+    ll_sc_flag = state.ll_sc_flag;
+    ll_sc_addr = state.ll_sc_addr;
+
+    halted = false;
+    ifValid = false;
+    ifStall = 0;
+    fetchPC = state.pc;
+    branchPending = false;
+    fetchHalted = false;
+    draining = false;
+    delaySlotDue = false;
+    speculating = false;
+
+    memset(&id, 0, sizeof(PipeInst));
+    memset(&ex, 0, sizeof(PipeInst));
+    memset(&memStage, 0, sizeof(PipeInst));
+    memset(&wb, 0, sizeof(PipeInst));
+    memStall = 0;
+    pendingRegs = 0;
+}
+
+int CycleSim::finalize()
+{
+    if(!mem)
+    {
+        return -EINVAL;
+    }
+
+    //Memory has to hold everything the program wrote before it is dumped.
+    writeBackCaches();
+
+    if(dumps)
+    {
+        RegisterInfo reg;
+        memset(&reg, 0, sizeof(RegisterInfo));
+        fillRegisterState(reg);
+        dumpRegisterState(reg);
+
+        FlatMemoryStore *flat = dynamic_cast<FlatMemoryStore *>(mem);
+        if(flat)
+        {
+            dumpMemoryState(flat);
+        }
+        else
+        {
+            dumpMemoryState(mem);
+        }
+
+        SimulationStats stats = getStats();
+        printSimStats(stats);
+    }
+
+    return 0;
+}
+
+SimulationStats CycleSim::getStats() const
+{
+    SimulationStats stats;
+    memset(&stats, 0, sizeof(SimulationStats));
+
+    stats.totalCycles = cycle;
+
+    if(icache && dcache)
+    {
+        stats.icHits = icache->getHits();
+        stats.icMisses = icache->getMisses();
+        stats.dcHits = dcache->getHits();
+        stats.dcMisses = dcache->getMisses();
+    }
+
+    return stats;
+}
+
+void CycleSim::fillRegisterState(RegisterInfo & reg) const
+{
+    fillRegisterInfo(regs, reg);
+}
+
+size_t CycleSim::getCoreStateSize()
+{
+    size_t size = 0;
+    visitCoreState([&](void *, size_t bytes) { size += bytes; });
+    return size;
+}
+
+//Copies the memory image out of mem into image (MEMORY_SIZE bytes, big-endian).
+static void saveMemoryImage(MemoryStore *mem, uint8_t *image)
+{
+    FlatMemoryStore *flat = dynamic_cast<FlatMemoryStore *>(mem);
+    if(flat)
+    {
+        memcpy(image, flat->bytes(), MEMORY_SIZE);
+        return;
+    }
+
+    memset(image, 0, MEMORY_SIZE);
+
+    uint32_t addr = 0;
+    uint32_t value = 0;
+
+    for( ; FlatMemoryStore::inRange(addr, WORD_SIZE) ; addr += WORD_SIZE)
+    {
+        mem->getMemValue(addr, value, WORD_SIZE);
+        for(int i = 0 ; i < WORD_SIZE ; i++)
+        {
+            image[addr + i] = value >> (8 * (WORD_SIZE - 1 - i));
+        }
+    }
+
+    for( ; FlatMemoryStore::inRange(addr, BYTE_SIZE) ; addr++)
+    {
+        mem->getMemValue(addr, value, BYTE_SIZE);
+        image[addr] = value;
+    }
+}
+
+//The reverse of saveMemoryImage.
+static void loadMemoryImage(MemoryStore *mem, const uint8_t *image)
+{
+    FlatMemoryStore *flat = dynamic_cast<FlatMemoryStore *>(mem);
+    if(flat)
+    {
+        memcpy(flat->bytes(), image, MEMORY_SIZE);
+        return;
+    }
+
+    uint32_t addr = 0;
+
+    for( ; FlatMemoryStore::inRange(addr, WORD_SIZE) ; addr += WORD_SIZE)
+    {
+        uint32_t value = 0;
+        for(int i = 0 ; i < WORD_SIZE ; i++)
+        {
+            value = (value << 8) | image[addr + i];
+        }
+        mem->setMemValue(addr, value, WORD_SIZE);
+    }
+
+    for( ; FlatMemoryStore::inRange(addr, BYTE_SIZE) ; addr++)
+    {
+        mem->setMemValue(addr, image[addr], BYTE_SIZE);
+    }
+}
+
+int CycleSim::saveCheckpoint(const char *fileName)
+{
+    if(!mem)
+    {
+        return -EINVAL;
+    }
+
+    uint64_t sizes[NUM_CKPT_SECTIONS];
+    sizes[CKPT_CORE] = getCoreStateSize();
+    sizes[CKPT_MEMORY] = MEMORY_SIZE;
+    sizes[CKPT_ICACHE] = icache->getStateSize();
+    sizes[CKPT_DCACHE] = dcache->getStateSize();
+    sizes[CKPT_L2CACHE] = l2cache ? l2cache->getStateSize() : 0;
+    sizes[CKPT_PREDICTOR] = predictor.getStateSize();
+
+    Checkpoint checkpoint;
+    int ret = checkpoint.create(fileName, sizes);
+    if(ret)
+    {
+        return ret;
+    }
+
+    checkpoint.header().icConfig = icConfig;
+    checkpoint.header().dcConfig = dcConfig;
+    checkpoint.header().l2Config = l2Config;
+    checkpoint.header().bpConfig = predictor.getConfig();
+
+    uint8_t *core = checkpoint.section(CKPT_CORE);
+    visitCoreState([&](void *ptr, size_t bytes)
+    {
+        memcpy(core, ptr, bytes);
+        core += bytes;
+    });
+
+    saveMemoryImage(mem, checkpoint.section(CKPT_MEMORY));
+    icache->saveState(checkpoint.section(CKPT_ICACHE));
+    dcache->saveState(checkpoint.section(CKPT_DCACHE));
+    if(l2cache)
+    {
+        l2cache->saveState(checkpoint.section(CKPT_L2CACHE));
+    }
+    predictor.saveState(checkpoint.section(CKPT_PREDICTOR));
+
+    checkpoint.close();
+    return 0;
+}
+
+int CycleSim::restoreCheckpoint(Checkpoint & checkpoint, MemoryStore *mainMem)
+{
+    CheckpointHeader & hdr = checkpoint.header();
+    CacheConfig ic = hdr.icConfig;
+    CacheConfig dc = hdr.dcConfig;
+
+    int ret = init(ic, dc, mainMem);
+    if(!ret)
+    {
+        ret = setL2Cache(hdr.l2Config);
+    }
+    if(!ret)
+    {
+        ret = setBranchPredictor(hdr.bpConfig);
+    }
+    if(ret)
+    {
+        return ret;
+    }
+
+    if(checkpoint.sectionSize(CKPT_CORE) != getCoreStateSize() ||
+       checkpoint.sectionSize(CKPT_MEMORY) != MEMORY_SIZE ||
+       checkpoint.sectionSize(CKPT_ICACHE) != icache->getStateSize() ||
+       checkpoint.sectionSize(CKPT_DCACHE) != dcache->getStateSize() ||
+       checkpoint.sectionSize(CKPT_L2CACHE) != (l2cache ? l2cache->getStateSize() : 0) ||
+       checkpoint.sectionSize(CKPT_PREDICTOR) != predictor.getStateSize())
+    {
+        cout << "Checkpoint does not match this simulator" << endl;
+        return -EINVAL;
+    }
+
+    const uint8_t *core = checkpoint.section(CKPT_CORE);
+    visitCoreState([&](void *ptr, size_t bytes)
+    {
+        memcpy(ptr, core, bytes);
+        core += bytes;
+    });
+
+    loadMemoryImage(mem, checkpoint.section(CKPT_MEMORY));
+    icache->loadState(checkpoint.section(CKPT_ICACHE));
+    dcache->loadState(checkpoint.section(CKPT_DCACHE));
+    if(l2cache)
+    {
+        l2cache->loadState(checkpoint.section(CKPT_L2CACHE));
+    }
+    predictor.loadState(checkpoint.section(CKPT_PREDICTOR));
+
+    return 0;
+}
+
+int CycleSim::restoreCheckpoint(const char *fileName, MemoryStore *mainMem)
+{
+    Checkpoint checkpoint;
+    int ret = checkpoint.open(fileName);
+    if(ret)
+    {
+        return ret;
+    }
+
+    return restoreCheckpoint(checkpoint, mainMem);
+}
+
+//The DriverFunctions.h API runs on a default instance.
+static CycleSim defaultSim;
+
+int initSimulator(CacheConfig & icConfig, CacheConfig & dcConfig, MemoryStore *mainMem)
+{
+    return defaultSim.init(icConfig, dcConfig, mainMem);
+}
+
+int runCycles(uint32_t cycles)
+{
+    return defaultSim.runCycles(cycles);
+}
+
+int runTillHalt()
+{
+    return defaultSim.runTillHalt();
+}
+
+int finalizeSimulator()
+{
+    return defaultSim.finalize();
+}
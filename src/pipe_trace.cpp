@@ -0,0 +1,258 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "DriverFunctions.h"
+#include "Disassembler.h"
+#include "PipeTrace.h"
+
+//Renders a pipeline trace (recorded with ./sampled_sim --pipe-trace) for a range of
+//cycles: either as the rows dumpPipeState writes to pipe_state.out, or as a Chrome
+//trace that Perfetto or chrome://tracing can show, with one track per stage and one
+//per kind of stall. Only the records in the range are disassembled.
+
+using namespace std;
+
+//Stall tracks come after the five stages.
+#define NUM_TRACKS (PIPE_TRACE_STAGES + 4)
+
+static const char *const trackNames[NUM_TRACKS] =
+{
+    "IF", "ID", "EX", "MEM", "WB", "I-cache stall", "ID stall", "D-cache stall", "Flush"
+};
+
+//An instruction (or stall) occupying a track, not yet written out.
+struct Slice
+{
+    uint32_t word;
+    uint64_t start;
+    uint64_t end;
+    //Was it held in the last cycle seen, i.e. is the next cycle still the same one?
+    bool held;
+};
+
+class PerfettoWriter
+{
+    public:
+        PerfettoWriter(): events(0)
+        {
+            memset(slices, 0, sizeof(slices));
+        }
+
+        void begin()
+        {
+            cout << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[" << endl;
+            event() << "{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"pipeline\"}}";
+
+            for(int t = 0 ; t < NUM_TRACKS ; t++)
+            {
+                event() << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << t << ",\"name\":\"thread_name\",\"args\":{\"name\":\""
+                        << trackNames[t] << "\"}}";
+                event() << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << t
+                        << ",\"name\":\"thread_sort_index\",\"args\":{\"sort_index\":" << t << "}}";
+            }
+        }
+
+        //Adds cycles [start, end) of rec.
+        void add(const PipeTraceRecord & rec, uint64_t start, uint64_t end)
+        {
+            for(int s = 0 ; s < PIPE_TRACE_STAGES ; s++)
+            {
+                occupy(s, rec.stage(s), start, end, rec.held(s));
+            }
+
+            for(int f = 0 ; f < NUM_TRACKS - PIPE_TRACE_STAGES ; f++)
+            {
+                occupy(PIPE_TRACE_STAGES + f, (rec.flags >> f) & 1, start, end, true);
+            }
+        }
+
+        void end()
+        {
+            for(int t = 0 ; t < NUM_TRACKS ; t++)
+            {
+                close(t);
+            }
+
+            cout << endl << "]}" << endl;
+        }
+
+    private:
+        Slice slices[NUM_TRACKS];
+        uint64_t events;
+
+        ostream & event()
+        {
+            cout << (events++ ? ",\n" : "");
+            return cout;
+        }
+
+        //Track t holds word (0 for nothing) over [start, end).
+        void occupy(int t, uint32_t word, uint64_t start, uint64_t end, bool held)
+        {
+            Slice & slice = slices[t];
+
+            if(!word)
+            {
+                close(t);
+                return;
+            }
+
+            if(slice.word == word && slice.end == start && slice.held)
+            {
+                slice.end = start + 1;
+            }
+            else
+            {
+                close(t);
+                slice.word = word;
+                slice.start = start;
+                slice.end = start + 1;
+            }
+
+            //The same instruction throughout if it is held, a new one every cycle if not.
+            for(uint64_t c = start + 1 ; c < end ; c++)
+            {
+                if(!held)
+                {
+                    close(t);
+                    slice.word = word;
+                    slice.start = c;
+                }
+                slice.end = c + 1;
+            }
+
+            slice.held = held;
+        }
+
+        void close(int t)
+        {
+            Slice & slice = slices[t];
+
+            if(slice.word)
+            {
+                ostream & out = event();
+                out << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << t << ",\"ts\":" << slice.start
+                    << ",\"dur\":" << slice.end - slice.start << ",\"name\":\"";
+
+                if(t < PIPE_TRACE_STAGES)
+                {
+                    out << disassemble(slice.word) << "\",\"args\":{\"word\":\"0x" << hex << setfill('0')
+                        << setw(8) << slice.word << dec << setfill(' ') << "\"}}";
+                }
+                else
+                {
+                    out << trackNames[t] << "\"}";
+                }
+            }
+
+            memset(&slice, 0, sizeof(slice));
+        }
+};
+
+//Same format as dumpPipeState.
+void printRows(const PipeTraceRecord & rec, uint64_t start, uint64_t end)
+{
+    string text[PIPE_TRACE_STAGES];
+    for(int s = 0 ; s < PIPE_TRACE_STAGES ; s++)
+    {
+        text[s] = disassemble(rec.stage(s));
+    }
+
+    string line(131, '-');
+    for(uint64_t c = start ; c < end ; c++)
+    {
+        cout << "Cycle: " << c << "\n" << line << "\n";
+        for(int s = 0 ; s < PIPE_TRACE_STAGES ; s++)
+        {
+            cout << "| " << left << setw(23) << text[s] << " ";
+        }
+        cout << "|\n" << line << "\n";
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t from = 0;
+    uint64_t to = UINT64_MAX;
+    bool perfetto = false;
+
+    int argi = 1;
+    for( ; argi < argc - 1 ; argi++)
+    {
+        if(strcmp(argv[argi], "--perfetto") == 0)
+        {
+            perfetto = true;
+        }
+        else if(strcmp(argv[argi], "--from") == 0 && argi + 1 < argc - 1)
+        {
+            from = strtoull(argv[++argi], NULL, 0);
+        }
+        else if(strcmp(argv[argi], "--to") == 0 && argi + 1 < argc - 1)
+        {
+            to = strtoull(argv[++argi], NULL, 0);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if(argi != argc - 1 || from > to)
+    {
+        cout << "Usage: ./pipe_trace [--from <cycle>] [--to <cycle>] [--perfetto] <trace file>" << endl;
+        return -EINVAL;
+    }
+
+    PipeTraceReader trace;
+    if(trace.open(argv[argc - 1]))
+    {
+        return -EBADF;
+    }
+
+    ios::sync_with_stdio(false);
+
+    PerfettoWriter writer;
+    if(perfetto)
+    {
+        writer.begin();
+    }
+
+    PipeTraceRecord rec;
+    while(trace.next(rec))
+    {
+        uint64_t start = rec.state.cycle;
+        uint64_t end = start + rec.cycles;
+
+        if(start > to)
+        {
+            break;
+        }
+
+        //Cut the run down to the range.
+        start = start < from ? from : start;
+        end = end > to + 1 && to != UINT64_MAX ? to + 1 : end;
+        if(start >= end)
+        {
+            continue;
+        }
+
+        if(perfetto)
+        {
+            writer.add(rec, start, end);
+        }
+        else
+        {
+            printRows(rec, start, end);
+        }
+    }
+
+    if(perfetto)
+    {
+        writer.end();
+    }
+
+    return 0;
+}
@@ -0,0 +1,865 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "MemoryStore.h"
+#include "FlatMemoryStore.h"
+#include "ProgramLoader.h"
+#include "CycleSim.h"
+#include "FunctionalSim.h"
+#include "StateHash.h"
+#include "Disassembler.h"
+
+//Sampled simulation: estimates the statistics of ./cycle_sim for programs too long to
+//run in detail. The run is cut into periods of --period instructions. Each period
+//starts with a detailed window on the cycle simulator - --warmup instructions to
+//refill the pipeline, then --measure instructions whose CPI is recorded as one
+//sample - and the rest of the period is fast-forwarded on the functional simulator.
+//
+//The cycle simulator's caches are fed every fetch, load and store made during the
+//fast-forward (functional warming), so every detailed window starts with the caches
+//in the state the full detailed run would have left them in, and their hit and miss
+//counts cover the whole run. Only the cycle count is estimated from the samples:
+//mean CPI times the number of instructions, with a confidence interval from the
+//spread of the samples.
+
+using namespace std;
+
+//Cycles to fill the five-stage pipeline before the first instruction retires.
+#define PIPELINE_FILL 4
+
+//Two-sided 95% confidence.
+#define CONFIDENCE_Z 1.96
+
+//Pipeline trace records buffered for the writer thread when streaming (32 MB).
+#define PIPE_TRACE_STREAM_RECORDS (1 << 20)
+
+struct SamplingConfig
+{
+    uint64_t period;
+    uint64_t warmup;
+    uint64_t measure;
+};
+
+struct SamplingResult
+{
+    uint64_t instructions;
+    uint64_t detailedInstructions;
+    //CPI of every full measured window.
+    vector<double> samples;
+    //Cycles of all detailed windows together. Exact for programs too short to give
+    //a single full sample, as those end in the first window.
+    uint64_t detailedCycles;
+    SimulationStats caches;
+    //Zero without an L2.
+    uint32_t l2Hits;
+    uint32_t l2Misses;
+    //Only ever non-zero for D-caches with MSHRs or critical word first.
+    uint32_t dcMerged;
+    uint32_t mshrStalls;
+    //Branch prediction, over the detailed windows only. All zero without a predictor.
+    uint32_t branches;
+    uint32_t mispredicts;
+    uint32_t speculated;
+    uint32_t mispredictCycles;
+    uint32_t btbHits;
+    uint32_t btbMisses;
+};
+
+//Parses <size>:<block size>:<ways>:<miss latency>[:<MSHRs>[:<word cycles>]], where
+//ways is a power of two or "full".
+int parseCacheArg(const char *arg, CacheConfig & cfg)
+{
+    char buf[128];
+    strncpy(buf, arg, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    char *fields[6] = { NULL, NULL, NULL, NULL, NULL, NULL };
+    int numFields = 0;
+    for(char *tok = strtok(buf, ":") ; tok && numFields < 6 ; tok = strtok(NULL, ":"))
+    {
+        fields[numFields++] = tok;
+    }
+
+    if(numFields < 4)
+    {
+        return -EINVAL;
+    }
+
+    cfg.cacheSize = strtoul(fields[0], NULL, 0);
+    cfg.blockSize = strtoul(fields[1], NULL, 0);
+    cfg.missLatency = strtoul(fields[3], NULL, 0);
+    cfg.replacement = REPLACE_LRU;
+    cfg.mshrs = fields[4] ? strtoul(fields[4], NULL, 0) : 0;
+    cfg.wordCycles = fields[5] ? strtoul(fields[5], NULL, 0) : 0;
+
+    if(strcmp(fields[2], "full") == 0)
+    {
+        cfg.type = FULLY_ASSOC;
+    }
+    else
+    {
+        cfg.type = N_WAY_SET_ASSOC;
+        cfg.associativity = strtoul(fields[2], NULL, 0);
+    }
+
+    uint32_t ways = getCacheWays(cfg);
+    bool powersOfTwo = cfg.blockSize && !(cfg.blockSize & (cfg.blockSize - 1)) &&
+                       ways && !(ways & (ways - 1)) &&
+                       cfg.cacheSize && !(cfg.cacheSize & (cfg.cacheSize - 1));
+    if(!powersOfTwo || cfg.cacheSize < cfg.blockSize * ways || cfg.mshrs > MAX_MSHRS)
+    {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+//Parses <non-inclusive|inclusive|exclusive>.
+int parseInclusionArg(const char *arg, InclusionPolicy & policy)
+{
+    static const char *const names[] = { "non-inclusive", "inclusive", "exclusive" };
+
+    for(int i = 0 ; i < static_cast<int>(sizeof(names) / sizeof(names[0])) ; i++)
+    {
+        if(strcmp(arg, names[i]) == 0)
+        {
+            policy = static_cast<InclusionPolicy>(i);
+            return 0;
+        }
+    }
+
+    return -EINVAL;
+}
+
+//Parses <none|not-taken|bimodal|gshare|tournament>[:<entries>[:<history bits>[:<BTB
+//entries>]]].
+int parsePredictorArg(const char *arg, PredictorConfig & cfg)
+{
+    static const char *const names[] = { "none", "not-taken", "bimodal", "gshare", "tournament" };
+
+    char buf[128];
+    strncpy(buf, arg, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    char *fields[4] = { NULL, NULL, NULL, NULL };
+    int numFields = 0;
+    for(char *tok = strtok(buf, ":") ; tok && numFields < 4 ; tok = strtok(NULL, ":"))
+    {
+        fields[numFields++] = tok;
+    }
+
+    if(!numFields)
+    {
+        return -EINVAL;
+    }
+
+    cfg = PredictorConfig();
+
+    int type = 0;
+    int numTypes = sizeof(names) / sizeof(names[0]);
+    while(type < numTypes && strcmp(fields[0], names[type]) != 0)
+    {
+        type++;
+    }
+
+    if(type == numTypes)
+    {
+        return -EINVAL;
+    }
+
+    cfg.type = static_cast<PredictorType>(type);
+    cfg.entries = fields[1] ? strtoul(fields[1], NULL, 0) : cfg.entries;
+    cfg.historyBits = fields[2] ? strtoul(fields[2], NULL, 0) : cfg.historyBits;
+    cfg.btbEntries = fields[3] ? strtoul(fields[3], NULL, 0) : cfg.btbEntries;
+
+    //Checked again by the simulator, but it's nicer to hear about it here.
+    BranchPredictor check;
+    return check.init(cfg);
+}
+
+//Copies the cycle simulator's totals into result.
+void getResultStats(CycleSim & sim, SamplingResult & result)
+{
+    const BranchPredictor & predictor = sim.getBranchPredictor();
+    Cache *l2cache = sim.getL2Cache();
+
+    result.caches = sim.getStats();
+    result.l2Hits = l2cache ? l2cache->getHits() : 0;
+    result.l2Misses = l2cache ? l2cache->getMisses() : 0;
+    result.dcMerged = sim.getDCacheMerged();
+    result.mshrStalls = sim.getMshrStallCycles();
+    result.branches = predictor.getLookups();
+    result.mispredicts = predictor.getMispredicts();
+    result.speculated = sim.getSpeculatedBranches();
+    result.mispredictCycles = sim.getMispredictCycles();
+    result.btbHits = predictor.getBtbHits();
+    result.btbMisses = predictor.getBtbMisses();
+}
+
+//Runs the program in mem to the end, alternating between detailed windows on sim and
+//functional fast-forward. sim must have been initialised on mem. profiler, if not
+//NULL, is given the fast-forwarded instructions as well.
+int runSampled(CycleSim & sim, FlatMemoryStore *mem, const SamplingConfig & cfg, SamplingResult & result,
+               Profiler *profiler)
+{
+    FunctionalSim functional;
+    functional.init(mem);
+    functional.setCacheWarming(sim.getICache(), sim.getDCache());
+    functional.setProfiler(profiler);
+
+    ArchState state;
+    memset(&state, 0, sizeof(ArchState));
+
+    uint64_t fastForward = cfg.period - cfg.warmup - cfg.measure;
+    uint64_t fastForwarded = 0;
+    int ret = 0;
+
+    while(true)
+    {
+        //Detailed window...
+        sim.setArchState(state);
+
+        uint32_t startCycle = sim.getStats().totalCycles;
+        ret = sim.runInstructions(cfg.warmup);
+
+        uint32_t measureCycle = sim.getStats().totalCycles;
+        uint64_t measureRetired = sim.getRetired();
+        if(!ret && !sim.isHalted())
+        {
+            ret = sim.runInstructions(cfg.measure);
+        }
+
+        if(!ret && sim.getRetired() - measureRetired == cfg.measure)
+        {
+            uint32_t cycles = sim.getStats().totalCycles - measureCycle;
+            result.samples.push_back(static_cast<double>(cycles) / cfg.measure);
+        }
+
+        if(!ret && !sim.isHalted())
+        {
+            ret = sim.drain();
+        }
+
+        result.detailedCycles += sim.getStats().totalCycles - startCycle;
+
+        if(ret || sim.isHalted())
+        {
+            break;
+        }
+
+        if(!fastForward)
+        {
+            //Nothing to fast-forward, the next window starts right away.
+            sim.getArchState(state);
+            continue;
+        }
+
+        //...and fast-forward. Memory has to be up to date for the functional
+        //simulator, and the cache contents for the next detailed window.
+        sim.getArchState(state);
+        sim.writeBackCaches();
+
+        functional.setArchState(state);
+        uint64_t before = functional.getInstructionCount();
+        ret = functional.runInstructions(fastForward);
+        fastForwarded += functional.getInstructionCount() - before;
+
+        if(ret || functional.isHalted())
+        {
+            //Don't count the end of the program as an instruction.
+            fastForwarded -= functional.isHalted() ? 1 : 0;
+            break;
+        }
+
+        functional.getArchState(state);
+        sim.reloadCaches();
+    }
+
+    sim.writeBackCaches();
+
+    result.detailedInstructions = sim.getRetired();
+    result.instructions = fastForwarded + result.detailedInstructions;
+    getResultStats(sim, result);
+    return ret;
+}
+
+//The hashes only follow what instructions retire with, not what the cycle simulator
+//does with it. Once both have halted, checks that its registers and (with the caches
+//written back) memory really are those of the functional simulator, and reports
+//whatever differs.
+bool checkFinalState(CycleSim & sim, MemoryStore *mem, const FunctionalSim & ref, FlatMemoryStore *refMem)
+{
+    ArchState simState;
+    ArchState refState;
+    sim.getArchState(simState);
+    ref.getArchState(refState);
+
+    //The last byte of memory can't be accessed (see inMemoryRange) and is taken as zero.
+    vector<uint8_t> simBytes(MEMORY_SIZE, 0);
+    vector<uint8_t> refBytes(MEMORY_SIZE, 0);
+    sim.writeBackCaches();
+    mem->readBlock(0, &simBytes[0], MEMORY_SIZE - 1);
+    refMem->readBlock(0, &refBytes[0], MEMORY_SIZE - 1);
+
+    bool same = simBytes == refBytes;
+    for(uint32_t r = 1 ; r < NUM_REGS ; r++)
+    {
+        same = same && simState.regs[r] == refState.regs[r];
+    }
+
+    if(same)
+    {
+        return true;
+    }
+
+    cout << "Lockstep mismatch in the final state, after " << sim.getRetired() << " instructions" << endl;
+    cout << hex << setfill('0');
+
+    for(uint32_t r = 1 ; r < NUM_REGS ; r++)
+    {
+        if(simState.regs[r] != refState.regs[r])
+        {
+            cout << "  " << left << setfill(' ') << setw(6) << getRegName(r) << right << setfill('0')
+                 << "cycle 0x" << setw(8) << simState.regs[r] << ", functional 0x" << setw(8)
+                 << refState.regs[r] << endl;
+        }
+    }
+
+    for(uint32_t addr = 0 ; addr < MEMORY_SIZE ; addr += WORD_SIZE)
+    {
+        const uint8_t *a = &simBytes[addr];
+        const uint8_t *b = &refBytes[addr];
+        if(memcmp(a, b, WORD_SIZE))
+        {
+            cout << "  0x" << setw(4) << addr << ": cycle 0x" << setw(8)
+                 << ((a[0] << 24) | (a[1] << 16) | (a[2] << 8) | a[3]) << ", functional 0x" << setw(8)
+                 << ((b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3]) << endl;
+        }
+    }
+
+    cout << dec << setfill(' ');
+    return false;
+}
+
+//Lockstep mode: runs the whole program in detail with a functional simulator on its
+//own copy of the program alongside, as a reference. After every instruction the
+//reference retires (a branch and its delay slot together) the cycle simulator is run
+//until it has retired as many, and the hashes of their architectural state are
+//compared (see StateHash.h). The first difference is reported with the registers
+//and memory words that differ, and stops the run. At the end the actual registers
+//and memory of both are compared as well (see checkFinalState).
+int runLockstep(CycleSim & sim, MemoryStore *mem, const char *fileName)
+{
+    FlatMemoryStore *refMem = new FlatMemoryStore();
+    if(loadProgram(fileName, refMem))
+    {
+        delete refMem;
+        return -EBADF;
+    }
+
+    StateHash simHash;
+    StateHash refHash;
+    if(simHash.init(mem) || refHash.init(refMem))
+    {
+        delete refMem;
+        return -EBADF;
+    }
+
+    FunctionalSim ref;
+    ref.init(refMem);
+    ref.setStateHash(&refHash);
+    sim.setStateHash(&simHash);
+
+    int ret = 0;
+    bool diverged = false;
+
+    while(!ret && !ref.isHalted())
+    {
+        ret = ref.runInstructions(1);
+        if(ret)
+        {
+            break;
+        }
+
+        uint64_t behind = refHash.getRetired() - simHash.getRetired();
+        if(behind)
+        {
+            ret = sim.runInstructions(behind);
+        }
+
+        if(ref.isHalted() && !ret)
+        {
+            //The cycle simulator must now reach the end of the program too.
+            ret = sim.runTillHalt();
+        }
+
+        if(ret)
+        {
+            //The cycle simulator fetches ahead, so it can fail on an instruction
+            //the reference hasn't got to.
+            break;
+        }
+
+        diverged = simHash.getRetired() != refHash.getRetired() || simHash.get() != refHash.get() ||
+                   simHash.getLastPC() != refHash.getLastPC();
+        if(diverged)
+        {
+            break;
+        }
+    }
+
+    sim.setStateHash(NULL);
+
+    if(diverged)
+    {
+        cout << "Lockstep mismatch at cycle " << sim.getStats().totalCycles << ", after "
+             << simHash.getRetired() << " instructions (functional: " << refHash.getRetired() << ")" << endl;
+        cout << hex << setfill('0');
+        cout << "  PC:   cycle 0x" << setw(8) << simHash.getLastPC() << ", functional 0x" << setw(8)
+             << refHash.getLastPC() << endl;
+
+        for(uint32_t r = 1 ; r < NUM_REGS ; r++)
+        {
+            if(simHash.getReg(r) != refHash.getReg(r))
+            {
+                cout << "  " << left << setfill(' ') << setw(6) << getRegName(r) << right << setfill('0')
+                     << "cycle 0x" << setw(8) << simHash.getReg(r) << ", functional 0x" << setw(8)
+                     << refHash.getReg(r) << endl;
+            }
+        }
+
+        for(uint32_t addr = 0 ; addr < MEMORY_SIZE ; addr += WORD_SIZE)
+        {
+            if(simHash.getWord(addr) != refHash.getWord(addr))
+            {
+                cout << "  0x" << setw(4) << addr << ": cycle 0x" << setw(8) << simHash.getWord(addr)
+                     << ", functional 0x" << setw(8) << refHash.getWord(addr) << endl;
+            }
+        }
+
+        cout << dec << setfill(' ');
+        ret = ret ? ret : -EINVAL;
+    }
+    else if(!ret && !checkFinalState(sim, mem, ref, refMem))
+    {
+        ret = -EINVAL;
+    }
+    else if(!ret)
+    {
+        cout << "Lockstep:           " << refHash.getRetired() << " instructions matched" << endl;
+    }
+
+    delete refMem;
+    return ret;
+}
+
+void printResult(const SamplingResult & result, bool sampled, bool predicted, bool l2)
+{
+    const SimulationStats & stats = result.caches;
+    size_t n = result.samples.size();
+
+    cout << "Instructions:       " << result.instructions << endl;
+
+    if(!sampled)
+    {
+        cout << "Total cycles:       " << stats.totalCycles << endl;
+    }
+    else if(!n)
+    {
+        //The program ended in the first detailed window.
+        cout << "Detailed:           " << result.detailedInstructions << " instructions" << endl;
+        cout << "Total cycles:       " << result.detailedCycles << " (exact, no fast-forward)" << endl;
+    }
+    else
+    {
+        double mean = 0;
+        for(size_t i = 0 ; i < n ; i++)
+        {
+            mean += result.samples[i];
+        }
+        mean /= n;
+
+        double var = 0;
+        for(size_t i = 0 ; i < n ; i++)
+        {
+            var += (result.samples[i] - mean) * (result.samples[i] - mean);
+        }
+        var = n > 1 ? var / (n - 1) : 0;
+
+        double cpiError = CONFIDENCE_Z * sqrt(var / n);
+        //The end of the program still has to go down the pipeline.
+        double instructions = static_cast<double>(result.instructions + 1);
+
+        cout << "Detailed:           " << result.detailedInstructions << " instructions" << endl;
+        cout << "Samples:            " << n << endl;
+        cout << fixed << setprecision(4);
+        cout << "CPI:                " << mean << " +/- " << cpiError << " (95%)" << endl;
+        cout << setprecision(0);
+        cout << "Total cycles:       " << mean * instructions + PIPELINE_FILL << " +/- "
+             << cpiError * instructions << " (95%)" << endl;
+
+        if(n < 2)
+        {
+            cout << "Too few samples for a confidence interval, use a shorter --period" << endl;
+        }
+        else if(mean > 0 && cpiError / mean > 0.03)
+        {
+            //Samples needed for +/-3% at the same spread.
+            double cv = sqrt(var) / mean;
+            double needed = ceil(pow(CONFIDENCE_Z * cv / 0.03, 2));
+            cout << "Error above 3%, about " << needed << " samples are needed" << endl;
+        }
+        cout.unsetf(ios::floatfield);
+    }
+
+    cout << "I-cache hits:       " << stats.icHits << endl;
+    cout << "I-cache misses:     " << stats.icMisses << endl;
+    cout << "D-cache hits:       " << stats.dcHits << endl;
+    cout << "D-cache misses:     " << stats.dcMisses << endl;
+
+    if(l2)
+    {
+        cout << "L2 hits:            " << result.l2Hits << endl;
+        cout << "L2 misses:          " << result.l2Misses << endl;
+    }
+
+    if(result.dcMerged || result.mshrStalls)
+    {
+        cout << "D-cache merged:     " << result.dcMerged << endl;
+        cout << "MSHR stall cycles:  " << result.mshrStalls << endl;
+    }
+
+    if(predicted)
+    {
+        cout << "Branches:           " << result.branches << endl;
+        cout << "Mispredicts:        " << result.mispredicts << endl;
+        cout << "Speculated:         " << result.speculated << endl;
+        cout << "Mispredict cycles:  " << result.mispredictCycles << endl;
+        cout << "BTB hits:           " << result.btbHits << endl;
+        cout << "BTB misses:         " << result.btbMisses << endl;
+    }
+}
+
+void printUsage()
+{
+    cout << "Usage: ./sampled_sim [options] <file name>" << endl
+         << "  --period <n>      instructions per sampling period (default: 100000)" << endl
+         << "  --warmup <n>      detailed instructions before each sample (default: 2000)" << endl
+         << "  --measure <n>     instructions per sample (default: 1000)" << endl
+         << "  --ic, --dc <size>:<block size>:<ways|full>:<miss latency>[:<MSHRs>[:<word cycles>]]" << endl
+         << "                    cache configurations (default: 1024:64:1:5); MSHRs make the" << endl
+         << "                    D-cache non-blocking, word cycles turn on critical word first" << endl
+         << "  --l2 <size>:<block size>:<ways|full>:<miss latency>  add a unified L2 cache; the" << endl
+         << "                    L1 miss latencies are then the L2 hit time" << endl
+         << "  --l2-policy <non-inclusive|inclusive|exclusive>  which blocks the L2 shares with" << endl
+         << "                    the L1 caches (default: non-inclusive)" << endl
+         << "  --bp <none|not-taken|bimodal|gshare|tournament>[:<entries>[:<history bits>[:<BTB" << endl
+         << "                    entries>]]]  predict branches that would wait in ID for their" << endl
+         << "                    operands (default: none, table defaults 1024:8:64); branch" << endl
+         << "                    counts only cover the detailed instructions" << endl
+         << "  --detailed        run everything in detail instead, to check the estimate" << endl
+         << "  --lockstep        run everything in detail, checking the architectural state" << endl
+         << "                    against the functional simulator after every instruction" << endl
+         << "  --dumps           with --detailed or --lockstep, write the pipe_state.out," << endl
+         << "                    reg_state.out, mem_state.out and sim_stats.out dumps of" << endl
+         << "                    ./cycle_sim" << endl
+         << "  --save-checkpoint <file>  with --detailed, save a checkpoint of the cycle" << endl
+         << "                    simulator to a file once it reaches the cycle given by --at," << endl
+         << "                    then carry on to the end" << endl
+         << "  --at <cycle>      the cycle for --save-checkpoint" << endl
+         << "  --restore <file>  with --detailed, carry on from a checkpoint instead of the" << endl
+         << "                    start of the program; the caches and branch predictor are" << endl
+         << "                    the checkpoint's" << endl
+         << "  --pipe-trace <file>  write the pipeline state of every detailed cycle to a trace" << endl
+         << "                    file for ./pipe_trace" << endl
+         << "  --pipe-history <n>   with --pipe-trace, only write the last n runs of cycles, at" << endl
+         << "                    the end" << endl
+         << "  --profile <file>  write per-PC counts to a file, and call stacks weighted by" << endl
+         << "                    cycles (instructions plus stall cycles) to <file>.folded" << endl
+         << "  --stats <file>    write the cycle simulator's statistics and CPI stack, over" << endl
+         << "                    the detailed cycles only, to a file" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    SamplingConfig cfg;
+    cfg.period = 100000;
+    cfg.warmup = 2000;
+    cfg.measure = 1000;
+    bool detailed = false;
+    bool lockstep = false;
+    bool dumps = false;
+    const char *pipeTraceFile = NULL;
+    size_t pipeHistory = 0;
+    const char *profileFile = NULL;
+    const char *statsFile = NULL;
+    const char *checkpointFile = NULL;
+    const char *restoreFile = NULL;
+    uint32_t checkpointCycle = 0;
+    bool checkpointAt = false;
+
+    //Defaults match test/example_driver.cpp.
+    CacheConfig icConfig;
+    icConfig.cacheSize = 1024;
+    icConfig.blockSize = 64;
+    icConfig.type = DIRECT_MAPPED;
+    icConfig.missLatency = 5;
+    CacheConfig dcConfig = icConfig;
+    CacheConfig l2Config = CacheConfig();
+    InclusionPolicy l2Policy = NON_INCLUSIVE;
+    PredictorConfig bpConfig;
+
+    int argi = 1;
+    for( ; argi < argc - 1 ; argi++)
+    {
+        const char *opt = argv[argi];
+        int ret = 0;
+
+        if(strcmp(opt, "--detailed") == 0)
+        {
+            detailed = true;
+            continue;
+        }
+
+        if(strcmp(opt, "--lockstep") == 0)
+        {
+            detailed = lockstep = true;
+            continue;
+        }
+
+        if(strcmp(opt, "--dumps") == 0)
+        {
+            dumps = true;
+            continue;
+        }
+
+        if(argi + 1 >= argc - 1)
+        {
+            break;
+        }
+
+        const char *arg = argv[++argi];
+
+        if(strcmp(opt, "--period") == 0)
+        {
+            cfg.period = strtoull(arg, NULL, 0);
+        }
+        else if(strcmp(opt, "--warmup") == 0)
+        {
+            cfg.warmup = strtoull(arg, NULL, 0);
+        }
+        else if(strcmp(opt, "--measure") == 0)
+        {
+            cfg.measure = strtoull(arg, NULL, 0);
+        }
+        else if(strcmp(opt, "--ic") == 0)
+        {
+            ret = parseCacheArg(arg, icConfig);
+        }
+        else if(strcmp(opt, "--dc") == 0)
+        {
+            ret = parseCacheArg(arg, dcConfig);
+        }
+        else if(strcmp(opt, "--l2") == 0)
+        {
+            ret = parseCacheArg(arg, l2Config);
+        }
+        else if(strcmp(opt, "--l2-policy") == 0)
+        {
+            ret = parseInclusionArg(arg, l2Policy);
+        }
+        else if(strcmp(opt, "--bp") == 0)
+        {
+            ret = parsePredictorArg(arg, bpConfig);
+        }
+        else if(strcmp(opt, "--pipe-trace") == 0)
+        {
+            pipeTraceFile = arg;
+        }
+        else if(strcmp(opt, "--profile") == 0)
+        {
+            profileFile = arg;
+        }
+        else if(strcmp(opt, "--stats") == 0)
+        {
+            statsFile = arg;
+            ret = SIM_STATS_ENABLED ? 0 : -EINVAL;
+        }
+        else if(strcmp(opt, "--save-checkpoint") == 0)
+        {
+            checkpointFile = arg;
+        }
+        else if(strcmp(opt, "--at") == 0)
+        {
+            checkpointCycle = strtoul(arg, NULL, 0);
+            checkpointAt = true;
+        }
+        else if(strcmp(opt, "--restore") == 0)
+        {
+            restoreFile = arg;
+        }
+        else if(strcmp(opt, "--pipe-history") == 0)
+        {
+            pipeHistory = strtoull(arg, NULL, 0);
+            ret = pipeHistory ? 0 : -EINVAL;
+        }
+        else
+        {
+            ret = -EINVAL;
+        }
+
+        if(ret)
+        {
+            cout << "Invalid argument " << opt << " " << arg << endl;
+            return -EINVAL;
+        }
+    }
+
+    if(argi != argc - 1 || !cfg.measure || cfg.period < cfg.warmup + cfg.measure || (dumps && !detailed) ||
+       (!checkpointFile != !checkpointAt) || ((checkpointFile || restoreFile) && (!detailed || lockstep)))
+    {
+        printUsage();
+        return -EINVAL;
+    }
+
+    //Owned by main itself, so that every way out of it frees them.
+    FlatMemoryStore mem;
+    unique_ptr<PipeTraceBuffer> pipeTrace;
+
+    if(loadProgram(argv[argc - 1], &mem))
+    {
+        return -EBADF;
+    }
+
+    CycleSim sim;
+    sim.setDumpsEnabled(dumps);
+    l2Config.inclusion = l2Policy;
+    if(sim.init(icConfig, dcConfig, &mem) || sim.setL2Cache(l2Config) || sim.setBranchPredictor(bpConfig))
+    {
+        return -EINVAL;
+    }
+
+    //The checkpoint brings its own memory image, caches and predictor.
+    if(restoreFile && sim.restoreCheckpoint(restoreFile, &mem))
+    {
+        return -EINVAL;
+    }
+
+    if(pipeTraceFile)
+    {
+        pipeTrace.reset(new PipeTraceBuffer(pipeHistory ? pipeHistory : PIPE_TRACE_STREAM_RECORDS));
+        if(!pipeHistory && pipeTrace->startStreaming(pipeTraceFile))
+        {
+            return -EBADF;
+        }
+        sim.setPipeTrace(pipeTrace.get());
+    }
+
+    Profiler *profiler = NULL;
+    if(profileFile)
+    {
+        profiler = new Profiler();
+        sim.setProfiler(profiler);
+    }
+
+    StatsRegistry *stats = NULL;
+    if(statsFile)
+    {
+        stats = new StatsRegistry();
+        sim.setStats(stats);
+    }
+
+    SamplingResult result;
+    result.instructions = 0;
+    result.detailedInstructions = 0;
+    result.detailedCycles = 0;
+    result.l2Hits = 0;
+    result.l2Misses = 0;
+    result.dcMerged = 0;
+    result.mshrStalls = 0;
+    result.branches = 0;
+    result.mispredicts = 0;
+    result.speculated = 0;
+    result.mispredictCycles = 0;
+    result.btbHits = 0;
+    result.btbMisses = 0;
+
+    int ret = 0;
+    if(detailed)
+    {
+        if(checkpointFile)
+        {
+            uint32_t now = sim.getStats().totalCycles;
+            ret = checkpointCycle > now ? sim.runCycles(checkpointCycle - now) : 0;
+            ret = ret ? ret : sim.saveCheckpoint(checkpointFile);
+        }
+        if(!ret)
+        {
+            ret = lockstep ? runLockstep(sim, &mem, argv[argc - 1]) : sim.runTillHalt();
+        }
+        if(!ret && dumps)
+        {
+            ret = sim.finalize();
+        }
+        result.instructions = result.detailedInstructions = sim.getRetired();
+        getResultStats(sim, result);
+    }
+    else
+    {
+        ret = runSampled(sim, &mem, cfg, result, profiler);
+    }
+
+    //A restored run has the checkpoint's configuration rather than the options'.
+    bool predicted = sim.getBranchPredictor().getConfig().type != PREDICT_NONE;
+    printResult(result, !detailed, predicted, sim.getL2Cache() != NULL);
+
+    if(profiler)
+    {
+        uint32_t cycles = PROF_MASK(PROF_INSTRUCTIONS) | PROF_MASK(PROF_STALL_CYCLES);
+        ret = profiler->save(profileFile, cycles, cycles) ? -EIO : ret;
+        delete profiler;
+    }
+
+    if(stats)
+    {
+        ofstream out(statsFile);
+        if(!out)
+        {
+            cout << "Could not open statistics file " << statsFile << endl;
+            ret = -EBADF;
+        }
+        else
+        {
+            stats->print(out);
+            out << endl;
+            stats->printCpiStack(out);
+            ret = out ? ret : -EIO;
+        }
+
+        sim.setStats(NULL);
+        delete stats;
+    }
+
+    if(pipeTrace)
+    {
+        sim.setPipeTrace(NULL);
+        if(pipeHistory)
+        {
+            ret = pipeTrace->save(pipeTraceFile) ? -EIO : ret;
+        }
+        pipeTrace->stopStreaming();
+
+        if(pipeTrace->getDropped())
+        {
+            cout << "Pipeline trace:     " << pipeTrace->getDropped() << " records dropped" << endl;
+        }
+    }
+
+    return ret ? -EINVAL : 0;
+}
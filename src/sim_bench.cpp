@@ -0,0 +1,614 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "MemoryStore.h"
+#include "FlatMemoryStore.h"
+#include "ProgramLoader.h"
+#include "FunctionalSim.h"
+#include "CycleSim.h"
+#include "cache.h"
+
+//Measures how fast the simulators themselves run: simulated instructions per second
+//for the functional engines, simulated cycles per second for the cycle simulator and
+//accesses per second for the caches on their own. Every benchmark runs --warmup times
+//untimed and then --reps times timed, and reports the median, spread and coefficient
+//of variation of its rate as CSV. Times are process CPU time, so other processes on
+//the host only show up through the caches they share.
+//
+//Programs are the ones given on the command line, or a built-in kernel (a load, add,
+//store loop over 4 KB of data) if there are none. Loading a program is not timed.
+//
+//With --baseline, the medians are compared against an earlier CSV output and every
+//benchmark that got slower by more than --tolerance percent is reported; the exit
+//status is then 1.
+
+using namespace std;
+
+//Where the built-in kernel keeps its data, and how many words of it.
+#define KERNEL_DATA 0x2000
+#define KERNEL_WORDS 1024
+
+//Cache benchmarks replay the same pseudo-random address stream every run.
+#define CACHE_STREAM_LENGTH (1 << 20)
+#define CACHE_STREAM_PASSES 8
+
+//The functional engines.
+enum FunctionalEngine
+{
+    ENGINE_INTERPRETER,
+    ENGINE_THREADED,
+    ENGINE_JIT
+};
+
+struct Benchmark
+{
+    string name;
+    const char *unit;
+    //Runs once. Returns 0 and sets work and the CPU seconds it took, or an error.
+    function<int(uint64_t & work, double & seconds)> run;
+};
+
+struct BenchResult
+{
+    string name;
+    const char *unit;
+    uint64_t work;
+    vector<double> rates;
+    double median;
+    double min;
+    double max;
+    double mean;
+    //Standard deviation over mean, in percent.
+    double cv;
+};
+
+static double cpuSeconds()
+{
+    timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static uint32_t encodeI(uint8_t opcode, uint8_t rs, uint8_t rt, uint16_t imm)
+{
+    return (static_cast<uint32_t>(opcode) << 26) | (rs << 21) | (rt << 16) | imm;
+}
+
+static uint32_t encodeR(uint8_t funct, uint8_t rs, uint8_t rt, uint8_t rd)
+{
+    return (rs << 21) | (rt << 16) | (rd << 11) | funct;
+}
+
+//Writes the built-in kernel to mem: outer passes over KERNEL_WORDS words, each loaded,
+//added to a running sum, incremented (a load-use stall) and stored back.
+static void writeKernel(MemoryStore *mem, uint32_t outer)
+{
+    vector<uint32_t> code;
+
+    code.push_back(encodeI(OP_LUI, REG_ZERO, REG_T0, outer >> 16));
+    code.push_back(encodeI(OP_ORI, REG_T0, REG_T0, outer & 0xffff));
+    //outer:
+    code.push_back(encodeI(OP_ADDIU, REG_ZERO, REG_T1, KERNEL_DATA));
+    code.push_back(encodeI(OP_ADDIU, REG_ZERO, REG_T2, KERNEL_WORDS));
+    //inner:
+    code.push_back(encodeI(OP_LW, REG_T1, REG_T3, 0));
+    code.push_back(encodeI(OP_ADDIU, REG_T3, REG_T3, 1));
+    code.push_back(encodeR(FUN_ADDU, REG_T4, REG_T3, REG_T4));
+    code.push_back(encodeI(OP_SW, REG_T1, REG_T3, 0));
+    code.push_back(encodeI(OP_ADDIU, REG_T2, REG_T2, 0xffff));
+    code.push_back(encodeI(OP_BNE, REG_T2, REG_ZERO, static_cast<uint16_t>(-6)));
+    code.push_back(encodeI(OP_ADDIU, REG_T1, REG_T1, 4));
+    code.push_back(encodeI(OP_ADDIU, REG_T0, REG_T0, 0xffff));
+    code.push_back(encodeI(OP_BNE, REG_T0, REG_ZERO, static_cast<uint16_t>(-11)));
+    code.push_back(0);
+    code.push_back(MAGIC_DEMARC);
+
+    for(size_t i = 0 ; i < code.size() ; i++)
+    {
+        mem->setMemValue(i * WORD_SIZE, code[i], WORD_SIZE);
+    }
+}
+
+//A program to benchmark: a file, or the kernel (empty fileName) with the given number
+//of outer passes.
+struct BenchProgram
+{
+    string name;
+    string fileName;
+    uint32_t outer;
+
+    int load(FlatMemoryStore *mem) const
+    {
+        if(fileName.empty())
+        {
+            writeKernel(mem, outer);
+            return 0;
+        }
+
+        return loadProgram(fileName.c_str(), mem);
+    }
+};
+
+static int runFunctional(const BenchProgram & prog, FunctionalEngine engine, uint64_t instructions,
+                         uint64_t & work, double & seconds)
+{
+    FlatMemoryStore mem;
+    if(prog.load(&mem))
+    {
+        return -EBADF;
+    }
+
+    FunctionalSim sim;
+    sim.init(&mem);
+
+    double start = cpuSeconds();
+    int ret = 0;
+    switch(engine)
+    {
+        case ENGINE_THREADED:
+            ret = sim.runProgramThreaded();
+            break;
+        case ENGINE_JIT:
+            ret = sim.runProgramJit();
+            break;
+        default:
+            ret = sim.runProgram();
+            break;
+    }
+    seconds = cpuSeconds() - start;
+
+    //The other engines don't count (or not everything), but run the same instructions.
+    work = (engine == ENGINE_INTERPRETER) ? sim.getInstructionCount() : instructions;
+    return ret;
+}
+
+static int runCycle(const BenchProgram & prog, uint64_t & work, double & seconds)
+{
+    FlatMemoryStore mem;
+    if(prog.load(&mem))
+    {
+        return -EBADF;
+    }
+
+    //Defaults match test/example_driver.cpp.
+    CacheConfig config;
+    config.cacheSize = 1024;
+    config.blockSize = 64;
+    config.type = DIRECT_MAPPED;
+    config.missLatency = 5;
+
+    CycleSim sim;
+    sim.setDumpsEnabled(false);
+    if(sim.init(config, config, &mem))
+    {
+        return -EINVAL;
+    }
+
+    double start = cpuSeconds();
+    int ret = sim.runTillHalt();
+    seconds = cpuSeconds() - start;
+
+    work = sim.getStats().totalCycles;
+    return ret;
+}
+
+//Three out of four accesses go to a 512 byte hot spot, the rest anywhere in 16 KB.
+static vector<uint32_t> makeCacheStream()
+{
+    mt19937 rng(375);
+    vector<uint32_t> stream(CACHE_STREAM_LENGTH);
+
+    for(size_t i = 0 ; i < stream.size() ; i++)
+    {
+        uint32_t range = (rng() & 3) ? 512 : 16384;
+        stream[i] = (rng() % range) & ~(WORD_SIZE - 1);
+    }
+
+    return stream;
+}
+
+//Feeds the stream to the cache CACHE_STREAM_PASSES times. The cache and its memory
+//are kept from run to run, so only the first warm-up run starts cold.
+static int runCache(Cache *cache, const vector<uint32_t> & stream, bool write, uint64_t & work,
+                    double & seconds)
+{
+    uint32_t value = 0;
+
+    double start = cpuSeconds();
+    for(int pass = 0 ; pass < CACHE_STREAM_PASSES ; pass++)
+    {
+        for(size_t i = 0 ; i < stream.size() ; i++)
+        {
+            if(write)
+            {
+                cache->setCacheValue(stream[i], i, WORD_SIZE);
+            }
+            else
+            {
+                cache->getCacheValue(stream[i], value, WORD_SIZE);
+            }
+        }
+    }
+    seconds = cpuSeconds() - start;
+
+    work = static_cast<uint64_t>(CACHE_STREAM_PASSES) * stream.size();
+    return 0;
+}
+
+static void summarise(BenchResult & result)
+{
+    vector<double> sorted = result.rates;
+    sort(sorted.begin(), sorted.end());
+
+    size_t n = sorted.size();
+    result.median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+    result.min = sorted.front();
+    result.max = sorted.back();
+
+    double sum = 0;
+    double squares = 0;
+    for(size_t i = 0 ; i < n ; i++)
+    {
+        sum += sorted[i];
+        squares += sorted[i] * sorted[i];
+    }
+
+    result.mean = sum / n;
+    double variance = n > 1 ? (squares - sum * sum / n) / (n - 1) : 0;
+    result.cv = result.mean > 0 ? 100 * sqrt(variance > 0 ? variance : 0) / result.mean : 0;
+}
+
+static int runBenchmark(const Benchmark & bench, unsigned warmup, unsigned reps, BenchResult & result)
+{
+    result.name = bench.name;
+    result.unit = bench.unit;
+    result.rates.clear();
+
+    for(unsigned i = 0 ; i < warmup + reps ; i++)
+    {
+        uint64_t work = 0;
+        double seconds = 0;
+        int ret = bench.run(work, seconds);
+        if(ret)
+        {
+            cerr << bench.name << " failed: " << ret << endl;
+            return ret;
+        }
+
+        if(i >= warmup)
+        {
+            result.work = work;
+            result.rates.push_back(seconds > 0 ? work / seconds : 0);
+        }
+    }
+
+    summarise(result);
+    cerr << left << setw(36) << result.name << right << fixed << setprecision(0) << setw(16) << result.median
+         << " " << result.unit << "  (cv " << setprecision(1) << result.cv << "%)" << endl;
+    return 0;
+}
+
+static void writeResults(ostream & out, const vector<BenchResult> & results)
+{
+    out << "benchmark,unit,work,reps,median,min,max,mean,cv_percent" << endl;
+    out << fixed;
+
+    for(size_t i = 0 ; i < results.size() ; i++)
+    {
+        const BenchResult & r = results[i];
+        out << r.name << "," << r.unit << "," << r.work << "," << r.rates.size() << ","
+            << setprecision(0) << r.median << "," << r.min << "," << r.max << "," << r.mean << ","
+            << setprecision(2) << r.cv << endl;
+    }
+}
+
+//Reads benchmark -> median from an earlier CSV output.
+static int readBaseline(const char *fileName, map<string, double> & baseline)
+{
+    ifstream in(fileName);
+    if(!in)
+    {
+        cout << "Could not open baseline " << fileName << endl;
+        return -EBADF;
+    }
+
+    string line;
+    getline(in, line);
+
+    while(getline(in, line))
+    {
+        stringstream fields(line);
+        string name;
+        string unit;
+        string work;
+        string reps;
+        string median;
+
+        if(getline(fields, name, ',') && getline(fields, unit, ',') && getline(fields, work, ',') &&
+           getline(fields, reps, ',') && getline(fields, median, ','))
+        {
+            baseline[name] = strtod(median.c_str(), NULL);
+        }
+    }
+
+    return 0;
+}
+
+//Reports every benchmark against the baseline. Returns the number that regressed.
+static int compareBaseline(const vector<BenchResult> & results, const map<string, double> & baseline,
+                           double tolerance)
+{
+    int regressions = 0;
+
+    cerr << endl << left << setw(36) << "Benchmark" << right << setw(16) << "Baseline" << setw(16) << "Current"
+         << setw(10) << "Change" << endl;
+
+    for(size_t i = 0 ; i < results.size() ; i++)
+    {
+        const BenchResult & r = results[i];
+        map<string, double>::const_iterator found = baseline.find(r.name);
+        if(found == baseline.end() || found->second <= 0)
+        {
+            cerr << left << setw(36) << r.name << right << setw(16) << "-" << setw(16) << r.median << endl;
+            continue;
+        }
+
+        double change = 100 * (r.median - found->second) / found->second;
+        bool regressed = change < -tolerance;
+        regressions += regressed;
+
+        cerr << left << setw(36) << r.name << right << setprecision(0) << setw(16) << found->second << setw(16)
+             << r.median << setprecision(1) << setw(9) << showpos << change << noshowpos << "%"
+             << (regressed ? "  REGRESSION" : "") << endl;
+    }
+
+    return regressions;
+}
+
+void printUsage()
+{
+    cout << "Usage: ./sim_bench [options] [program files]" << endl
+         << "  --reps <n>           timed runs per benchmark (default: 5)" << endl
+         << "  --warmup <n>         untimed runs before them (default: 1)" << endl
+         << "  --scale <n>          multiplies the length of the built-in kernel (default: 1)" << endl
+         << "  --filter <text>      only run benchmarks whose name contains text" << endl
+         << "  --out <file>         write the CSV results to a file instead of stdout" << endl
+         << "  --baseline <file>    compare against the CSV results of an earlier run" << endl
+         << "  --tolerance <pct>    slowdown allowed against the baseline (default: 10)" << endl
+         << "Without program files, the built-in kernel is run." << endl;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned reps = 5;
+    unsigned warmup = 1;
+    unsigned scale = 1;
+    double tolerance = 10;
+    const char *filter = NULL;
+    const char *outFile = NULL;
+    const char *baselineFile = NULL;
+    vector<BenchProgram> programs;
+
+    for(int i = 1 ; i < argc ; i++)
+    {
+        const char *opt = argv[i];
+
+        if(strncmp(opt, "--", 2) != 0)
+        {
+            BenchProgram prog;
+            const char *slash = strrchr(opt, '/');
+            prog.name = slash ? slash + 1 : opt;
+            prog.fileName = opt;
+            prog.outer = 0;
+            programs.push_back(prog);
+            continue;
+        }
+
+        if(i + 1 >= argc)
+        {
+            printUsage();
+            return -EINVAL;
+        }
+
+        const char *arg = argv[++i];
+        int ret = 0;
+
+        if(strcmp(opt, "--reps") == 0)
+        {
+            reps = strtoul(arg, NULL, 0);
+            ret = reps ? 0 : -EINVAL;
+        }
+        else if(strcmp(opt, "--warmup") == 0)
+        {
+            warmup = strtoul(arg, NULL, 0);
+        }
+        else if(strcmp(opt, "--scale") == 0)
+        {
+            scale = strtoul(arg, NULL, 0);
+            ret = scale ? 0 : -EINVAL;
+        }
+        else if(strcmp(opt, "--filter") == 0)
+        {
+            filter = arg;
+        }
+        else if(strcmp(opt, "--out") == 0)
+        {
+            outFile = arg;
+        }
+        else if(strcmp(opt, "--baseline") == 0)
+        {
+            baselineFile = arg;
+        }
+        else if(strcmp(opt, "--tolerance") == 0)
+        {
+            tolerance = strtod(arg, NULL);
+        }
+        else
+        {
+            ret = -EINVAL;
+        }
+
+        if(ret)
+        {
+            cout << "Invalid argument " << opt << " " << arg << endl;
+            return -EINVAL;
+        }
+    }
+
+    map<string, double> baseline;
+    if(baselineFile && readBaseline(baselineFile, baseline))
+    {
+        return -EBADF;
+    }
+
+    //The functional engines get ten times the passes of the cycle simulator, so that
+    //both run for a similar time.
+    bool kernel = programs.empty();
+    if(kernel)
+    {
+        BenchProgram prog;
+        prog.name = "kernel";
+        prog.outer = 200 * scale;
+        programs.push_back(prog);
+    }
+
+    vector<Benchmark> benches;
+
+    for(size_t p = 0 ; p < programs.size() ; p++)
+    {
+        BenchProgram fast = programs[p];
+        fast.outer *= 10;
+        BenchProgram slow = programs[p];
+
+        //The threaded engine and the JIT are credited with the instructions runProgram counts.
+        uint64_t instructions = 0;
+        double seconds = 0;
+        if(runFunctional(fast, ENGINE_INTERPRETER, 0, instructions, seconds))
+        {
+            return -EINVAL;
+        }
+
+        Benchmark bench;
+        bench.unit = "instructions/s";
+        bench.name = "functional." + fast.name;
+        bench.run = [fast](uint64_t & work, double & secs)
+        {
+            return runFunctional(fast, ENGINE_INTERPRETER, 0, work, secs);
+        };
+        benches.push_back(bench);
+
+        bench.name = "functional_threaded." + fast.name;
+        bench.run = [fast, instructions](uint64_t & work, double & secs)
+        {
+            return runFunctional(fast, ENGINE_THREADED, instructions, work, secs);
+        };
+        benches.push_back(bench);
+
+        bench.name = "functional_jit." + fast.name;
+        bench.run = [fast, instructions](uint64_t & work, double & secs)
+        {
+            return runFunctional(fast, ENGINE_JIT, instructions, work, secs);
+        };
+        benches.push_back(bench);
+
+        bench.unit = "cycles/s";
+        bench.name = "cycle." + slow.name;
+        bench.run = [slow](uint64_t & work, double & secs)
+        {
+            return runCycle(slow, work, secs);
+        };
+        benches.push_back(bench);
+    }
+
+    //Cache benchmarks: a direct-mapped and a two-way 1 KB cache with 64 byte blocks.
+    vector<uint32_t> stream = makeCacheStream();
+    FlatMemoryStore cacheMem;
+    CacheConfig configs[2];
+    const char *configNames[2] = { "direct", "2way" };
+    vector<Cache *> caches;
+
+    for(int c = 0 ; c < 2 ; c++)
+    {
+        configs[c].cacheSize = 1024;
+        configs[c].blockSize = 64;
+        configs[c].type = c ? TWO_WAY_SET_ASSOC : DIRECT_MAPPED;
+        configs[c].missLatency = 5;
+
+        for(int write = 0 ; write < 2 ; write++)
+        {
+            Cache *cache = new Cache(configs[c], &cacheMem);
+            caches.push_back(cache);
+
+            Benchmark bench;
+            bench.unit = "accesses/s";
+            bench.name = string(write ? "cache.write." : "cache.read.") + configNames[c];
+            bench.run = [cache, &stream, write](uint64_t & work, double & secs)
+            {
+                return runCache(cache, stream, write, work, secs);
+            };
+            benches.push_back(bench);
+        }
+    }
+
+    vector<BenchResult> results;
+    int ret = 0;
+
+    for(size_t b = 0 ; b < benches.size() && !ret ; b++)
+    {
+        if(filter && benches[b].name.find(filter) == string::npos)
+        {
+            continue;
+        }
+
+        BenchResult result;
+        ret = runBenchmark(benches[b], warmup, reps, result);
+        if(!ret)
+        {
+            results.push_back(result);
+        }
+    }
+
+    for(size_t c = 0 ; c < caches.size() ; c++)
+    {
+        delete caches[c];
+    }
+
+    if(outFile)
+    {
+        ofstream out(outFile);
+        if(!out)
+        {
+            cout << "Could not open " << outFile << endl;
+            return -EBADF;
+        }
+        writeResults(out, results);
+    }
+    else
+    {
+        writeResults(cout, results);
+    }
+
+    if(ret)
+    {
+        return -EINVAL;
+    }
+
+    if(baselineFile && compareBaseline(results, baseline, tolerance))
+    {
+        return 1;
+    }
+
+    return 0;
+}
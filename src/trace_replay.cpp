@@ -0,0 +1,181 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "MemoryStore.h"
+#include "FlatMemoryStore.h"
+#include "DriverFunctions.h"
+#include "cache.h"
+#include "Trace.h"
+
+//Replays a memory access trace (recorded with ./sim --trace) through one or more
+//split I-cache/D-cache pairs without executing any instructions. All pairs are fed
+//from a single pass over the trace.
+
+using namespace std;
+
+//One I-cache/D-cache pair under evaluation, with its own backing memory.
+struct ReplayTarget
+{
+    string spec;
+    FlatMemoryStore *mem;
+    Cache *icache;
+    Cache *dcache;
+};
+
+//Parses <size>:<block size>:<ways>[:<policy>], where ways is a power of two or
+//"full" and policy is one of lru, plru, random or srrip.
+int parseCacheSpec(const char *spec, CacheConfig & cfg)
+{
+    char buf[128];
+    strncpy(buf, spec, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    char *fields[4] = { NULL, NULL, NULL, NULL };
+    int numFields = 0;
+    for(char *tok = strtok(buf, ":") ; tok && numFields < 4 ; tok = strtok(NULL, ":"))
+    {
+        fields[numFields++] = tok;
+    }
+
+    if(numFields < 3)
+    {
+        return -EINVAL;
+    }
+
+    cfg.cacheSize = strtoul(fields[0], NULL, 0);
+    cfg.blockSize = strtoul(fields[1], NULL, 0);
+    cfg.missLatency = 0;
+    cfg.replacement = REPLACE_LRU;
+
+    if(strcmp(fields[2], "full") == 0)
+    {
+        cfg.type = FULLY_ASSOC;
+    }
+    else
+    {
+        cfg.type = N_WAY_SET_ASSOC;
+        cfg.associativity = strtoul(fields[2], NULL, 0);
+    }
+
+    if(fields[3])
+    {
+        if(strcmp(fields[3], "lru") == 0)
+        {
+            cfg.replacement = REPLACE_LRU;
+        }
+        else if(strcmp(fields[3], "plru") == 0)
+        {
+            cfg.replacement = REPLACE_TREE_PLRU;
+        }
+        else if(strcmp(fields[3], "random") == 0)
+        {
+            cfg.replacement = REPLACE_RANDOM;
+        }
+        else if(strcmp(fields[3], "srrip") == 0)
+        {
+            cfg.replacement = REPLACE_SRRIP;
+        }
+        else
+        {
+            return -EINVAL;
+        }
+    }
+
+    uint32_t ways = getCacheWays(cfg);
+    bool powersOfTwo = cfg.blockSize && !(cfg.blockSize & (cfg.blockSize - 1)) &&
+                       ways && !(ways & (ways - 1)) &&
+                       cfg.cacheSize && !(cfg.cacheSize & (cfg.cacheSize - 1));
+    if(!powersOfTwo || cfg.cacheSize < cfg.blockSize * ways)
+    {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 3)
+    {
+        cout << "Usage: ./trace_replay <trace file> <size>:<block size>:<ways|full>[:<lru|plru|random|srrip>] ..." << endl;
+        return -EINVAL;
+    }
+
+    TraceReader trace;
+    if(trace.open(argv[1]))
+    {
+        return -EBADF;
+    }
+
+    vector<ReplayTarget> targets;
+    for(int i = 2 ; i < argc ; i++)
+    {
+        CacheConfig cfg;
+        if(parseCacheSpec(argv[i], cfg))
+        {
+            cout << "Invalid cache spec " << argv[i] << endl;
+            return -EINVAL;
+        }
+
+        ReplayTarget target;
+        target.spec = argv[i];
+        target.mem = new FlatMemoryStore();
+        target.icache = new Cache(cfg, target.mem);
+        target.dcache = new Cache(cfg, target.mem);
+        targets.push_back(target);
+    }
+
+    TraceRecord rec;
+    uint64_t records = 0;
+    uint32_t value = 0;
+
+    while(trace.next(rec))
+    {
+        records++;
+
+        for(size_t i = 0 ; i < targets.size() ; i++)
+        {
+            switch(rec.type)
+            {
+                case TRACE_IFETCH:
+                    targets[i].icache->getCacheValue(rec.addr, value, rec.size);
+                    break;
+                case TRACE_READ:
+                    targets[i].dcache->getCacheValue(rec.addr, value, rec.size);
+                    break;
+                case TRACE_WRITE:
+                    targets[i].dcache->setCacheValue(rec.addr, 0, rec.size);
+                    break;
+            }
+        }
+    }
+
+    cout << "Replayed " << dec << records << " accesses (" << trace.size() << " bytes)" << endl;
+    cout << left << setw(24) << "config" << right
+         << setw(12) << "icHits" << setw(12) << "icMisses"
+         << setw(12) << "dcHits" << setw(12) << "dcMisses" << endl;
+
+    for(size_t i = 0 ; i < targets.size() ; i++)
+    {
+        SimulationStats stats;
+        memset(&stats, 0, sizeof(stats));
+        stats.icHits = targets[i].icache->getHits();
+        stats.icMisses = targets[i].icache->getMisses();
+        stats.dcHits = targets[i].dcache->getHits();
+        stats.dcMisses = targets[i].dcache->getMisses();
+
+        cout << left << setw(24) << targets[i].spec << right
+             << setw(12) << stats.icHits << setw(12) << stats.icMisses
+             << setw(12) << stats.dcHits << setw(12) << stats.dcMisses << endl;
+
+        delete targets[i].icache;
+        delete targets[i].dcache;
+        delete targets[i].mem;
+    }
+
+    return 0;
+}
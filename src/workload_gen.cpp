@@ -0,0 +1,589 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "MipsDefs.h"
+#include "MemoryStore.h"
+#include "EndianHelpers.h"
+#include "Disassembler.h"
+#include "ProgramLoader.h"
+
+//Generates synthetic workloads in the instruction subset the simulators support:
+//  stream  walks an array of --footprint bytes with a --stride, loading every element
+//          (and storing a running sum back with --write), --iterations times
+//  chase   follows a linked list scattered at random over --footprint bytes, one node
+//          every --stride bytes, for --iterations loads
+//  branch  a loop over a table of flags, with a branch on each flag taken --taken
+//          percent of the time, in a random pattern, --iterations times over the table
+//  llsc    --iterations atomic increments of a counter with LL/SC, where a store
+//          between the LL and the SC makes --contention percent of the attempts fail
+//          and retry
+//Each writes either assembly for bin/mips-linux-gnu-as (then objcopy -O binary, as for
+//test/load_use.asm), or the program image the simulators load directly, or both; the
+//two are the same program. Code starts at 0 and ends with 0xfeedfeed. Data starts at
+//DATA_BASE, and only data that needs initialising is in the image. The same seed
+//always gives the same program.
+
+using namespace std;
+
+//Code has to fit below this.
+#define DATA_BASE 0x1000
+//The llsc counter, and its table of flags after it.
+#define LLSC_COUNTER DATA_BASE
+#define LLSC_FLAGS 1024
+
+enum WorkloadKind
+{
+    WL_STREAM,
+    WL_CHASE,
+    WL_BRANCH,
+    WL_LLSC
+};
+
+struct WorkloadConfig
+{
+    WorkloadKind kind;
+    uint32_t footprint;
+    uint32_t stride;
+    uint32_t iterations;
+    uint32_t taken;
+    uint32_t contention;
+    bool write;
+    uint32_t seed;
+};
+
+//Collects instructions, labels and data, and writes them out as an image or as
+//assembly. Branches go to labels, which are resolved when writing.
+class ProgramBuilder
+{
+    public:
+        int newLabel()
+        {
+            labels.push_back(-1);
+            return labels.size() - 1;
+        }
+
+        void bind(int label)
+        {
+            labels[label] = code.size();
+            lines.push_back("L" + to_string(label) + ":");
+        }
+
+        void aluR(uint8_t funct, uint8_t rd, uint8_t rs, uint8_t rt)
+        {
+            add((rs << 21) | (rt << 16) | (rd << 11) | funct, -1);
+        }
+
+        //Immediate ALU ops, loads and stores. imm is sign or zero extended like the
+        //instruction does it.
+        void immediate(uint8_t opcode, uint8_t rt, uint8_t rs, int32_t imm)
+        {
+            add((static_cast<uint32_t>(opcode) << 26) | (rs << 21) | (rt << 16) | (imm & 0xffff), -1);
+        }
+
+        void branch(uint8_t opcode, uint8_t rs, uint8_t rt, int label)
+        {
+            add((static_cast<uint32_t>(opcode) << 26) | (rs << 21) | (rt << 16), label);
+        }
+
+        void nop()
+        {
+            add(0, -1);
+        }
+
+        //Any 32-bit value, always in two instructions.
+        void loadConst(uint8_t reg, uint32_t value)
+        {
+            immediate(OP_LUI, reg, REG_ZERO, value >> 16);
+            immediate(OP_ORI, reg, reg, value & 0xffff);
+        }
+
+        void halt()
+        {
+            add(MAGIC_DEMARC, -1);
+        }
+
+        //Initialised data at addr, which must be DATA_BASE or after earlier data.
+        void data(uint32_t addr, const vector<uint32_t> & words)
+        {
+            dataWords.resize((addr - DATA_BASE) / WORD_SIZE);
+            dataWords.insert(dataWords.end(), words.begin(), words.end());
+        }
+
+        uint32_t getCodeSize() const
+        {
+            return code.size() * WORD_SIZE;
+        }
+
+        //Big-endian words, like the output of objcopy.
+        int writeImage(const char *fileName)
+        {
+            vector<uint32_t> image = code;
+            resolve(image);
+
+            if(!dataWords.empty())
+            {
+                image.resize(DATA_BASE / WORD_SIZE, 0);
+                image.insert(image.end(), dataWords.begin(), dataWords.end());
+            }
+
+            for(size_t i = 0 ; i < image.size() ; i++)
+            {
+                image[i] = HostToBigEndianWord(image[i]);
+            }
+
+            ofstream out(fileName, ios::binary);
+            out.write(reinterpret_cast<const char *>(image.data()), image.size() * WORD_SIZE);
+            if(!out)
+            {
+                cout << "Could not write " << fileName << endl;
+                return -EIO;
+            }
+
+            return 0;
+        }
+
+        int writeAsm(const char *fileName, const string & comment)
+        {
+            vector<uint32_t> words = code;
+            resolve(words);
+
+            ofstream out(fileName);
+            out << "# " << comment << endl;
+            out << ".set noreorder" << endl;
+
+            size_t next = 0;
+            for(size_t i = 0 ; i < lines.size() ; i++)
+            {
+                if(lines[i].empty())
+                {
+                    out << formatInst(words[next], branchLabels[next]) << endl;
+                    next++;
+                }
+                else
+                {
+                    out << lines[i] << endl;
+                }
+            }
+
+            if(!dataWords.empty())
+            {
+                out << ".org 0x" << hex << DATA_BASE << endl;
+                for(size_t i = 0 ; i < dataWords.size() ; i++)
+                {
+                    out << (i % 8 ? ", " : ".word ") << "0x" << dataWords[i] << (i % 8 == 7 ? "\n" : "");
+                }
+                out << dec << endl;
+            }
+
+            if(!out)
+            {
+                cout << "Could not write " << fileName << endl;
+                return -EIO;
+            }
+
+            return 0;
+        }
+
+    private:
+        vector<uint32_t> code;
+        //Label branched to by each instruction, -1 if none.
+        vector<int> branchLabels;
+        //Instruction index of each label.
+        vector<int> labels;
+        //Label lines, and an empty line for each instruction, in order.
+        vector<string> lines;
+        vector<uint32_t> dataWords;
+
+        void add(uint32_t word, int label)
+        {
+            code.push_back(word);
+            branchLabels.push_back(label);
+            lines.push_back("");
+        }
+
+        //Fills in branch displacements.
+        void resolve(vector<uint32_t> & words) const
+        {
+            for(size_t i = 0 ; i < words.size() ; i++)
+            {
+                if(branchLabels[i] >= 0)
+                {
+                    int32_t offset = labels[branchLabels[i]] - static_cast<int32_t>(i + 1);
+                    words[i] |= offset & 0xffff;
+                }
+            }
+        }
+
+        //Like disassemble, but in the syntax the assembler takes: branches go to
+        //labels and signed immediates are written as such.
+        static string formatInst(uint32_t word, int label)
+        {
+            char buf[64];
+            const char *rs = getRegName((word >> 21) & 0x1f);
+            const char *rt = getRegName((word >> 16) & 0x1f);
+            int32_t simm = static_cast<int16_t>(word & 0xffff);
+            const char *name = NULL;
+
+            if(word == MAGIC_DEMARC)
+            {
+                return ".word 0xfeedfeed";
+            }
+
+            switch(getOpcode(word))
+            {
+                case OP_BEQ:
+                case OP_BNE:
+                    snprintf(buf, sizeof(buf), "%s %s, %s, L%d", getOpcode(word) == OP_BEQ ? "beq" : "bne", rs, rt,
+                             label);
+                    return buf;
+                case OP_ADDI: name = "addi"; break;
+                case OP_ADDIU: name = "addiu"; break;
+                case OP_SLTI: name = "slti"; break;
+                case OP_SLTIU: name = "sltiu"; break;
+                default:
+                    return disassemble(word);
+            }
+
+            snprintf(buf, sizeof(buf), "%s %s, %s, %d", name, rt, rs, simm);
+            return buf;
+        }
+};
+
+//A loop running body count times, with the counter in $t0. count must not be 0.
+template <typename F>
+static void countedLoop(ProgramBuilder & prog, uint32_t count, F body)
+{
+    int top = prog.newLabel();
+    prog.loadConst(REG_T0, count);
+    prog.bind(top);
+    body();
+    prog.immediate(OP_ADDIU, REG_T0, REG_T0, -1);
+    prog.branch(OP_BNE, REG_T0, REG_ZERO, top);
+    prog.nop();
+}
+
+//Loads (and with write, stores back a running sum) every stride bytes from DATA_BASE.
+static void genStream(ProgramBuilder & prog, const WorkloadConfig & cfg)
+{
+    uint32_t end = DATA_BASE + cfg.footprint / cfg.stride * cfg.stride;
+
+    countedLoop(prog, cfg.iterations, [&]()
+    {
+        int inner = prog.newLabel();
+        prog.loadConst(REG_T1, DATA_BASE);
+        prog.loadConst(REG_T2, end);
+        prog.bind(inner);
+        prog.immediate(OP_LW, REG_T3, REG_T1, 0);
+        prog.immediate(OP_ADDIU, REG_T1, REG_T1, cfg.stride);
+        prog.aluR(FUN_ADDU, REG_T4, REG_T4, REG_T3);
+        if(cfg.write)
+        {
+            prog.immediate(OP_SW, REG_T4, REG_T1, -static_cast<int32_t>(cfg.stride));
+        }
+        prog.branch(OP_BNE, REG_T1, REG_T2, inner);
+        prog.nop();
+    });
+
+    prog.halt();
+}
+
+//Every node links to the next in a random cycle through all of them.
+static void genChase(ProgramBuilder & prog, const WorkloadConfig & cfg)
+{
+    uint32_t nodes = cfg.footprint / cfg.stride;
+    vector<uint32_t> order(nodes);
+    for(uint32_t n = 0 ; n < nodes ; n++)
+    {
+        order[n] = n;
+    }
+
+    mt19937 rng(cfg.seed);
+    shuffle(order.begin(), order.end(), rng);
+
+    vector<uint32_t> words(nodes * cfg.stride / WORD_SIZE, 0);
+    for(uint32_t n = 0 ; n < nodes ; n++)
+    {
+        uint32_t next = order[(n + 1) % nodes];
+        words[order[n] * cfg.stride / WORD_SIZE] = DATA_BASE + next * cfg.stride;
+    }
+
+    prog.loadConst(REG_T1, DATA_BASE + order[0] * cfg.stride);
+    countedLoop(prog, cfg.iterations, [&]()
+    {
+        prog.immediate(OP_LW, REG_T1, REG_T1, 0);
+    });
+    prog.halt();
+    prog.data(DATA_BASE, words);
+}
+
+//A branch on every flag of the table, skipping two instructions when taken.
+static void genBranch(ProgramBuilder & prog, const WorkloadConfig & cfg)
+{
+    uint32_t flags = cfg.footprint / WORD_SIZE;
+    vector<uint32_t> words(flags);
+
+    mt19937 rng(cfg.seed);
+    for(uint32_t f = 0 ; f < flags ; f++)
+    {
+        words[f] = rng() % 100 < cfg.taken;
+    }
+
+    countedLoop(prog, cfg.iterations, [&]()
+    {
+        int inner = prog.newLabel();
+        int skip = prog.newLabel();
+        prog.loadConst(REG_T1, DATA_BASE);
+        prog.loadConst(REG_T2, DATA_BASE + flags * WORD_SIZE);
+        prog.bind(inner);
+        prog.immediate(OP_LW, REG_T3, REG_T1, 0);
+        prog.immediate(OP_ADDIU, REG_T1, REG_T1, WORD_SIZE);
+        prog.aluR(FUN_ADDU, REG_T5, REG_T5, REG_T3);
+        prog.branch(OP_BNE, REG_T3, REG_ZERO, skip);
+        prog.nop();
+        prog.immediate(OP_ADDIU, REG_T4, REG_T4, 1);
+        prog.aluR(FUN_ADDU, REG_T6, REG_T6, REG_T4);
+        prog.bind(skip);
+        prog.branch(OP_BNE, REG_T1, REG_T2, inner);
+        prog.nop();
+    });
+
+    prog.halt();
+    prog.data(DATA_BASE, words);
+}
+
+//The counter ends up at --iterations. A set flag stores the value just loaded back to
+//the counter between the LL and the SC, which makes the SC fail.
+static void genLLSC(ProgramBuilder & prog, const WorkloadConfig & cfg)
+{
+    vector<uint32_t> words(1 + LLSC_FLAGS);
+
+    mt19937 rng(cfg.seed);
+    for(uint32_t f = 0 ; f < LLSC_FLAGS ; f++)
+    {
+        words[1 + f] = rng() % 100 < cfg.contention;
+    }
+
+    //$t2 is the counter, $t6 the offset of the next flag.
+    prog.loadConst(REG_T2, LLSC_COUNTER);
+    prog.loadConst(REG_T6, 0);
+
+    countedLoop(prog, cfg.iterations, [&]()
+    {
+        int retry = prog.newLabel();
+        int store = prog.newLabel();
+        prog.bind(retry);
+        prog.immediate(OP_LL, REG_T1, REG_T2, 0);
+        prog.aluR(FUN_ADDU, REG_T7, REG_T6, REG_T2);
+        prog.immediate(OP_LW, REG_T3, REG_T7, WORD_SIZE);
+        prog.immediate(OP_ADDIU, REG_T6, REG_T6, WORD_SIZE);
+        prog.immediate(OP_ANDI, REG_T6, REG_T6, LLSC_FLAGS * WORD_SIZE - 1);
+        prog.branch(OP_BEQ, REG_T3, REG_ZERO, store);
+        prog.immediate(OP_ADDIU, REG_T4, REG_T1, 1);
+        prog.immediate(OP_SW, REG_T1, REG_T2, 0);
+        prog.bind(store);
+        prog.immediate(OP_SC, REG_T4, REG_T2, 0);
+        prog.branch(OP_BEQ, REG_T4, REG_ZERO, retry);
+        prog.nop();
+    });
+
+    prog.halt();
+    prog.data(LLSC_COUNTER, words);
+}
+
+void printUsage()
+{
+    cout << "Usage: ./workload_gen stream|chase|branch|llsc [options]" << endl
+         << "  --footprint <bytes>  data touched by stream, chase and branch (default: 16384)" << endl
+         << "  --stride <bytes>     stream and chase: bytes between accesses (default: 4 for" << endl
+         << "                       stream, 64 for chase)" << endl
+         << "  --iterations <n>     passes over the data, loads for chase, increments for llsc" << endl
+         << "                       (default: 16, 100000 for chase and llsc)" << endl
+         << "  --write              stream: store a running sum back to every element" << endl
+         << "  --taken <percent>    branch: how often the data-dependent branch is taken" << endl
+         << "                       (default: 50)" << endl
+         << "  --contention <pct>   llsc: how often an SC fails and retries (default: 10)" << endl
+         << "  --seed <n>           for the random layouts and patterns (default: 1)" << endl
+         << "  --asm <file>         write assembly for bin/mips-linux-gnu-as" << endl
+         << "  --bin <file>         write the program image" << endl;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 2)
+    {
+        printUsage();
+        return -EINVAL;
+    }
+
+    WorkloadConfig cfg;
+    cfg.footprint = 16384;
+    cfg.stride = 0;
+    cfg.iterations = 0;
+    cfg.taken = 50;
+    cfg.contention = 10;
+    cfg.write = false;
+    cfg.seed = 1;
+
+    const char *kinds[] = { "stream", "chase", "branch", "llsc" };
+    int kind = 0;
+    while(kind < 4 && strcmp(argv[1], kinds[kind]) != 0)
+    {
+        kind++;
+    }
+
+    if(kind == 4)
+    {
+        printUsage();
+        return -EINVAL;
+    }
+    cfg.kind = static_cast<WorkloadKind>(kind);
+
+    const char *asmFile = NULL;
+    const char *binFile = NULL;
+
+    for(int i = 2 ; i < argc ; i++)
+    {
+        const char *opt = argv[i];
+
+        if(strcmp(opt, "--write") == 0)
+        {
+            cfg.write = true;
+            continue;
+        }
+
+        if(i + 1 >= argc)
+        {
+            printUsage();
+            return -EINVAL;
+        }
+
+        const char *arg = argv[++i];
+        uint32_t value = strtoul(arg, NULL, 0);
+        int ret = 0;
+
+        if(strcmp(opt, "--footprint") == 0)
+        {
+            cfg.footprint = value;
+        }
+        else if(strcmp(opt, "--stride") == 0)
+        {
+            cfg.stride = value;
+            ret = (value && value % WORD_SIZE == 0 && value <= 0x7fff) ? 0 : -EINVAL;
+        }
+        else if(strcmp(opt, "--iterations") == 0)
+        {
+            cfg.iterations = value;
+            ret = value ? 0 : -EINVAL;
+        }
+        else if(strcmp(opt, "--taken") == 0)
+        {
+            cfg.taken = value;
+            ret = value <= 100 ? 0 : -EINVAL;
+        }
+        else if(strcmp(opt, "--contention") == 0)
+        {
+            cfg.contention = value;
+            ret = value < 100 ? 0 : -EINVAL;
+        }
+        else if(strcmp(opt, "--seed") == 0)
+        {
+            cfg.seed = value;
+        }
+        else if(strcmp(opt, "--asm") == 0)
+        {
+            asmFile = arg;
+        }
+        else if(strcmp(opt, "--bin") == 0)
+        {
+            binFile = arg;
+        }
+        else
+        {
+            ret = -EINVAL;
+        }
+
+        if(ret)
+        {
+            cout << "Invalid argument " << opt << " " << arg << endl;
+            return -EINVAL;
+        }
+    }
+
+    if(!cfg.stride)
+    {
+        cfg.stride = cfg.kind == WL_CHASE ? 64 : WORD_SIZE;
+    }
+    if(!cfg.iterations)
+    {
+        cfg.iterations = (cfg.kind == WL_CHASE || cfg.kind == WL_LLSC) ? 100000 : 16;
+    }
+
+    //Everything has to fit in memory, and there has to be something to walk.
+    if(cfg.kind == WL_LLSC)
+    {
+        cfg.footprint = (1 + LLSC_FLAGS) * WORD_SIZE;
+    }
+
+    if(cfg.footprint < cfg.stride || cfg.footprint % WORD_SIZE || cfg.footprint > MAX_PROGRAM_SIZE - DATA_BASE)
+    {
+        cout << "The footprint must be a multiple of " << WORD_SIZE << " between the stride and "
+             << MAX_PROGRAM_SIZE - DATA_BASE << " bytes" << endl;
+        return -EINVAL;
+    }
+
+    if(!asmFile && !binFile)
+    {
+        printUsage();
+        return -EINVAL;
+    }
+
+    ProgramBuilder prog;
+    switch(cfg.kind)
+    {
+        case WL_STREAM:
+            genStream(prog, cfg);
+            break;
+        case WL_CHASE:
+            genChase(prog, cfg);
+            break;
+        case WL_BRANCH:
+            genBranch(prog, cfg);
+            break;
+        case WL_LLSC:
+            genLLSC(prog, cfg);
+            break;
+    }
+
+    if(prog.getCodeSize() > DATA_BASE)
+    {
+        cout << "The generated code doesn't fit below the data" << endl;
+        return -EINVAL;
+    }
+
+    stringstream comment;
+    comment << "Generated by: ./workload_gen";
+    for(int i = 1 ; i < argc ; i++)
+    {
+        comment << " " << argv[i];
+    }
+
+    if(asmFile && prog.writeAsm(asmFile, comment.str()))
+    {
+        return -EIO;
+    }
+
+    if(binFile && prog.writeImage(binFile))
+    {
+        return -EIO;
+    }
+
+    return 0;
+}
@@ -0,0 +1,26 @@
+# Branches with known patterns, 24 passes of a loop: one alternates taken and not
+# taken, one is taken twice then not taken, and the loop branch is taken every time
+# but the last. The goldens branch_pattern_<kind>.out are the output of
+# ./sampled_sim --detailed --bp <kind> for each predictor kind; the other goldens are
+# from ./sampled_sim --detailed --dumps --bp gshare and must not change with the kind.
+.set noreorder
+addi $t0, $zero, 24
+loop:
+andi $t1, $t0, 1
+beq $t1, $zero, even
+nop
+addi $s0, $s0, 1
+even:
+addi $t2, $t2, 1
+addi $t3, $t2, -3
+bne $t3, $zero, skip
+nop
+addi $t2, $zero, 0
+addi $s1, $s1, 1
+skip:
+addi $t0, $t0, -1
+bne $t0, $zero, loop
+nop
+sw $s0, 0x100($zero)
+sw $s1, 0x104($zero)
+.word 0xfeedfeed
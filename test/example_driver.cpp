@@ -1,47 +1,15 @@
 #include <iostream>
 #include <iomanip>
-#include <fstream>
 #include <errno.h>
 #include "../src/MemoryStore.h"
 #include "../src/RegisterInfo.h"
-#include "../src/EndianHelpers.h"
 #include "../src/DriverFunctions.h"
+#include "../src/ProgramLoader.h"
 
 using namespace std;
 
 static MemoryStore *mem;
 
-int initMemory(ifstream & inputProg)
-{
-    if(inputProg && mem)
-    {
-        uint32_t curVal = 0;
-        uint32_t addr = 0;
-
-        while(inputProg.read((char *)(&curVal), sizeof(uint32_t)))
-        {
-            curVal = ConvertWordToBigEndian(curVal);
-            int ret = mem->setMemValue(addr, curVal, WORD_SIZE);
-
-            if(ret)
-            {
-                cout << "Could not set memory value!" << endl;
-                return -EINVAL;
-            }
-
-            //We're reading 4 bytes each time...
-            addr += 4;
-        }
-    }
-    else
-    {
-        cout << "Invalid file stream or memory image passed, could not initialise memory values" << endl;
-        return -EINVAL;
-    }
-
-    return 0;
-}
-
 int main(int argc, char **argv)
 {
     if(argc != 2)
@@ -50,12 +18,9 @@ int main(int argc, char **argv)
         return -EINVAL;
     }
 
-    ifstream prog;
-    prog.open(argv[1], ios::binary | ios::in);
-
     mem = createMemoryStore();
 
-    if(initMemory(prog))
+    if(loadProgram(argv[1], mem))
     {
         return -EBADF;
     }
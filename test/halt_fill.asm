@@ -0,0 +1,18 @@
+# Loads and stores missing in a non-blocking D-cache with critical word first, the
+# last load right before the end of the program, which has to wait for its fill.
+# The goldens are from ./sampled_sim --detailed --dumps --dc 1024:16:1:9:4:2.
+# Saving a checkpoint mid-run, with --save-checkpoint ck --at 12 instead of --dumps,
+# then running ./sampled_sim --detailed --dumps --restore ck must write the same dumps.
+.set noreorder
+addi $t0, $zero, 0x55
+sw $t0, 0x20c($zero)
+lw $s0, 0x200($zero)
+lw $s1, 0x20c($zero)
+lw $s3, 0x300($zero)
+addu $s4, $s0, $s1
+addu $s4, $s4, $s3
+addi $s5, $zero, 0x66
+lw $s2, data($zero)
+.word 0xfeedfeed
+data:
+.word 0x1234
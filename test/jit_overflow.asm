@@ -0,0 +1,34 @@
+# Overflow exceptions in code translated by ./project1_sim --jit: one in the middle of
+# a loop body, after a store in the same block, and one in the delay slot of a taken
+# branch. The handler at 0x8000 counts them in $k0.
+# The goldens are from ./project1_sim; --threaded and --jit must write the same
+# reg_state.out and mem_state.out.
+.set noreorder
+lui $s1, 0x7fff
+ori $s1, $s1, 0xfff0
+addi $t0, $zero, 0x100
+loop:
+sw $s1, 0($t0)
+addi $t0, $t0, 4
+addi $s1, $s1, 4
+addi $s2, $s2, 1
+beq $zero, $zero, loop
+nop
+slot:
+lui $s3, 0x7fff
+ori $s3, $s3, 0xfffd
+loop2:
+addi $s4, $s4, 1
+bne $s4, $zero, loop2
+addi $s3, $s3, 1
+.word 0xfeedfeed
+.org 0x8000
+addi $k0, $k0, 1
+addi $t1, $k0, -2
+beq $t1, $zero, done
+nop
+j slot
+nop
+done:
+sw $k0, 0x180($zero)
+.word 0xfeedfeed
@@ -0,0 +1,30 @@
+# Stores into code that has already been translated by ./project1_sim --jit: a
+# half-word store into the immediate of the next instruction in the same block, on
+# every pass of a loop, and a word store over a function that has already run once.
+# The goldens are from ./project1_sim; --threaded and --jit must write the same
+# reg_state.out and mem_state.out.
+.set noreorder
+addi $t0, $zero, 4
+addi $s4, $zero, patch
+loop:
+addi $t1, $t1, 1
+sh $t1, 2($s4)
+patch:
+addi $s1, $s1, 0
+addi $t0, $t0, -1
+bne $t0, $zero, loop
+nop
+jal fn
+nop
+lui $t2, 0x2252
+ori $t2, $t2, 0x0010
+sw $t2, fn($zero)
+jal fn
+nop
+sw $s1, 0x100($zero)
+sw $s2, 0x104($zero)
+.word 0xfeedfeed
+fn:
+addi $s2, $s2, 1
+jr $ra
+nop
@@ -0,0 +1,31 @@
+# A store into a block of code, with an exclusive L2 under split L1 caches. Both L1
+# caches hold the block; the D-cache evicts it dirty, then the I-cache evicts its
+# clean, older copy, which must not overwrite the store in the L2.
+# The goldens are from ./sampled_sim --detailed --dumps --ic 64:16:1:5 --dc 64:16:1:5
+# --l2 1024:16:4:20 --l2-policy exclusive.
+.set noreorder
+addi $t0, $zero, 0x5555
+sw $t0, slot($zero)
+lw $t1, far($zero)
+beq $zero, $zero, next
+nop
+slot:
+.word 0
+next:
+nop
+nop
+nop
+nop
+nop
+nop
+nop
+nop
+nop
+nop
+nop
+nop
+nop
+nop
+far:
+lw $t2, slot($zero)
+.word 0xfeedfeed
@@ -1,4 +1,7 @@
 # A simple test case that includes a load-use stall and a branch.
+# ./sampled_sim --detailed --save-checkpoint ck --at 10, then
+# ./sampled_sim --detailed --dumps --restore ck must write the same reg_state.out,
+# mem_state.out and sim_stats.out, and load_use_restore_pipe_state.out.
 .set noreorder
 addi $t4, $zero, next+4;
 lw $t0, 0($t4);
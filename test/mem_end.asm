@@ -0,0 +1,13 @@
+# The end of the program in the last word of memory that can be read, at 0xfff8,
+# right after code that only runs there. The goldens are from ./project1_sim;
+# --threaded and --jit must write the same reg_state.out and mem_state.out, and like
+# the interpreter must not report any access out of range.
+.set noreorder
+addi $t0, $zero, 0x77
+j top
+nop
+.org 0xfff0
+top:
+sw $t0, 0x100($zero)
+addi $t1, $t0, 1
+.word 0xfeedfeed